@@ -0,0 +1,74 @@
+#include "core.h"
+
+/* Arenas hand memory out of large blocks, one allocation after the other,
+ * and give it all back at once.  What one load makes so lies together in
+ * the order it was made, and nothing of it can be forgotten when the next
+ * load replaces it. */
+
+#define ARENA_BLOCK (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_block {
+	arena_block *next;
+	size_t size;
+};
+
+static char *block_data(arena_block *b);
+
+void arena_init(arena *a)
+{
+	a->head = 0;
+	a->used = 0;
+}
+
+/* n bytes aligned for anything, valid until the arena is freed */
+void *arena_alloc(arena *a, size_t n)
+{
+	n = (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+	if (!a->head || a->used + n > a->head->size) {
+		/* larger requests get a block of their own; the rest of the
+		 * last one stays unused */
+		size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+		arena_block *b = malloc(ARENA_ALIGN + size);
+		if (!b) {
+			fprintf(stderr, "error: out of memory for %lu bytes\n", (unsigned long) size);
+			abort();
+		}
+		b->next = a->head;
+		b->size = size;
+		a->head = b;
+		a->used = 0;
+	}
+
+	void *p = block_data(a->head) + a->used;
+	a->used += n;
+
+	return p;
+}
+
+void *arena_copy(arena *a, void const *src, size_t n)
+{
+	void *p = arena_alloc(a, n);
+	memcpy(p, src, n);
+
+	return p;
+}
+
+/* frees everything allocated from a, which is empty again afterwards */
+void arena_free(arena *a)
+{
+	while (a->head) {
+		arena_block *b = a->head;
+		a->head = b->next;
+		free(b);
+	}
+	a->used = 0;
+}
+
+/* low level */
+static char *block_data(arena_block *b)
+{
+	/* malloc aligns for anything, the header takes no more than this */
+	return (char *) b + ARENA_ALIGN;
+}
@@ -0,0 +1,744 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bake.h"
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/* a growing buffer the cache is compiled into */
+typedef struct {
+	unsigned char *p;
+	size_t n;
+	size_t cap;
+} blob;
+
+static enum state const group_state[NGROUPS] = { ST_IDLE, ST_IDLE, ST_WALK };
+static char const * const group_key[NGROUPS] = { "players", "objects", "enemies" };
+
+static bool compile(blob *out, char const *root, char const *conf);
+static bool add_source(blob *out, char const *root, char const *file, bake_source **src, uint32_t *n);
+static void put_grid(blob *out, bake_grid *bg, line_grid const *g);
+static void put_rule(blob *out, bake_rule *br, entity_rule const *er, char const *asset);
+static void put_params(bake_params *p, entity_rule const *er);
+static void get_params(entity_rule *er, bake_params const *p);
+static void get_anim(bake const *b, arena *mem, animation_rule *a, bake_anim const *ba, bool reuse);
+static void refit_entity(entity_state *es);
+static bool put_group(blob *out, bake_header *h, enum group g, json_t *game, json_t *ent, entity_rule const *rules, bake_params **custom);
+static bool stat_file(char const *path, int64_t *mtime, int64_t *size);
+static bool map_cache(bake *b, char const *path);
+static bool check_cache(bake const *b);
+static bool fresh(bake const *b, char const *root);
+static uint32_t add(blob *out, void const *src, size_t n);
+static uint32_t add_str(blob *out, char const *s);
+static void *at(bake const *b, uint32_t off);
+static bool fits(bake const *b, uint32_t off, size_t n, size_t size);
+
+/* opening */
+
+/* Opens the cache of the config conf, compiling it again if it is missing,
+ * belongs to an other version or any file it was made from changed. */
+bool bake_open(bake *b, char const *root, char const *conf)
+{
+	char path[MAX_PATH];
+	snprintf(path, MAX_PATH, "%s/%s/%s", root, CONF_DIR, BAKE_FILE);
+
+	if (map_cache(b, path)) {
+		if (check_cache(b) && fresh(b, root)) {
+			return true;
+		}
+		bake_close(b);
+	}
+
+	blob out = { 0 };
+	if (!compile(&out, root, conf)) {
+		free(out.p);
+		return false;
+	}
+
+	FILE *fd = fopen(path, "wb");
+	if (!fd || fwrite(out.p, 1, out.n, fd) != out.n) {
+		fprintf(stderr, "Warning: could not write the config cache `%s'\n", path);
+	}
+	if (fd) { fclose(fd); }
+
+	*b = (bake) { map: out.p, size: out.n, mapped: false, hdr: (bake_header const *) out.p };
+
+	return true;
+}
+
+/* compiles the cache whether it is up to date or not */
+bool bake_build(char const *root, char const *conf)
+{
+	char path[MAX_PATH];
+	snprintf(path, MAX_PATH, "%s/%s/%s", root, CONF_DIR, BAKE_FILE);
+	remove(path);
+
+	bake b;
+	if (!bake_open(&b, root, conf)) { return false; }
+	bake_close(&b);
+
+	return true;
+}
+
+void bake_close(bake *b)
+{
+#ifndef _WIN32
+	if (b->mapped) {
+		munmap(b->map, b->size);
+	} else {
+		free(b->map);
+	}
+#else
+	free(b->map);
+#endif
+	b->map = 0;
+	b->hdr = 0;
+}
+
+/* reading */
+
+/* The rules of all entities, as load_entity_rules would make them, with
+ * no textures yet, out of mem.  Returns how many there are. */
+int bake_rules(bake const *b, arena *mem, entity_rule **rules)
+{
+	int i, k, n = b->hdr->nrules;
+	bake_rule const *br = at(b, b->hdr->rules);
+
+	*rules = arena_alloc(mem, sizeof(entity_rule) * n);
+	for (i = 0; i < n; i++) {
+		entity_rule *er = &(*rules)[i];
+		get_params(er, &br[i].params);
+		er->start_dim = (rect) { x: 0, y: 0, w: br[i].w, h: br[i].h };
+		er->tex = 0;
+		er->sheet = (point) { 0, 0 };
+
+		for (k = 0; k < NSTATES; k++) {
+			get_anim(b, mem, &er->anim[k], &br[i].anim[k], false);
+		}
+	}
+
+	return n;
+}
+
+/* the sprite sheet of a rule, valid until the cache is closed */
+char const *bake_asset(bake const *b, int rule)
+{
+	bake_rule const *br = at(b, b->hdr->rules);
+	return br[rule].asset ? at(b, br[rule].asset) : 0;
+}
+
+char const *bake_background(bake const *b)
+{
+	return b->hdr->background ? at(b, b->hdr->background) : 0;
+}
+
+/* the finish, the messages and the level, with the triggers indexed; all
+ * but the level, which has an arena of its own, out of mem */
+void bake_world(bake const *b, arena *mem, world *w)
+{
+	bake_header const *h = b->hdr;
+	unsigned i;
+
+	w->finish.pos = h->finish;
+	w->finish.win = (message) { pos: h->finish, when: MSG_NEVER };
+	w->finish.loss = (message) { pos: h->finish, when: MSG_NEVER };
+
+	bake_message const *bm = at(b, h->msgs);
+	w->msg.timeout = h->msg_timeout;
+	w->msg.n = h->nmsgs;
+	w->msg.msgs = arena_alloc(mem, sizeof(message) * h->nmsgs);
+	for (i = 0; i < h->nmsgs; i++) {
+		w->msg.msgs[i] = (message) { pos: { x: bm[i].x, y: bm[i].y }, when: bm[i].when };
+	}
+	index_triggers(w, mem);
+
+	bake_level(b, &w->level);
+}
+
+/* the level's lines and grids alone, for a level file that changed */
+void bake_level(bake const *b, level *l)
+{
+	bake_header const *h = b->hdr;
+	unsigned i;
+
+	arena_init(&l->mem);
+	l->nvertical = h->nvertical;
+	l->nhorizontal = h->nhorizontal;
+	l->vertical = arena_copy(&l->mem, at(b, h->vertical), sizeof(line) * h->nvertical);
+	l->horizontal = arena_copy(&l->mem, at(b, h->horizontal), sizeof(line) * h->nhorizontal);
+
+	bake_grid const *bg[2] = { &h->vgrid, &h->hgrid };
+	line_grid *g[2] = { &l->vgrid, &l->hgrid };
+	for (i = 0; i < 2; i++) {
+		int nc = bg[i]->np * bg[i]->ns;
+		int const *start = at(b, bg[i]->start);
+		*g[i] = (line_grid) { p0: bg[i]->p0, s0: bg[i]->s0, cell: bg[i]->cell, np: bg[i]->np, ns: bg[i]->ns };
+		g[i]->start = arena_copy(&l->mem, start, sizeof(int) * (nc + 1));
+		g[i]->idx = arena_copy(&l->mem, at(b, bg[i]->idx), sizeof(int) * start[nc]);
+	}
+	index_columns(l);
+	l->active_radius = h->active_radius;
+}
+
+bool bake_level_differs(bake const *b, level const *l)
+{
+	bake_header const *h = b->hdr;
+
+	return h->nvertical != (unsigned) l->nvertical || h->nhorizontal != (unsigned) l->nhorizontal ||
+	       memcmp(l->vertical, at(b, h->vertical), sizeof(line) * h->nvertical) ||
+	       memcmp(l->horizontal, at(b, h->horizontal), sizeof(line) * h->nhorizontal);
+}
+
+/* Every entity at its spawn, the logo and the intro centred on a screen
+ * of the given size, the groups out of mem.  A spawn with a rule of its
+ * own gets a copy of its entity's rule, so this comes after the textures
+ * are set in rules. */
+void bake_game(bake const *b, arena *mem, game_state *gs, point const *screen, entity_rule const *rules)
+{
+	bake_header const *h = b->hdr;
+	bake_params const *custom = at(b, h->custom);
+	int g;
+	unsigned i;
+
+	for (g = 0; g < NGROUPS; g++) {
+		bake_spawn const *sp = at(b, h->spawns[g]);
+		alloc_group(&gs->entities[g], mem, h->nspawns[g]);
+		for (i = 0; i < h->nspawns[g]; i++) {
+			entity_state a;
+			a.spawn.x = sp[i].x;
+			a.spawn.y = sp[i].y;
+			init_entity_state(&a, &rules[sp[i].rule], group_state[g], 0);
+			if (sp[i].custom >= 0) {
+				entity_rule *c = arena_alloc(mem, sizeof(entity_rule));
+				*c = *a.rule;
+				get_params(c, &custom[sp[i].custom]);
+				a.rule = c;
+			}
+			group_put(&gs->entities[g], i, &a);
+		}
+	}
+
+	int32_t const which[2] = { h->logo, h->intro };
+	entity_state *intro[2] = { &gs->logo, &gs->intro };
+	for (i = 0; i < 2; i++) {
+		if (which[i] < 0) {
+			fprintf(stderr, "Warning: No intro found for `%s'\n", i == 0 ? "logo" : "intro");
+			intro[i]->active = false;
+			continue;
+		}
+		// TODO
+		intro[i]->spawn.w = 640;
+		intro[i]->spawn.h = 480;
+		intro[i]->spawn.x = (screen->x - 640) / 2;
+		intro[i]->spawn.y = (screen->y - 480) / 2;
+		init_entity_state(intro[i], &rules[which[i]], ST_IDLE, 0);
+	}
+}
+
+/* Brings the n rules, and the rules of their own that entities on custom
+ * spawns have, up to date with b in place, keeping their textures and
+ * the entities' state but for the boxes the rules give them.  Nothing changes and false comes back when b no
+ * longer has the same entities at the same spawns.  Animations that grew
+ * take new arrays out of mem, the rules' arena; the old ones stay in it
+ * until the next full load. */
+bool bake_update_rules(bake const *b, arena *mem, game_state *gs, entity_rule *rules, int n)
+{
+	bake_header const *h = b->hdr;
+	uintptr_t lo = (uintptr_t) rules, hi = (uintptr_t) (rules + n);
+	int g, i, k;
+
+	if (h->nrules != (unsigned) n) { return false; }
+	for (g = 0; g < NGROUPS; g++) {
+		bake_spawn const *sp = at(b, h->spawns[g]);
+		group const *gr = &gs->entities[g];
+		if (h->nspawns[g] != (unsigned) gr->n) { return false; }
+		for (i = 0; i < gr->n; i++) {
+			uintptr_t r = (uintptr_t) gr->rule[i];
+			bool own = r < lo || r >= hi;
+			if (own != (sp[i].custom >= 0) || (!own && gr->rule[i] != &rules[sp[i].rule])) {
+				return false;
+			}
+		}
+	}
+
+	bake_rule const *br = at(b, h->rules);
+	for (i = 0; i < n; i++) {
+		get_params(&rules[i], &br[i].params);
+		rules[i].start_dim = (rect) { x: 0, y: 0, w: br[i].w, h: br[i].h };
+		for (k = 0; k < NSTATES; k++) {
+			get_anim(b, mem, &rules[i].anim[k], &br[i].anim[k], true);
+		}
+	}
+
+	bake_params const *custom = at(b, h->custom);
+	for (g = 0; g < NGROUPS; g++) {
+		bake_spawn const *sp = at(b, h->spawns[g]);
+		group *gr = &gs->entities[g];
+		for (i = 0; i < gr->n; i++) {
+			if (sp[i].custom < 0) { continue; }
+			entity_rule *c = (entity_rule *) gr->rule[i];
+			*c = rules[sp[i].rule];
+			get_params(c, &custom[sp[i].custom]);
+		}
+	}
+
+	for (g = 0; g < NGROUPS; g++) {
+		group *gr = &gs->entities[g];
+		for (i = 0; i < gr->n; i++) {
+			entity_state es;
+			group_get(gr, i, &es);
+			refit_entity(&es);
+			group_put(gr, i, &es);
+		}
+	}
+
+	return true;
+}
+
+/* compiling */
+static bool compile(blob *out, char const *root, char const *conf)
+{
+	bake_header h = { version: BAKE_VERSION, nstates: NSTATES };
+	memcpy(h.magic, BAKE_MAGIC, 4);
+	add(out, &h, sizeof(bake_header));
+
+	bake_source *src = 0;
+	uint32_t nsrc = 0;
+	/* the messages and rules as loaded from JSON, gone once copied */
+	arena mem;
+	arena_init(&mem);
+	bool ok = add_source(out, root, conf, &src, &nsrc);
+
+	char const *path = set_path("%s/%s/%s", root, CONF_DIR, conf);
+	json_error_t err;
+	json_t *game = json_load_file(path, 0, &err);
+	if (*err.text != 0) {
+		fprintf(stderr, "error: in %s:%d: %s\n", path, err.line, err.text);
+		free(src);
+		return false;
+	}
+
+	/* finish and messages */
+	finish fin;
+	msg_info mi;
+	if (!load_finish(&fin, game) || !load_messages(&mi, &mem, game)) {
+		json_decref(game);
+		arena_free(&mem);
+		free(src);
+		return false;
+	}
+	h.finish = fin.pos;
+	h.msg_timeout = mi.timeout;
+	h.nmsgs = mi.n;
+	bake_message *bm = malloc(sizeof(bake_message) * (mi.n ? mi.n : 1));
+	unsigned i;
+	for (i = 0; i < mi.n; i++) {
+		bm[i] = (bake_message) { mi.msgs[i].pos.x, mi.msgs[i].pos.y, mi.msgs[i].when };
+	}
+	h.msgs = add(out, bm, sizeof(bake_message) * mi.n);
+	free(bm);
+
+	/* the level, sorted and indexed by load_level */
+	level lev;
+	json_t *lj = load_level(&lev, game, root);
+	if (!lj) {
+		json_decref(game);
+		arena_free(&mem);
+		free(src);
+		return false;
+	}
+	ok = ok && add_source(out, root, json_string_value(json_object_get(game, "level")), &src, &nsrc);
+	h.active_radius = lev.active_radius;
+	h.nvertical = lev.nvertical;
+	h.vertical = add(out, lev.vertical, sizeof(line) * lev.nvertical);
+	h.nhorizontal = lev.nhorizontal;
+	h.horizontal = add(out, lev.horizontal, sizeof(line) * lev.nhorizontal);
+	put_grid(out, &h.vgrid, &lev.vgrid);
+	put_grid(out, &h.hgrid, &lev.hgrid);
+	char const *bg = json_string_value(json_object_get(lj, "resource"));
+	h.background = bg ? add_str(out, bg) : 0;
+	destroy_level(&lev);
+	json_decref(lj);
+
+	/* the entity rules, one file each besides the list of them */
+	json_t *eo = json_object_get(game, "entities");
+	if (!eo) {
+		fprintf(stderr, "Error: No entities defined, need player\n");
+		json_decref(game);
+		arena_free(&mem);
+		free(src);
+		return false;
+	}
+	char const *file = json_string_value(json_object_get(eo, "resource"));
+	ok = ok && add_source(out, root, file, &src, &nsrc);
+
+	entity_rule *rules;
+	path = set_path("%s/%s/%s", root, CONF_DIR, file);
+	json_t *ent = load_entity_rules(root, path, &mem, &rules);
+	if (!ent) {
+		fprintf(stderr, "Error: Could not load entities\n");
+		json_decref(game);
+		arena_free(&mem);
+		free(src);
+		return false;
+	}
+
+	int n = json_object_size(ent);
+	bake_rule *br = calloc(n ? n : 1, sizeof(bake_rule));
+	json_t *o;
+	char const *name;
+	int k = 0;
+	json_object_foreach(ent, name, o) {
+		if (ok && !add_source(out, root, json_string_value(json_object_get(o, "resource")), &src, &nsrc)) {
+			fprintf(stderr, "error: no resource for `%s'\n", name);
+			ok = false;
+		}
+		put_rule(out, &br[k], &rules[k], json_string_value(json_object_get(o, "asset")));
+		k += 1;
+	}
+	h.nrules = n;
+	h.rules = add(out, br, sizeof(bake_rule) * n);
+	free(br);
+
+	/* where everything spawns */
+	bake_params *custom = 0;
+	enum group g;
+	for (g = 0; g < NGROUPS; g++) {
+		ok = ok && put_group(out, &h, g, game, ent, rules, &custom);
+	}
+	h.custom = add(out, custom, sizeof(bake_params) * h.ncustom);
+	free(custom);
+
+	o = json_object_get(ent, "logo");
+	h.logo = o ? json_integer_value(json_object_get(o, "index")) : -1;
+	o = json_object_get(ent, "intro");
+	h.intro = o ? json_integer_value(json_object_get(o, "index")) : -1;
+
+	h.nsources = nsrc;
+	h.sources = add(out, src, sizeof(bake_source) * nsrc);
+	memcpy(out->p, &h, sizeof(bake_header));
+
+	free(src);
+	arena_free(&mem);
+	json_decref(ent);
+	json_decref(game);
+
+	return ok;
+}
+
+static bool add_source(blob *out, char const *root, char const *file, bake_source **src, uint32_t *n)
+{
+	if (!file) { return false; }
+
+	bake_source s = { path: add_str(out, file) };
+	if (!stat_file(set_path("%s/%s/%s", root, CONF_DIR, file), &s.mtime, &s.size)) {
+		return false;
+	}
+
+	*src = realloc(*src, sizeof(bake_source) * (*n + 1));
+	(*src)[*n] = s;
+	*n += 1;
+
+	return true;
+}
+
+static void put_grid(blob *out, bake_grid *bg, line_grid const *g)
+{
+	int nc = g->np * g->ns;
+	*bg = (bake_grid) { p0: g->p0, s0: g->s0, cell: g->cell, np: g->np, ns: g->ns };
+	if (!g->start) {
+		/* no lines: one empty cell count */
+		int zero = 0;
+		bg->start = add(out, &zero, sizeof(int));
+		bg->idx = bg->start;
+		return;
+	}
+	bg->start = add(out, g->start, sizeof(int) * (nc + 1));
+	bg->idx = add(out, g->idx, sizeof(int) * g->start[nc]);
+}
+
+static void put_rule(blob *out, bake_rule *br, entity_rule const *er, char const *asset)
+{
+	int k;
+
+	put_params(&br->params, er);
+	br->w = er->start_dim.w;
+	br->h = er->start_dim.h;
+	br->asset = asset ? add_str(out, asset) : 0;
+
+	for (k = 0; k < NSTATES; k++) {
+		animation_rule const *a = &er->anim[k];
+		bake_anim *ba = &br->anim[k];
+		/* an entity without even an idle animation */
+		ba->len = a->frames ? a->len : 0;
+		ba->period = a->frames ? a->period : 0;
+		ba->frames = add(out, a->frames, sizeof(unsigned) * ba->len);
+		ba->duration = add(out, a->duration, sizeof(unsigned) * ba->len);
+		ba->timeline = add(out, a->timeline, sizeof(unsigned) * ba->period);
+		ba->box[0] = a->box.x;
+		ba->box[1] = a->box.y;
+		ba->box[2] = a->box.w;
+		ba->box[3] = a->box.h;
+	}
+}
+
+static void put_params(bake_params *p, entity_rule const *er)
+{
+	*p = (bake_params) {
+		a_wide: er->a_wide,
+		a_high: er->a_high,
+		walk_dist: er->walk_dist,
+		jump_dist_x: er->jump_dist_x,
+		jump_dist_y: er->jump_dist_y,
+		jump_time: er->jump_time,
+		fall_dist: er->fall_dist,
+		has_gravity: er->has_gravity };
+}
+
+static void get_params(entity_rule *er, bake_params const *p)
+{
+	er->a_wide = p->a_wide;
+	er->a_high = p->a_high;
+	er->walk_dist = p->walk_dist;
+	er->jump_dist_x = p->jump_dist_x;
+	er->jump_dist_y = p->jump_dist_y;
+	er->jump_time = p->jump_time;
+	er->fall_dist = p->fall_dist;
+	er->has_gravity = p->has_gravity;
+}
+
+/* The animation ba, its arrays out of mem.  With reuse the arrays a has
+ * are written over where ba fits into them. */
+static void get_anim(bake const *b, arena *mem, animation_rule *a, bake_anim const *ba, bool reuse)
+{
+	if (!reuse || ba->len > a->len) {
+		a->frames = arena_alloc(mem, sizeof(unsigned) * ba->len);
+		a->duration = arena_alloc(mem, sizeof(unsigned) * ba->len);
+	}
+	if (!reuse || ba->period > a->period) {
+		a->timeline = arena_alloc(mem, sizeof(unsigned) * ba->period);
+	}
+	a->len = ba->len;
+	a->period = ba->period;
+	memcpy(a->frames, at(b, ba->frames), sizeof(unsigned) * ba->len);
+	memcpy(a->duration, at(b, ba->duration), sizeof(unsigned) * ba->len);
+	memcpy(a->timeline, at(b, ba->timeline), sizeof(unsigned) * ba->period);
+	a->box = (rect) { ba->box[0], ba->box[1], ba->box[2], ba->box[3] };
+}
+
+/* the hitbox and size an entity takes from its rule, leaving where its
+ * animation is */
+static void refit_entity(entity_state *es)
+{
+	es->hitbox = es->rule->anim[es->st].box;
+	es->spawn.w = es->rule->start_dim.w;
+	es->spawn.h = es->rule->start_dim.h;
+}
+
+/* the spawns of group g, as init_group used to read them */
+static bool put_group(blob *out, bake_header *h, enum group g, json_t *game, json_t *ent, entity_rule const *rules, bake_params **custom)
+{
+	json_t *objs = json_object_get(game, group_key[g]);
+	json_t *o, *spawn;
+	char const *name;
+	size_t j;
+
+	bake_spawn *sp = 0;
+	h->nspawns[g] = 0;
+	json_object_foreach(objs, name, o) {
+		json_t *entity = json_object_get(ent, name);
+		if (!entity) {
+			fprintf(stderr, "error: no entity `%s'\n", name);
+			free(sp);
+			return false;
+		}
+		int ei = json_integer_value(json_object_get(entity, "index"));
+		json_array_foreach(o, j, spawn) {
+			sp = realloc(sp, sizeof(bake_spawn) * (h->nspawns[g] + 1));
+			bake_spawn *s = &sp[h->nspawns[g]];
+			*s = (bake_spawn) {
+				rule: ei,
+				x: json_integer_value(json_array_get(spawn, 0)),
+				y: json_integer_value(json_array_get(spawn, 1)),
+				custom: -1 };
+
+			json_t *cr = json_array_get(spawn, 2);
+			if (cr) {
+				entity_rule c = rules[ei];
+				load_entity_rule(cr, &c, "custom-rule");
+				*custom = realloc(*custom, sizeof(bake_params) * (h->ncustom + 1));
+				put_params(&(*custom)[h->ncustom], &c);
+				s->custom = h->ncustom;
+				h->ncustom += 1;
+			}
+			h->nspawns[g] += 1;
+		}
+	}
+	h->spawns[g] = add(out, sp, sizeof(bake_spawn) * h->nspawns[g]);
+	free(sp);
+
+	return true;
+}
+
+/* low level */
+
+/* mtime in nanoseconds, so an edit within the second the cache was made in
+ * is still seen where the file system keeps them */
+static bool stat_file(char const *path, int64_t *mtime, int64_t *size)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+	*mtime = (int64_t) st.st_mtime * 1000000000;
+#ifndef _WIN32
+	*mtime += st.st_mtim.tv_nsec;
+#endif
+	*size = st.st_size;
+
+	return true;
+}
+
+static bool map_cache(bake *b, char const *path)
+{
+	FILE *fd = fopen(path, "rb");
+	if (!fd) { return false; }
+
+	bool ok = fseek(fd, 0, SEEK_END) == 0;
+	long n = ok ? ftell(fd) : 0;
+	if (n < (long) sizeof(bake_header)) {
+		fclose(fd);
+		return false;
+	}
+	b->size = n;
+
+#ifndef _WIN32
+	b->map = mmap(0, b->size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+	b->mapped = true;
+	if (b->map == MAP_FAILED) {
+		b->map = 0;
+		ok = false;
+	}
+#else
+	b->map = malloc(b->size);
+	b->mapped = false;
+	rewind(fd);
+	if (fread(b->map, 1, b->size, fd) != b->size) {
+		free(b->map);
+		b->map = 0;
+		ok = false;
+	}
+#endif
+	fclose(fd);
+	b->hdr = b->map;
+
+	return ok;
+}
+
+/* every offset the header and the records give lies within the file */
+static bool check_cache(bake const *b)
+{
+	bake_header const *h = b->hdr;
+	if (memcmp(h->magic, BAKE_MAGIC, 4) || h->version != BAKE_VERSION || h->nstates != NSTATES) {
+		return false;
+	}
+
+	size_t sz = b->size;
+	if (!fits(b, h->sources, h->nsources, sizeof(bake_source)) ||
+	    !fits(b, h->msgs, h->nmsgs, sizeof(bake_message)) ||
+	    !fits(b, h->vertical, h->nvertical, sizeof(line)) ||
+	    !fits(b, h->horizontal, h->nhorizontal, sizeof(line)) ||
+	    !fits(b, h->rules, h->nrules, sizeof(bake_rule)) ||
+	    !fits(b, h->custom, h->ncustom, sizeof(bake_params)) ||
+	    h->background >= sz) {
+		return false;
+	}
+
+	bake_grid const *bg[2] = { &h->vgrid, &h->hgrid };
+	int i, k;
+	for (i = 0; i < 2; i++) {
+		size_t nc = (size_t) bg[i]->np * bg[i]->ns;
+		if (!fits(b, bg[i]->start, nc + 1, sizeof(int)) ||
+		    !fits(b, bg[i]->idx, ((int const *) at(b, bg[i]->start))[nc], sizeof(int))) {
+			return false;
+		}
+	}
+
+	bake_rule const *br = at(b, h->rules);
+	for (i = 0; i < (int) h->nrules; i++) {
+		for (k = 0; k < NSTATES; k++) {
+			bake_anim const *a = &br[i].anim[k];
+			if (!fits(b, a->frames, a->len, sizeof(unsigned)) ||
+			    !fits(b, a->duration, a->len, sizeof(unsigned)) ||
+			    !fits(b, a->timeline, a->period, sizeof(unsigned))) {
+				return false;
+			}
+		}
+		if (br[i].asset >= sz) { return false; }
+	}
+
+	for (i = 0; i < NGROUPS; i++) {
+		if (!fits(b, h->spawns[i], h->nspawns[i], sizeof(bake_spawn))) {
+			return false;
+		}
+		bake_spawn const *sp = at(b, h->spawns[i]);
+		for (k = 0; k < (int) h->nspawns[i]; k++) {
+			if (sp[k].rule >= h->nrules || sp[k].custom >= (int32_t) h->ncustom) {
+				return false;
+			}
+		}
+	}
+
+	return h->logo < (int32_t) h->nrules && h->intro < (int32_t) h->nrules;
+}
+
+/* the files the cache was compiled from are unchanged */
+static bool fresh(bake const *b, char const *root)
+{
+	bake_source const *src = at(b, b->hdr->sources);
+	uint32_t i;
+	for (i = 0; i < b->hdr->nsources; i++) {
+		int64_t mtime, size;
+		char const *file = at(b, src[i].path);
+		if (!memchr(file, 0, b->size - src[i].path) ||
+		    !stat_file(set_path("%s/%s/%s", root, CONF_DIR, file), &mtime, &size) ||
+		    mtime != src[i].mtime || size != src[i].size) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* appends n bytes at the next multiple of 8 and returns where they went */
+static uint32_t add(blob *out, void const *src, size_t n)
+{
+	size_t off = (out->n + 7) & ~(size_t) 7;
+	if (off + n > out->cap) {
+		out->cap = (off + n) * 2;
+		out->p = realloc(out->p, out->cap);
+	}
+	memset(out->p + out->n, 0, off - out->n);
+	if (n) { memcpy(out->p + off, src, n); }
+	out->n = off + n;
+
+	return off;
+}
+
+static uint32_t add_str(blob *out, char const *s)
+{
+	return add(out, s, strlen(s) + 1);
+}
+
+static void *at(bake const *b, uint32_t off)
+{
+	return (char *) b->map + off;
+}
+
+static bool fits(bake const *b, uint32_t off, size_t n, size_t size)
+{
+	return off <= b->size && n <= (b->size - off) / size;
+}
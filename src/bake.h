@@ -0,0 +1,132 @@
+#ifndef FRIDGE_BAKE_H
+#define FRIDGE_BAKE_H
+
+/* The config cache: everything the game takes from the JSON files under
+ * conf/ -- the finish, the messages, the level's collision lines already
+ * sorted and indexed, the entity rules with their baked animations and
+ * where every entity spawns -- compiled into one file that is mapped and
+ * read in place at startup.  The cache names the files it was made from
+ * with their times and sizes; when any of them differs it is compiled
+ * again from the JSON.  The file is in the machine's byte order and laid
+ * out as
+ *
+ *   bake_header | everything else, 8 byte aligned, at the offsets the
+ *   header and the records give
+ *
+ * Offset 0 is the header, so a string offset of 0 means no string. */
+
+#include <stdint.h>
+
+#include "core.h"
+
+#define BAKE_MAGIC "FCFG"
+#define BAKE_VERSION 2
+#define BAKE_FILE "game.cache"
+
+/* a file the cache was compiled from, relative to conf/ */
+typedef struct {
+	uint32_t path;
+	uint32_t pad;
+	int64_t mtime; /* ns */
+	int64_t size;
+} bake_source;
+
+typedef struct {
+	int32_t x, y;
+	int32_t when;
+} bake_message;
+
+typedef struct {
+	int32_t p0, s0;
+	int32_t cell;
+	int32_t np, ns;
+	uint32_t start; /* np * ns + 1 ints */
+	uint32_t idx;
+} bake_grid;
+
+/* what a custom rule on a spawn can change */
+typedef struct {
+	double a_wide;
+	double a_high;
+	int32_t walk_dist;
+	int32_t jump_dist_x;
+	int32_t jump_dist_y;
+	int32_t jump_time;
+	int32_t fall_dist;
+	int32_t has_gravity;
+} bake_params;
+
+typedef struct {
+	uint32_t len;
+	uint32_t period;
+	uint32_t frames;   /* len unsigned */
+	uint32_t duration; /* len unsigned */
+	uint32_t timeline; /* period unsigned */
+	int32_t box[4];
+} bake_anim;
+
+typedef struct {
+	bake_params params;
+	int32_t w, h;
+	uint32_t asset;
+	uint32_t pad;
+	bake_anim anim[NSTATES];
+} bake_rule;
+
+typedef struct {
+	uint32_t rule;
+	int32_t x, y;
+	int32_t custom; /* index into the custom params, -1 for none */
+} bake_spawn;
+
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t nstates;
+	uint32_t nsources;
+	uint32_t sources;
+	point finish;
+	int32_t msg_timeout;
+	uint32_t nmsgs;
+	uint32_t msgs;
+	int32_t active_radius;
+	uint32_t nvertical;
+	uint32_t vertical;
+	uint32_t nhorizontal;
+	uint32_t horizontal;
+	bake_grid vgrid;
+	bake_grid hgrid;
+	uint32_t background;
+	uint32_t nrules;
+	uint32_t rules;
+	uint32_t ncustom;
+	uint32_t custom;
+	uint32_t nspawns[NGROUPS];
+	uint32_t spawns[NGROUPS];
+	int32_t logo;  /* rule index, -1 for none */
+	int32_t intro;
+} bake_header;
+
+typedef struct {
+	void *map;
+	size_t size;
+	bool mapped; /* or compiled into memory, when the cache was stale */
+	bake_header const *hdr;
+} bake;
+
+/* opening */
+bool bake_open(bake *b, char const *root, char const *conf);
+bool bake_build(char const *root, char const *conf);
+void bake_close(bake *b);
+
+/* reading */
+int bake_rules(bake const *b, arena *mem, entity_rule **rules);
+char const *bake_asset(bake const *b, int rule);
+char const *bake_background(bake const *b);
+void bake_world(bake const *b, arena *mem, world *w);
+void bake_level(bake const *b, level *l);
+bool bake_level_differs(bake const *b, level const *l);
+void bake_game(bake const *b, arena *mem, game_state *gs, point const *screen, entity_rule const *rules);
+bool bake_update_rules(bake const *b, arena *mem, game_state *gs, entity_rule *rules, int n);
+
+#endif
@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <time.h>
+
+#include "core.h"
+#include "bake.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Microbenchmarks of the collision, movement and animation code the
+ * simulation spends its ticks in, over the shipped level and over made up
+ * ones of 10^3 to 10^6 lines.  Every benchmark runs the same sequence of
+ * queries each time, drawn from a fixed seed.  The operations are timed in
+ * batches long enough for the clock; the percentiles are over the batches,
+ * each given as time per operation.  Cache misses are counted with
+ * perf_event_open where the kernel allows it. */
+
+#define ROOTVAR "FRIDGE_ROOT"
+#define GAME_CONF "game.json"
+
+#define NQUERIES 4096 /* a power of two */
+#define BOX_BATCH 8 /* divides NQUERIES */
+#define SAMPLES 101
+#define SAMPLE_NS 50000 /* the least a batch should take */
+#define MAX_LINES 1000000
+/* made up levels get about one line per this many square pixels */
+#define LINE_AREA (96 * 96)
+
+/* what the benchmarks run on: a level and queries into it */
+typedef struct {
+	char const *name;
+	level *lev;
+	rect box[NQUERIES];
+	point v[NQUERIES];
+	entity_event ev[NQUERIES];
+	entity_state e;
+	unsigned sink;
+} bench_ctx;
+
+typedef struct {
+	char const *name;
+	void (*run)(bench_ctx *c, int i);
+} benchmark;
+
+typedef struct {
+	int fd;
+} miss_counter;
+
+static void bench_collides(bench_ctx *c, int i);
+static void bench_collides_batch(bench_ctx *c, int i);
+static void bench_stands(bench_ctx *c, int i);
+static void bench_vector_move(bench_ctx *c, int i);
+static void bench_move(bench_ctx *c, int i);
+static void bench_anim(bench_ctx *c, int i);
+static void bench_have_collision(bench_ctx *c, int i);
+
+static benchmark const benchmarks[] = {
+	{ "collides_with_terrain", bench_collides },
+	{ "collides_with_terrain_batch", bench_collides_batch },
+	{ "stands_on_terrain", bench_stands },
+	{ "entity_vector_move", bench_vector_move },
+	{ "move_entity", bench_move },
+	{ "anim_frame", bench_anim },
+	{ "have_collision", bench_have_collision },
+};
+#define NBENCH (int) (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static bool shipped_level(level *l, char const *root);
+static void make_level(level *l, int n, uint32_t *seed);
+static void make_queries(bench_ctx *c, uint32_t *seed);
+static void make_rule(entity_rule *er);
+static void run_level(bench_ctx *c, char const *filter, miss_counter *mc);
+static void run_bench(bench_ctx *c, benchmark const *b, miss_counter *mc);
+static bool open_misses(miss_counter *mc);
+static void start_misses(miss_counter *mc);
+static long long stop_misses(miss_counter *mc);
+static void close_misses(miss_counter *mc);
+static long long now_ns(void);
+static uint32_t rnd(uint32_t *s);
+static int rnd_in(uint32_t *s, int lo, int hi);
+static int cmp_double(void const *x, void const *y);
+
+int main(int argc, char **argv)
+{
+	int i, max_lines = MAX_LINES;
+	char const *filter = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (streq(argv[i], "-l") && i + 1 < argc) {
+			max_lines = atoi(argv[++i]);
+		} else if (argv[i][0] != '-' && !filter) {
+			filter = argv[i];
+		} else {
+			fprintf(stderr, "usage: %s [-l MAX-LINES] [BENCHMARK]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	miss_counter mc;
+	bool misses = open_misses(&mc);
+	printf("hit kernels: %s, cache misses: %s\n", hit_kernels(), misses ? "counted" : "not available");
+	printf("%-12s %8s  %-28s %9s %9s %9s %9s %10s\n",
+	       "level", "lines", "benchmark", "ns/op", "p50", "p90", "p99", "misses/op");
+
+	static bench_ctx c;
+	entity_rule rule;
+	make_rule(&rule);
+	init_entity_state(&c.e, &rule, ST_IDLE, 0);
+
+	uint32_t seed = 0x2012f00d;
+	level l;
+	char const *root = getenv(ROOTVAR);
+	if (root && *root && shipped_level(&l, root)) {
+		c.name = "level.json";
+		c.lev = &l;
+		make_queries(&c, &seed);
+		run_level(&c, filter, &mc);
+		destroy_level(&l);
+	} else {
+		fprintf(stderr, "Warning: set %s to include the shipped level\n", ROOTVAR);
+	}
+
+	int n;
+	for (n = 1000; n <= max_lines; n *= 10) {
+		make_level(&l, n, &seed);
+		c.name = "made-up";
+		c.lev = &l;
+		make_queries(&c, &seed);
+		run_level(&c, filter, &mc);
+		destroy_level(&l);
+	}
+
+	/* all states share the one animation */
+	free(rule.anim[0].frames);
+	free(rule.anim[0].duration);
+	free(rule.anim[0].timeline);
+	close_misses(&mc);
+
+	return 0;
+}
+
+/* the benchmarks, one operation each for query i */
+static void bench_collides(bench_ctx *c, int i)
+{
+	c->sink += collides_with_terrain(&c->box[i], c->lev);
+}
+
+/* BOX_BATCH boxes per call, as enemy_movement asks; the call falls to
+ * the first query of each batch so the time per operation is per box */
+static void bench_collides_batch(bench_ctx *c, int i)
+{
+	if (i % BOX_BATCH != 0) { return; }
+
+	enum hit h[BOX_BATCH];
+	int k;
+	collides_with_terrain_batch(&c->box[i], BOX_BATCH, c->lev, h);
+	for (k = 0; k < BOX_BATCH; k++) {
+		c->sink += h[k];
+	}
+}
+
+static void bench_stands(bench_ctx *c, int i)
+{
+	c->sink += stands_on_terrain(&c->box[i], c->lev);
+}
+
+static void bench_vector_move(bench_ctx *c, int i)
+{
+	entity_state e = c->e;
+	e.pos = (point) { c->box[i].x, c->box[i].y };
+	point w = entity_vector_move(&e, &c->v[i], c->lev, i & 1);
+	c->sink += w.x + w.y;
+}
+
+static void bench_move(bench_ctx *c, int i)
+{
+	static enum state const st[4] = { ST_IDLE, ST_WALK, ST_JUMP, ST_FALL };
+	entity_state e = c->e;
+	e.pos = (point) { c->box[i].x, c->box[i].y };
+	e.st = st[i & 3];
+	e.jump_timeout = e.st == ST_JUMP ? e.rule->jump_time / 2 : 0;
+	e.fall_time = e.st == ST_FALL ? 3 : 0;
+
+	move_log mlog;
+	move_entity(&e, &c->ev[i], c->lev, &mlog);
+	c->sink += e.pos.x + e.pos.y + e.st;
+}
+
+static void bench_anim(bench_ctx *c, int i)
+{
+	entity_state e = c->e;
+	e.st = i % NSTATES;
+	e.anim.start = c->box[i].x;
+	c->sink += anim_frame(&e, c->box[i].y);
+}
+
+static void bench_have_collision(bench_ctx *c, int i)
+{
+	rect r = c->box[i];
+	r.x += c->v[i].x * 2;
+	r.y += c->v[i].y * 2;
+	c->sink += have_collision(&c->box[i], &r);
+}
+
+/* levels */
+static bool shipped_level(level *l, char const *root)
+{
+	bake b;
+	if (!bake_open(&b, root, GAME_CONF)) { return false; }
+
+	bake_level(&b, l);
+	bake_close(&b);
+
+	return true;
+}
+
+/* n walls and platforms, a square level's worth, at random */
+static void make_level(level *l, int n, uint32_t *seed)
+{
+	int side = (int) sqrt((double) n * LINE_AREA);
+	int i;
+
+	arena_init(&l->mem);
+	l->dim = (rect) { 0, 0, side, side };
+	l->active_radius = 0;
+	l->nvertical = n / 2;
+	l->nhorizontal = n - l->nvertical;
+	l->vertical = arena_alloc(&l->mem, sizeof(line) * l->nvertical);
+	l->horizontal = arena_alloc(&l->mem, sizeof(line) * l->nhorizontal);
+
+	line *all[2] = { l->vertical, l->horizontal };
+	int count[2] = { l->nvertical, l->nhorizontal };
+	int k;
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < count[k]; i++) {
+			int a = rnd_in(seed, 0, side);
+			all[k][i] = (line) { p: rnd_in(seed, 0, side), a: a, b: a + rnd_in(seed, 32, 256) };
+		}
+		qsort(all[k], count[k], sizeof(line), cmp_lines);
+	}
+	index_level(l);
+}
+
+/* Boxes the size of an entity: every other one standing on a platform,
+ * the rest anywhere in the level.  Next to them what moves the entities
+ * make. */
+static void make_queries(bench_ctx *c, uint32_t *seed)
+{
+	level const *l = c->lev;
+	int i, x0, y0, x1, y1;
+
+	x0 = y0 = 0;
+	x1 = y1 = 1;
+	for (i = 0; i < l->nhorizontal; i++) {
+		line const *h = &l->horizontal[i];
+		if (i == 0 || h->p < y0) { y0 = h->p; }
+		if (i == 0 || h->p > y1) { y1 = h->p; }
+		if (i == 0 || h->a < x0) { x0 = h->a; }
+		if (i == 0 || h->b > x1) { x1 = h->b; }
+	}
+
+	rect const *hb = &c->e.hitbox;
+	for (i = 0; i < NQUERIES; i++) {
+		rect *r = &c->box[i];
+		*r = (rect) { w: hb->w, h: hb->h };
+		if (i & 1 && l->nhorizontal > 0) {
+			line const *h = &l->horizontal[rnd(seed) % l->nhorizontal];
+			int lo = h->a < h->b ? h->a : h->b, hi = h->a < h->b ? h->b : h->a;
+			r->x = rnd_in(seed, lo, hi) - r->w / 2;
+			r->y = h->p - r->h;
+		} else {
+			r->x = rnd_in(seed, x0, x1);
+			r->y = rnd_in(seed, y0, y1);
+		}
+		/* entity_hitbox puts the box at pos plus the animation's box */
+		r->x += hb->x;
+		r->y += hb->y;
+
+		c->v[i] = (point) { rnd_in(seed, -16, 16), rnd_in(seed, -16, 16) };
+
+		uint32_t m = rnd(seed);
+		c->ev[i] = (entity_event) {
+			walk: m & 1,
+			move_left: (m >> 1 & 3) == 1,
+			move_right: (m >> 1 & 3) == 2,
+			move_jump: (m >> 3 & 3) == 0 };
+	}
+}
+
+/* a walking, jumping entity the size of the player */
+static void make_rule(entity_rule *er)
+{
+	static unsigned const durations[4] = { 3, 5, 2, 6 };
+	int i, k;
+	unsigned t = 0;
+
+	*er = (entity_rule) {
+		start_dim: { 0, 0, 40, 60 },
+		walk_dist: 4,
+		jump_dist_x: 6,
+		jump_dist_y: 8,
+		jump_time: 10,
+		fall_dist: 2,
+		has_gravity: true,
+		a_wide: 1,
+		a_high: 1 };
+
+	animation_rule *a = &er->anim[0];
+	a->len = 4;
+	a->period = 0;
+	a->frames = malloc(sizeof(unsigned) * a->len);
+	a->duration = malloc(sizeof(unsigned) * a->len);
+	for (i = 0; i < 4; i++) {
+		a->frames[i] = i;
+		a->duration[i] = durations[i];
+		a->period += durations[i] + 1;
+	}
+	a->timeline = malloc(sizeof(unsigned) * a->period);
+	for (i = 0; i < 4; i++) {
+		for (k = 0; k <= (int) durations[i]; k++) {
+			a->timeline[t++] = i;
+		}
+	}
+	a->box = (rect) { 5, 10, 30, 50 };
+	for (i = 1; i < NSTATES; i++) {
+		er->anim[i] = *a;
+	}
+}
+
+/* running */
+static void run_level(bench_ctx *c, char const *filter, miss_counter *mc)
+{
+	int i;
+	for (i = 0; i < NBENCH; i++) {
+		if (filter && !strstr(benchmarks[i].name, filter)) { continue; }
+		run_bench(c, &benchmarks[i], mc);
+	}
+}
+
+static void run_bench(bench_ctx *c, benchmark const *b, miss_counter *mc)
+{
+	double per_op[SAMPLES];
+	long long t, total = 0, misses = 0;
+	int batch, i, k, q = 0;
+
+	/* as many operations per batch as take SAMPLE_NS, which also warms
+	 * the caches up */
+	for (batch = 64;; batch *= 2) {
+		t = now_ns();
+		for (i = 0; i < batch; i++) {
+			b->run(c, q);
+			q = (q + 1) & (NQUERIES - 1);
+		}
+		if (now_ns() - t >= SAMPLE_NS || batch >= 1 << 24) { break; }
+	}
+
+	q = 0;
+	start_misses(mc);
+	for (k = 0; k < SAMPLES; k++) {
+		t = now_ns();
+		for (i = 0; i < batch; i++) {
+			b->run(c, q);
+			q = (q + 1) & (NQUERIES - 1);
+		}
+		t = now_ns() - t;
+		total += t;
+		per_op[k] = (double) t / batch;
+	}
+	misses = stop_misses(mc);
+	qsort(per_op, SAMPLES, sizeof(double), cmp_double);
+
+	long long ops = (long long) batch * SAMPLES;
+	int lines = c->lev->nvertical + c->lev->nhorizontal;
+	printf("%-12s %8d  %-28s %9.1f %9.1f %9.1f %9.1f ",
+	       c->name, lines, b->name, (double) total / ops,
+	       per_op[SAMPLES / 2], per_op[SAMPLES * 9 / 10], per_op[SAMPLES * 99 / 100]);
+	if (misses >= 0) {
+		printf("%10.3f\n", (double) misses / ops);
+	} else {
+		printf("%10s\n", "-");
+	}
+	fflush(stdout);
+}
+
+/* cache misses */
+#ifdef __linux__
+static bool open_misses(miss_counter *mc)
+{
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CACHE_MISSES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+
+	mc->fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+	return mc->fd >= 0;
+}
+
+static void start_misses(miss_counter *mc)
+{
+	if (mc->fd < 0) { return; }
+	ioctl(mc->fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(mc->fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/* the misses since start_misses, -1 without a counter */
+static long long stop_misses(miss_counter *mc)
+{
+	if (mc->fd < 0) { return -1; }
+	ioctl(mc->fd, PERF_EVENT_IOC_DISABLE, 0);
+
+	long long n;
+	if (read(mc->fd, &n, sizeof(n)) != sizeof(n)) { return -1; }
+	return n;
+}
+
+static void close_misses(miss_counter *mc)
+{
+	if (mc->fd >= 0) { close(mc->fd); }
+}
+#else
+static bool open_misses(miss_counter *mc)
+{
+	mc->fd = -1;
+	return false;
+}
+
+static void start_misses(miss_counter *mc)
+{
+}
+
+static long long stop_misses(miss_counter *mc)
+{
+	return -1;
+}
+
+static void close_misses(miss_counter *mc)
+{
+}
+#endif
+
+/* low level */
+static long long now_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER f, t;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&t);
+	return (long long) ((double) t.QuadPart * 1e9 / f.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* xorshift32 */
+static uint32_t rnd(uint32_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+static int rnd_in(uint32_t *s, int lo, int hi)
+{
+	return hi > lo ? lo + (int) (rnd(s) % (uint32_t) (hi - lo)) : lo;
+}
+
+static int cmp_double(void const *x, void const *y)
+{
+	double a = *(double const *) x, b = *(double const *) y;
+	return a < b ? -1 : a > b;
+}
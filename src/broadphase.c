@@ -0,0 +1,102 @@
+#include "core.h"
+
+/* Sort and sweep: the boxes are kept sorted by their left edge, so all
+ * boxes overlapping one along x follow it directly.  Entities move little
+ * from one tick to the next, so the order of the last tick is nearly right
+ * and an insertion sort brings it up to date in about linear time. */
+
+static void sort_boxes(broadphase *bp);
+static void add_pair(broadphase *bp, int a, int b);
+
+void bp_resize(broadphase *bp, int n)
+{
+	bp_destroy(bp);
+
+	bp->n = n;
+	bp->box = calloc(n, sizeof(bp_box));
+	bp->order = malloc(sizeof(int) * n);
+
+	int i;
+	for (i = 0; i < n; i++) {
+		bp->order[i] = i;
+	}
+}
+
+void bp_set(broadphase *bp, int id, rect const *r)
+{
+	bp_box *b = &bp->box[id];
+
+	b->live = true;
+	b->x0 = r->w < 0 ? r->x + r->w : r->x;
+	b->x1 = r->w < 0 ? r->x : r->x + r->w;
+	b->y0 = r->h < 0 ? r->y + r->h : r->y;
+	b->y1 = r->h < 0 ? r->y : r->y + r->h;
+}
+
+void bp_remove(broadphase *bp, int id)
+{
+	bp->box[id].live = false;
+}
+
+/* Collects the pairs of live boxes that overlap, edges included, into
+ * bp->pairs and returns how many there are.  Only pairs overlapping along
+ * x are looked at. */
+int bp_collide(broadphase *bp)
+{
+	sort_boxes(bp);
+	bp->npairs = 0;
+
+	int i, j;
+	for (i = 0; i < bp->n; i++) {
+		bp_box const *a = &bp->box[bp->order[i]];
+		if (!a->live) {
+			continue;
+		}
+
+		for (j = i + 1; j < bp->n; j++) {
+			bp_box const *b = &bp->box[bp->order[j]];
+			if (b->x0 > a->x1) {
+				break;
+			}
+
+			if (b->live && b->y0 <= a->y1 && a->y0 <= b->y1) {
+				add_pair(bp, bp->order[i], bp->order[j]);
+			}
+		}
+	}
+
+	return bp->npairs;
+}
+
+void bp_destroy(broadphase *bp)
+{
+	free(bp->box);
+	free(bp->order);
+	free(bp->pairs);
+	*bp = (broadphase) { n: 0 };
+}
+
+/* low level */
+static void sort_boxes(broadphase *bp)
+{
+	int i, j;
+	for (i = 1; i < bp->n; i++) {
+		int id = bp->order[i];
+		int x = bp->box[id].x0;
+		for (j = i; j > 0 && bp->box[bp->order[j - 1]].x0 > x; j--) {
+			bp->order[j] = bp->order[j - 1];
+		}
+		bp->order[j] = id;
+	}
+}
+
+static void add_pair(broadphase *bp, int a, int b)
+{
+	if (bp->npairs == bp->pairs_cap) {
+		bp->pairs_cap = bp->pairs_cap ? 2 * bp->pairs_cap : 16;
+		bp->pairs = realloc(bp->pairs, sizeof(bp_pair) * bp->pairs_cap);
+	}
+
+	bp->pairs[bp->npairs] = (bp_pair) { a: a < b ? a : b, b: a < b ? b : a };
+	bp->npairs += 1;
+}
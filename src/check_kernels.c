@@ -0,0 +1,534 @@
+#include <math.h>
+
+#include "core.h"
+#include "bake.h"
+
+/* Checks the indexed and vectorised kernels against the plain loops they
+ * stand in for: the terrain grid and the line columns against a scan of
+ * every line, the sweep against moving a step at a time, the broadphase
+ * and the trigger grid against testing every pair, and the batch hit tests
+ * against have_collision and in_rect.  The levels and queries are drawn at
+ * random from a fixed seed, on a coarse lattice so that edges meet often,
+ * and the level in FRIDGE_ROOT is checked too when there is one.  Run it
+ * once more with FRIDGE_NO_SIMD set to check the scalar hit kernels. */
+
+#define ROOTVAR "FRIDGE_ROOT"
+#define GAME_CONF "game.json"
+
+#define NQUERIES 10000
+/* the plain loops look at every line, so the levels stay small */
+#define MAX_LINES 1000
+#define LATTICE 8
+#define BATCH 8 /* divides NQUERIES */
+#define NBOXES 300
+#define NROUNDS 50
+
+typedef struct {
+	line const *l;
+	int n;
+	int *seen;
+} visit_log;
+
+static int check_level(level const *l, char const *name, uint32_t *seed);
+static int check_broadphase(uint32_t *seed);
+static int check_triggers(uint32_t *seed);
+static int check_hits(uint32_t *seed);
+static enum hit ref_collides(rect const *r, level const *lev);
+static bool ref_stands(rect const *r, level const *lev);
+static point ref_vector_move(entity_state *e, point const *v, level const *lev, bool grav);
+static enum hit ref_intersects(line const *l, rect const *r, bool vertical);
+static bool ref_touches(line const *l, rect const *r, bool vertical);
+static void note_line(line const *l, bool vertical, void *data);
+static bool shipped_level(level *l, char const *root);
+static void make_level(level *l, int n, uint32_t *seed);
+static rect make_box(level const *l, uint32_t *seed);
+static int report(char const *what, char const *name, int bad, int n);
+static uint32_t rnd(uint32_t *s);
+static int rnd_in(uint32_t *s, int lo, int hi);
+
+int main(void)
+{
+	int failed = 0;
+	uint32_t seed = 0x2012f00d;
+	level l;
+
+	printf("hit kernels: %s\n", hit_kernels());
+
+	char const *root = getenv(ROOTVAR);
+	if (root && *root && shipped_level(&l, root)) {
+		failed += check_level(&l, "level.json", &seed);
+		destroy_level(&l);
+	} else {
+		fprintf(stderr, "Warning: set %s to include the shipped level\n", ROOTVAR);
+	}
+
+	int n;
+	for (n = 10; n <= MAX_LINES; n *= 10) {
+		make_level(&l, n, &seed);
+		failed += check_level(&l, "made-up", &seed);
+		destroy_level(&l);
+	}
+
+	failed += check_broadphase(&seed);
+	failed += check_triggers(&seed);
+	failed += check_hits(&seed);
+
+	printf("%d checks failed\n", failed);
+
+	return failed == 0 ? 0 : 1;
+}
+
+/* the grid lookups, the line columns and the sweep on one level */
+static int check_level(level const *l, char const *name, uint32_t *seed)
+{
+	char label[32];
+	snprintf(label, sizeof(label), "%s/%d", name, l->nhorizontal + l->nvertical);
+	name = label;
+
+	int i, k, failed = 0;
+	int bad_collide = 0, bad_batch = 0, bad_stand = 0, bad_lines = 0, bad_move = 0;
+	rect batch[BATCH];
+	enum hit want_batch[BATCH];
+
+	visit_log vl[2] = {
+		{ l: l->horizontal, n: l->nhorizontal, seen: calloc(l->nhorizontal + 1, sizeof(int)) },
+		{ l: l->vertical, n: l->nvertical, seen: calloc(l->nvertical + 1, sizeof(int)) } };
+
+	for (i = 0; i < NQUERIES; i++) {
+		rect r = make_box(l, seed);
+
+		enum hit want = ref_collides(&r, l), got = collides_with_terrain(&r, l);
+		if (got != want && bad_collide++ == 0) {
+			printf("%s: collides_with_terrain(%d,%d %dx%d) is %d, not %d\n",
+			       name, r.x, r.y, r.w, r.h, got, want);
+		}
+
+		/* the batch gets the boxes BATCH at a time */
+		batch[i % BATCH] = r;
+		want_batch[i % BATCH] = want;
+		if (i % BATCH == BATCH - 1) {
+			enum hit got_batch[BATCH];
+			collides_with_terrain_batch(batch, BATCH, l, got_batch);
+			for (k = 0; k < BATCH; k++) {
+				rect const *b = &batch[k];
+				if (got_batch[k] != want_batch[k] && bad_batch++ == 0) {
+					printf("%s: collides_with_terrain_batch(%d,%d %dx%d) is %d, not %d\n",
+					       name, b->x, b->y, b->w, b->h, got_batch[k], want_batch[k]);
+				}
+			}
+		}
+
+		bool on = stands_on_terrain(&r, l);
+		if (on != ref_stands(&r, l) && bad_stand++ == 0) {
+			printf("%s: stands_on_terrain(%d,%d %dx%d) is %d\n", name, r.x, r.y, r.w, r.h, on);
+		}
+
+		/* every line touching the box once, horizontal ones first */
+		memset(vl[0].seen, 0, sizeof(int) * l->nhorizontal);
+		memset(vl[1].seen, 0, sizeof(int) * l->nvertical);
+		int n = lines_in_rect(l, &r, note_line, vl), want_n = 0;
+		bool ok = true;
+		for (k = 0; k < 2; k++) {
+			int j;
+			for (j = 0; j < vl[k].n; j++) {
+				bool t = ref_touches(&vl[k].l[j], &r, k == 1);
+				want_n += t;
+				ok = ok && vl[k].seen[j] == t;
+			}
+		}
+		if ((!ok || n != want_n) && bad_lines++ == 0) {
+			printf("%s: lines_in_rect(%d,%d %dx%d) found %d lines, not %d\n",
+			       name, r.x, r.y, r.w, r.h, n, want_n);
+		}
+
+		entity_state e = { pos: { r.x, r.y }, hitbox: { 0, 0, r.w, r.h }, dir: DIR_LEFT };
+		entity_state f = e;
+		point v = { rnd_in(seed, -48, 49), rnd_in(seed, -48, 49) };
+		bool grav = i & 1;
+		point want_v = ref_vector_move(&e, &v, l, grav);
+		point got_v = entity_vector_move(&f, &v, l, grav);
+		if ((got_v.x != want_v.x || got_v.y != want_v.y || f.pos.x != e.pos.x || f.pos.y != e.pos.y) &&
+		    bad_move++ == 0) {
+			printf("%s: entity_vector_move(%d,%d %dx%d by %d,%d%s) went %d,%d, not %d,%d\n",
+			       name, r.x, r.y, r.w, r.h, v.x, v.y, grav ? " with gravity" : "",
+			       got_v.x, got_v.y, want_v.x, want_v.y);
+		}
+	}
+
+	failed += report("collides_with_terrain", name, bad_collide, NQUERIES);
+	failed += report("collides_with_terrain_batch", name, bad_batch, NQUERIES);
+	failed += report("stands_on_terrain", name, bad_stand, NQUERIES);
+	failed += report("lines_in_rect", name, bad_lines, NQUERIES);
+	failed += report("entity_vector_move", name, bad_move, NQUERIES);
+
+	free(vl[0].seen);
+	free(vl[1].seen);
+
+	return failed;
+}
+
+/* Boxes that move a little every round, some of them removed for a while,
+ * so the insertion sort works from the last round's order. */
+static int check_broadphase(uint32_t *seed)
+{
+	broadphase bp = { n: 0 };
+	rect box[NBOXES];
+	bool live[NBOXES];
+	bool *found = malloc(NBOXES * NBOXES);
+	int i, j, round, bad = 0;
+
+	bp_resize(&bp, NBOXES);
+	for (i = 0; i < NBOXES; i++) {
+		box[i] = (rect) { x: rnd_in(seed, 0, 2000), y: rnd_in(seed, 0, 600),
+		                  w: rnd_in(seed, 0, 60), h: rnd_in(seed, 0, 80) };
+	}
+
+	for (round = 0; round < NROUNDS; round++) {
+		for (i = 0; i < NBOXES; i++) {
+			box[i].x += rnd_in(seed, -24, 25);
+			box[i].y += rnd_in(seed, -8, 9);
+			live[i] = rnd(seed) % 8 != 0;
+			if (live[i]) {
+				bp_set(&bp, i, &box[i]);
+			} else {
+				bp_remove(&bp, i);
+			}
+		}
+
+		memset(found, 0, NBOXES * NBOXES);
+		int n = bp_collide(&bp), want = 0;
+		bool ok = true;
+		for (i = 0; i < n; i++) {
+			bp_pair const *p = &bp.pairs[i];
+			ok = ok && p->a < p->b && !found[p->a * NBOXES + p->b];
+			found[p->a * NBOXES + p->b] = true;
+		}
+		for (i = 0; i < NBOXES; i++) {
+			for (j = i + 1; j < NBOXES; j++) {
+				bool hit = live[i] && live[j] && have_collision(&box[i], &box[j]);
+				want += hit;
+				ok = ok && found[i * NBOXES + j] == hit;
+			}
+		}
+		if ((!ok || n != want) && bad++ == 0) {
+			printf("bp_collide: %d pairs in round %d, not %d\n", n, round, want);
+		}
+	}
+
+	bp_destroy(&bp);
+	free(found);
+
+	return report("bp_collide", "made-up", bad, NROUNDS);
+}
+
+/* near_triggers may give more than lie in the box, but never fewer */
+static int check_triggers(uint32_t *seed)
+{
+	world w;
+	arena mem;
+	int i, bad = 0;
+
+	arena_init(&mem);
+	w.msg.n = 200;
+	w.msg.msgs = arena_alloc(&mem, sizeof(message) * w.msg.n);
+	for (i = 0; i < (int) w.msg.n; i++) {
+		w.msg.msgs[i].pos = (point) { rnd_in(seed, -500, 3000), rnd_in(seed, -200, 1000) };
+	}
+	w.finish.pos = (point) { rnd_in(seed, 0, 2500), rnd_in(seed, 0, 800) };
+	index_triggers(&w, &mem);
+
+	trigger_index const *ti = &w.triggers;
+	bool *near = malloc(ti->n);
+	rect r = { 0 };
+	for (i = 0; i < NQUERIES; i++) {
+		/* the box wanders, so the cached cells are hit as well, and now
+		 * and then it grows or shrinks or jumps elsewhere */
+		if (i % 64 == 0) {
+			r = (rect) { x: rnd_in(seed, -700, 3200), y: rnd_in(seed, -300, 1100),
+			             w: rnd_in(seed, -200, 200), h: rnd_in(seed, -200, 200) };
+		} else if (rnd(seed) % 4 == 0) {
+			r.w += rnd_in(seed, -64, 65);
+			r.h += rnd_in(seed, -64, 65);
+		} else {
+			r.x += rnd_in(seed, -16, 17);
+			r.y += rnd_in(seed, -16, 17);
+		}
+		rect a = { x: r.w < 0 ? r.x + r.w : r.x, y: r.h < 0 ? r.y + r.h : r.y,
+		           w: r.w < 0 ? -r.w : r.w, h: r.h < 0 ? -r.h : r.h };
+		int const *ids;
+		int k, n = near_triggers(&w, &r, &ids);
+
+		memset(near, 0, ti->n);
+		bool ok = true;
+		for (k = 0; k < n; k++) {
+			ok = ok && ids[k] >= 0 && ids[k] < ti->n && (k == 0 || ids[k - 1] < ids[k]);
+			if (ids[k] >= 0 && ids[k] < ti->n) { near[ids[k]] = true; }
+		}
+		for (k = 0; k < ti->n; k++) {
+			ok = ok && (near[k] || !in_rect(&ti->t[k].pos, &a));
+		}
+		if (!ok && bad++ == 0) {
+			printf("near_triggers(%d,%d %dx%d) misses a trigger in the box\n", r.x, r.y, r.w, r.h);
+		}
+	}
+
+	free(near);
+	arena_free(&mem);
+
+	return report("near_triggers", "made-up", bad, NQUERIES);
+}
+
+/* every length up to a few vectors, so the tails are covered */
+static int check_hits(uint32_t *seed)
+{
+	rect r[80];
+	point p[80];
+	uint32_t mask[3];
+	int i, k, n, bad_boxes = 0, bad_points = 0;
+
+	for (i = 0; i < NQUERIES; i++) {
+		rect q = { x: rnd_in(seed, 0, 256) & ~3, y: rnd_in(seed, 0, 256) & ~3,
+		           w: rnd_in(seed, 0, 64) & ~3, h: rnd_in(seed, 0, 64) & ~3 };
+		n = i % 81;
+		for (k = 0; k < n; k++) {
+			r[k] = (rect) { x: rnd_in(seed, 0, 320) & ~3, y: rnd_in(seed, 0, 320) & ~3,
+			                w: rnd_in(seed, 0, 64) & ~3, h: rnd_in(seed, 0, 64) & ~3 };
+			p[k] = (point) { rnd_in(seed, 0, 320) & ~3, rnd_in(seed, 0, 320) & ~3 };
+		}
+
+		bool ok = true;
+		memset(mask, 0xff, sizeof(mask));
+		boxes_hit(&q, r, n, mask);
+		for (k = 0; k < n; k++) {
+			ok = ok && !(mask[k / 32] >> k % 32 & 1) == !have_collision(&q, &r[k]);
+		}
+		if (!ok && bad_boxes++ == 0) {
+			printf("boxes_hit(%d,%d %dx%d) disagrees with have_collision on %d boxes\n",
+			       q.x, q.y, q.w, q.h, n);
+		}
+
+		ok = true;
+		memset(mask, 0xff, sizeof(mask));
+		points_hit(&q, p, n, mask);
+		for (k = 0; k < n; k++) {
+			ok = ok && !(mask[k / 32] >> k % 32 & 1) == !in_rect(&p[k], &q);
+		}
+		if (!ok && bad_points++ == 0) {
+			printf("points_hit(%d,%d %dx%d) disagrees with in_rect on %d points\n",
+			       q.x, q.y, q.w, q.h, n);
+		}
+	}
+
+	return report("boxes_hit", "made-up", bad_boxes, NQUERIES) +
+	       report("points_hit", "made-up", bad_points, NQUERIES);
+}
+
+/* the plain loops */
+
+/* every line in array order, horizontal ones first */
+static enum hit ref_collides(rect const *r, level const *lev)
+{
+	rect hb = *r;
+	hb.h -= 1;
+
+	int i;
+	for (i = 0; i < lev->nhorizontal; i++) {
+		enum hit a = ref_intersects(&lev->horizontal[i], &hb, false);
+		if (a != HIT_NONE) { return a; }
+	}
+	for (i = 0; i < lev->nvertical; i++) {
+		enum hit a = ref_intersects(&lev->vertical[i], &hb, true);
+		if (a != HIT_NONE) { return a; }
+	}
+
+	return HIT_NONE;
+}
+
+static bool ref_stands(rect const *r, level const *lev)
+{
+	point mid = entity_feet(r);
+
+	int i;
+	for (i = 0; i < lev->nhorizontal; i++) {
+		line const *h = &lev->horizontal[i];
+		if (mid.y == h->p && between(mid.x, h->a, h->b)) { return true; }
+	}
+
+	return false;
+}
+
+/* one step at a time, as entity_vector_move did before it swept */
+static point ref_vector_move(entity_state *e, point const *v, level const *lev, bool grav)
+{
+	rect r, n;
+	entity_hitbox(e, &n);
+	r = n;
+
+	int dirx = v->x < 0 ? -1 : 1;
+	int diry = v->y < 0 ? -1 : 1;
+	int vx = v->x < 0 ? -v->x : v->x;
+	int vy = v->y < 0 ? -v->y : v->y;
+	int v_max = vx > vy ? vx : vy;
+
+	int i;
+	point out = { x: 0, y: 0 };
+	for (i = 1; i < v_max + 1; i++) {
+		int dx = dirx * (i * vx) / v_max;
+		int dy = diry * (i * vy) / v_max;
+		r.x = n.x + dx;
+		r.y = n.y + dy;
+		if (ref_collides(&r, lev) != HIT_NONE) { break; }
+		if (grav && !ref_stands(&r, lev)) { break; }
+		out.x = dx;
+		out.y = dy;
+	}
+
+	e->pos.x += out.x;
+	e->pos.y += out.y;
+
+	return out;
+}
+
+/* intersects_x for horizontal lines, intersects_y for vertical ones */
+static enum hit ref_intersects(line const *l, rect const *r, bool vertical)
+{
+	int rx1 = r->x;
+	int rxm = r->x + r->w / 2;
+	int rx2 = r->x + r->w;
+	int ry1 = r->y;
+	int ry2 = r->y + r->h;
+
+	if (!vertical) {
+		if (!between(l->p, ry1, ry2)) { return HIT_NONE; }
+		if (between(rx1, l->a, l->b) || between(rxm, l->a, l->b) ||
+		    between(l->a, rx1, rxm) || between(l->b, rx1, rxm)) {
+			return HIT_LEFT;
+		}
+		if (between(rxm, l->a, l->b) || between(rx2, l->a, l->b) ||
+		    between(l->a, rx1, rx2) || between(l->b, rx1, rx2)) {
+			return HIT_RIGHT;
+		}
+		return HIT_NONE;
+	}
+
+	bool span = between(ry1, l->a, l->b) || between(ry2, l->a, l->b) ||
+	            between(l->a, ry1, ry2) || between(l->b, ry1, ry2);
+	if (span && between(l->p, rx1, rxm)) { return HIT_LEFT; }
+	if (span && between(l->p, rxm, rx2)) { return HIT_RIGHT; }
+
+	return HIT_NONE;
+}
+
+/* the line lies in the box, edges included */
+static bool ref_touches(line const *l, rect const *r, bool vertical)
+{
+	int lo = l->a < l->b ? l->a : l->b;
+	int hi = l->a < l->b ? l->b : l->a;
+
+	if (vertical) {
+		return between(l->p, r->x, r->x + r->w) && hi >= r->y && lo <= r->y + r->h;
+	}
+	return between(l->p, r->y, r->y + r->h) && hi >= r->x && lo <= r->x + r->w;
+}
+
+static void note_line(line const *l, bool vertical, void *data)
+{
+	visit_log *vl = data;
+	visit_log *v = &vl[vertical ? 1 : 0];
+
+	if (l >= v->l && l < v->l + v->n) {
+		v->seen[l - v->l] += 1;
+	} else {
+		/* not a line of this direction; seen[n] is never expected */
+		v->seen[v->n] += 1;
+	}
+}
+
+/* levels and queries */
+static bool shipped_level(level *l, char const *root)
+{
+	bake b;
+	if (!bake_open(&b, root, GAME_CONF)) { return false; }
+
+	bake_level(&b, l);
+	bake_close(&b);
+
+	return true;
+}
+
+/* n walls and platforms on the lattice, about 100 px apart */
+static void make_level(level *l, int n, uint32_t *seed)
+{
+	int side = 100 * (int) sqrt((double) n) / LATTICE * LATTICE + LATTICE;
+	int i, k;
+
+	arena_init(&l->mem);
+	l->dim = (rect) { 0, 0, side, side };
+	l->active_radius = 0;
+	l->nvertical = n / 2;
+	l->nhorizontal = n - l->nvertical;
+	l->vertical = arena_alloc(&l->mem, sizeof(line) * l->nvertical);
+	l->horizontal = arena_alloc(&l->mem, sizeof(line) * l->nhorizontal);
+
+	line *all[2] = { l->vertical, l->horizontal };
+	int count[2] = { l->nvertical, l->nhorizontal };
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < count[k]; i++) {
+			int a = rnd_in(seed, 0, side / LATTICE) * LATTICE;
+			all[k][i] = (line) { p: rnd_in(seed, 0, side / LATTICE) * LATTICE, a: a,
+			                     b: a + rnd_in(seed, 0, 32) * LATTICE };
+		}
+		qsort(all[k], count[k], sizeof(line), cmp_lines);
+	}
+	index_level(l);
+}
+
+/* Boxes up to entity size, a third of them standing on a platform and
+ * the rest anywhere in and around the level, near the lattice. */
+static rect make_box(level const *l, uint32_t *seed)
+{
+	rect r = { w: rnd_in(seed, 0, 8) * LATTICE + rnd_in(seed, -1, 2),
+	           h: rnd_in(seed, 0, 10) * LATTICE + rnd_in(seed, -1, 2) };
+	if (r.w < 0) { r.w = 0; }
+	if (r.h < 0) { r.h = 0; }
+
+	if (rnd(seed) % 3 == 0 && l->nhorizontal > 0) {
+		line const *h = &l->horizontal[rnd(seed) % l->nhorizontal];
+		r.x = rnd_in(seed, h->a, h->b + 1) - r.w / 2;
+		r.y = h->p - r.h;
+	} else {
+		int m = 4 * LATTICE;
+		r.x = rnd_in(seed, (l->dim.x - m) / LATTICE, (l->dim.x + l->dim.w + m) / LATTICE) * LATTICE;
+		r.y = rnd_in(seed, (l->dim.y - m) / LATTICE, (l->dim.y + l->dim.h + m) / LATTICE) * LATTICE;
+		r.x += rnd_in(seed, -1, 2);
+		r.y += rnd_in(seed, -1, 2);
+	}
+
+	return r;
+}
+
+/* prints the outcome of one check, returns 1 if it failed */
+static int report(char const *what, char const *name, int bad, int n)
+{
+	if (bad == 0) {
+		printf("%-12s %-28s ok (%d)\n", name, what, n);
+	} else {
+		printf("%-12s %-28s %d of %d differ\n", name, what, bad, n);
+	}
+
+	return bad != 0;
+}
+
+/* low level */
+static uint32_t rnd(uint32_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+static int rnd_in(uint32_t *s, int lo, int hi)
+{
+	return hi > lo ? lo + (int) (rnd(s) % (uint32_t) (hi - lo)) : lo;
+}
@@ -0,0 +1,321 @@
+#include "core.h"
+
+static int load_collisions(level *level, json_t const *o);
+static void bake_timeline(animation_rule *a, arena *mem);
+
+/* loading */
+void load_anim(json_t *src, char const *name, char const *key, arena *mem, animation_rule *a)
+{
+	json_t *o, *frames, *dur, *box;
+	o = json_object_get(src, key);
+	if (!o) {
+		#ifdef VERBOSE
+		fprintf(stderr, "Warning: No %s animation for %s\n", key, name);
+		#endif
+		return;
+	}
+
+	frames = json_object_get(o, "frames");
+	dur = json_object_get(o, "duration");
+
+	int k, l;
+	l = json_array_size(frames);
+	k = json_array_size(dur);
+	if (k != l) {
+		fprintf(stderr, "error: have %d frames but %d durations\n", l, k);
+		return;
+	}
+	a->len = l;
+	a->frames   = arena_alloc(mem, sizeof(unsigned) * l);
+	a->duration = arena_alloc(mem, sizeof(unsigned) * l);
+	int i;
+	for (i = 0; i < l; i++) {
+		a->frames[i] = json_integer_value(json_array_get(frames, i));
+		a->duration[i] = json_integer_value(json_array_get(dur, i));
+	}
+	bake_timeline(a, mem);
+
+	box = json_object_get(o, "box");
+	a->box.x = json_integer_value(json_array_get(box, 0));
+	a->box.y = json_integer_value(json_array_get(box, 1));
+	a->box.w = json_integer_value(json_array_get(box, 2));
+	a->box.h = json_integer_value(json_array_get(box, 3));
+}
+
+/* one entry per tick of a loop of the animation, see animation_rule */
+static void bake_timeline(animation_rule *a, arena *mem)
+{
+	unsigned i, k, t = 0;
+
+	a->period = 0;
+	for (i = 0; i < a->len; i++) {
+		a->period += a->duration[i] + 1;
+	}
+
+	a->timeline = arena_alloc(mem, sizeof(unsigned) * a->period);
+	for (i = 0; i < a->len; i++) {
+		for (k = 0; k <= a->duration[i]; k++) {
+			a->timeline[t++] = i;
+		}
+	}
+}
+
+void load_entity_rule(json_t *src, entity_rule *er, char const *n)
+{
+	get_int_field(src, n, "walk-dist", &er->walk_dist);
+	get_int_field(src, n, "jump-dist-y", &er->jump_dist_y);
+	get_int_field(src, n, "jump-dist-x", &er->jump_dist_x);
+	get_int_field(src, n, "jump-time", &er->jump_time);
+	get_int_field(src, n, "fall-dist", &er->fall_dist);
+	get_float_field(src, n, "wide-jump-factor", &er->a_wide);
+	get_float_field(src, n, "high-jump-factor", &er->a_high);
+	json_t *o = json_object_get(src, "has-gravity");
+        if (o || !streq(n, "custom-rule")) {
+                er->has_gravity = o ? streq(json_string_value(json_object_get(src, "has-gravity")), "yes") : true;
+        }
+}
+
+/* The rules of the entities in file, out of mem, and the JSON they came
+ * from with the index of each rule added. */
+json_t *load_entity_rules(char const *root, char const *file, arena *mem, entity_rule **rules)
+{
+	json_t *ent;
+	json_error_t e;
+	ent = json_load_file(file, 0, &e);
+	if (*e.text != 0) {
+		fprintf(stderr, "Error at %s:%d: %s\n", file, e.line, e.text);
+		return 0;
+	}
+
+	int k;
+	k = json_object_size(ent);
+	*rules = arena_alloc(mem, sizeof(entity_rule) * k);
+
+	json_t *o;
+	int i = 0;
+	bool ok;
+	char const *name;
+	entity_rule *rule = *rules;
+	json_object_foreach(ent, name, o) {
+
+		ok = load_entity_resource(o, name, mem, rule, root);
+		if (!ok) {
+			return 0;
+		}
+
+		/* save the index in the buffer, so the items in groups can
+		 * link directly to their rules later: */
+		json_object_set_new(o, "index", json_integer(i));
+		i += 1;
+		rule += 1;
+	}
+
+	return ent;
+}
+
+bool load_entity_resource(json_t *src, char const *n, arena *mem, entity_rule *er, char const *root)
+{
+	json_t *o;
+	char const *ps;
+	o = json_object_get(src, "resource");
+	ps = json_string_value(o);
+	char const *path;
+	path = set_path("%s/%s/%s", root, CONF_DIR, ps);
+
+        load_entity_rule(src, er, n);
+        er->tex = 0;
+        er->sheet = (point) { 0, 0 };
+
+	json_error_t e;
+	o = json_load_file(path, 0, &e);
+	if (*e.text != 0) {
+		fprintf(stderr, "Error at %s:%d: %s\n", path, e.line, e.text);
+		return false;
+	}
+
+	/* keep the asset name next to the rule, the render layer loads the
+	 * texture from it */
+	json_object_set_new(src, "asset", json_string(get_asset(o, "asset")));
+
+	json_t *siz;
+	siz = json_object_get(o, "frame_size");
+	er->start_dim.w = json_integer_value(json_array_get(siz, 0));
+	er->start_dim.h = json_integer_value(json_array_get(siz, 1));
+
+	int i;
+	for (i = 0; i < NSTATES; i++) {
+		er->anim[i].frames = 0;
+		load_anim(o, n, st_names[i], mem, &er->anim[i]);
+		if (!er->anim[i].frames) {
+			er->anim[i] = er->anim[ST_IDLE];
+		}
+	}
+
+	json_decref(o);
+
+	return true;
+}
+
+json_t *load_level(level *l, json_t *game, char const *root)
+{
+	json_t *o;
+	char const *path;
+
+	o = json_object_get(game, "level");
+	path = set_path("%s/%s/%s", root, CONF_DIR, json_string_value(o));
+	json_error_t e;
+	o = json_load_file(path, 0, &e);
+	if (*e.text != 0) {
+		fprintf(stderr, "Error at %s:%d: %s\n", path, e.line, e.text);
+		return 0;
+	}
+
+	load_collisions(l, o);
+	l->active_radius = json_integer_value(json_object_get(game, "active-radius"));
+
+	return o;
+}
+
+bool load_finish(finish *f, json_t *game)
+{
+	json_t *fin = json_object_get(game, "finish");
+	if (!fin) { return false; }
+
+	json_t *o = json_object_get(fin, "pos");
+	f->pos.x = json_integer_value(json_array_get(o, 0));
+	f->pos.y = json_integer_value(json_array_get(o, 1));
+
+	f->win = (message) { pos: { x: f->pos.x,
+	                            y: f->pos.y },
+		             when: MSG_NEVER };
+	f->loss = (message) { pos: { x: f->pos.x,
+	                             y: f->pos.y },
+		              when: MSG_NEVER };
+
+	return true;
+}
+
+bool load_messages(msg_info *mi, arena *mem, json_t *game)
+{
+	json_t *o = json_object_get(game, "message");
+	if (!o) { return false; }
+
+	mi->timeout = json_integer_value(json_object_get(o, "timeout"));
+
+	o = json_object_get(game, "messages");
+	int k = json_array_size(o);
+	mi->n = k;
+	message *ms = arena_alloc(mem, sizeof(message) * k);
+	mi->msgs = ms;
+
+	int i;
+	json_t *m;
+	json_array_foreach(o, i, m) {
+		ms[i] = (message) {
+			pos: { x: json_integer_value(json_array_get(m, 0)),
+		               y: json_integer_value(json_array_get(m, 1)) },
+		        when: streq(frq_names[MSG_ONCE], json_string_value(json_array_get(m, 2))) ?
+				MSG_ONCE : MSG_ALWAYS };
+	}
+
+	return true;
+}
+
+/* low level */
+static int load_collisions(level *level, json_t const *o)
+{
+	json_t *lines_o = json_object_get(o, "collision-lines");
+
+	int k = json_array_size(lines_o);
+	arena_init(&level->mem);
+	level->vertical = arena_alloc(&level->mem, sizeof(line) * k);
+	level->horizontal = arena_alloc(&level->mem, sizeof(line) * k);
+	level->nvertical = 0;
+	level->nhorizontal = 0;
+
+	int i;
+	json_t *l;
+	json_array_foreach(lines_o, i, l) {
+		if (json_array_size(l) != 4) {
+			puts("incomplete line");
+			continue;
+		}
+		int ax, ay, bx, by;
+		ax = json_integer_value(json_array_get(l, 0));
+		ay = json_integer_value(json_array_get(l, 1));
+		bx = json_integer_value(json_array_get(l, 2));
+		by = json_integer_value(json_array_get(l, 3));
+
+		if (ax == bx) {
+			level->vertical[level->nvertical] = (line) { ax, ay, by };
+			level->nvertical += 1;
+		} else if (ay == by) {
+			level->horizontal[level->nhorizontal] = (line) { ay, ax, bx };
+			level->nhorizontal += 1;
+		} else {
+			fprintf(stderr, "Warning: Ignoring diagonal line %d %d - %d %d\n",
+					ax, ay, bx, by);
+		}
+	}
+
+	/* sort by p component */
+	qsort(level->vertical, level->nvertical, sizeof(line), cmp_lines);
+	qsort(level->horizontal, level->nhorizontal, sizeof(line), cmp_lines);
+	index_level(level);
+
+	return k;
+}
+
+/* low level json */
+char const *get_asset(json_t *a, char const *k)
+{
+	json_t *v;
+
+	v = json_object_get(a, k);
+	if (!v) {
+		fprintf(stderr, "no %s in %p\n", k, a);
+		json_dumpf(a, stderr, 0);
+		fprintf(stderr, "no %s\n", k);
+		return 0;
+	}
+
+	char const *r = json_string_value(v);
+
+	return r;
+}
+
+bool get_int_field(json_t *o, char const *n, char const *s, int *r)
+{
+	json_t *var;
+
+	var = json_object_get(o, s);
+	if (!var) {
+		#ifdef VERBOSE
+		fprintf(stderr, "Warning: No %s for %s\n", s, n);
+		#endif
+                if (!streq(n, "custom-rule")) {
+                        *r = 0;
+                }
+		return false;
+	}
+	*r = json_integer_value(var);
+
+	return true;
+}
+
+bool get_float_field(json_t *o, char const *n, char const *s, double *r)
+{
+	json_t *var;
+
+	var = json_object_get(o, s);
+	if (!var) {
+		#ifdef VERBOSE
+		fprintf(stderr, "Warning: No %s for %s\n", s, n);
+		#endif
+		*r = 0;
+		return false;
+	}
+	*r = json_real_value(var);
+
+	return true;
+}
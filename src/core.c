@@ -0,0 +1,881 @@
+#include "core.h"
+
+bool pt_on_line(point const *p, line const *l);
+static enum hit intersects_x(line const *l, rect const *r);
+static enum hit intersects_y(line const *l, rect const *r);
+static void build_grid(line_grid *g, arena *mem, line const *l, int n);
+static void pack_lines(line_soa *s, arena *mem, line const *l, line_grid const *g);
+static bool grid_span(line_grid const *g, int lo, int hi, bool p, int *c0, int *c1);
+static bool grid_cells(line_grid const *g, rect const *q, int *p0, int *p1, int *s0, int *s1);
+static enum hit grid_hit(line_grid const *g, line const *l, rect const *r, rect const *q,
+			 enum hit (*hit)(line const *, rect const *));
+static enum hit cells_hit(line_grid const *g, line_soa const *s, rect const *r, rect const *q, bool vertical);
+static int grid_visit(line_grid const *g, line const *l, rect const *q, bool vertical,
+		      void (*f)(line const *, bool, void *), void *data);
+
+/* A straight move of a box, in the steps entity_vector_move takes: step i
+ * of n puts the box at from + dir * floor(i * v / n). */
+typedef struct {
+	rect from;
+	int dirx, diry;
+	int vx, vy;
+	int n;
+} sweep;
+
+static int sweep_hit(sweep const *s, level const *lev);
+static int sweep_fall(sweep const *s, level const *lev, int limit);
+static int hline_step(sweep const *s, line const *l);
+static int vline_step(sweep const *s, line const *l);
+static void sweep_x(sweep const *s, int lo, int hi, int *i0, int *i1);
+static void sweep_y(sweep const *s, int lo, int hi, int *i0, int *i1);
+static void sweep_steps(int v, int n, int lo, int hi, int *i0, int *i1);
+static int first_common(int (*a)[2], int na, int (*b)[2], int nb, int none);
+
+static int entity_jump(entity_state *e, level const *terrain, bool walk, bool jump);
+
+/* state */
+/* starts the animation of es's state at the tick now */
+void load_state(entity_state *es, unsigned now)
+{
+	animation_rule const *ar = &es->rule->anim[es->st];
+	es->anim.start = now;
+	es->hitbox.x = ar->box.x;
+	es->hitbox.y = ar->box.y;
+	es->hitbox.w = ar->box.w;
+	es->hitbox.h = ar->box.h;
+}
+
+void init_entity_state(entity_state *es, entity_rule const *er, enum state st, unsigned now)
+{
+	if (!er) {
+		er = es->rule;
+	} else {
+		es->rule = er;
+	}
+
+	es->active = true;
+	es->dir = DIR_LEFT;
+	es->st = st;
+	load_state(es, now);
+	es->pos.x = es->spawn.x;
+	es->pos.y = es->spawn.y;
+	es->spawn.w = er->start_dim.w;
+	es->spawn.h = er->start_dim.h;
+	es->jump_timeout = 0;
+	es->jump_type = JUMP_WIDE;
+	es->fall_time = 0;
+}
+
+void clear_debug(debug_state *d)
+{
+	d->active = false;
+	d->pause = false;
+	d->frames = true;
+	d->hitboxes = true;
+	d->show_terrain_collision = false;
+	d->message_positions = true;
+}
+
+/* teardown */
+void destroy_level(level *l)
+{
+	arena_free(&l->mem);
+	l->vertical = 0;
+	l->horizontal = 0;
+	l->vgrid = (line_grid) { start: 0 };
+	l->hgrid = (line_grid) { start: 0 };
+	l->vsoa = (line_soa) { n: 0 };
+	l->hsoa = (line_soa) { n: 0 };
+}
+
+/* state updates */
+void clear_order(entity_event *o)
+{
+	o->move_left = false;
+	o->move_right = false;
+	o->move_jump = false;
+	o->walk = false;
+}
+
+/* which of its animation's frames e shows at the tick now, as an index
+ * into the animation and as a frame of the sprite sheet */
+unsigned anim_pos(entity_state const *e, unsigned now)
+{
+	animation_rule const *ar = &e->rule->anim[e->st];
+	return ar->timeline[(now - e->anim.start) % ar->period];
+}
+
+unsigned anim_frame(entity_state const *e, unsigned now)
+{
+	return e->rule->anim[e->st].frames[anim_pos(e, now)];
+}
+
+int kick_entity(entity_state *e, enum hit h, point const *v)
+{
+	if (h == HIT_NONE || h & HIT_TOP) { return 0; }
+	if ((h & HIT_RIGHT && h & HIT_LEFT)) { return 0; }
+
+	e->pos.x += v->x * (h & HIT_RIGHT ? -1 : 1);
+	e->pos.y += v->y;
+
+	return 0;
+}
+
+/* movement */
+
+/* Moves the entity along v in v_max steps, stopping before the first step
+ * that collides with the terrain or, with grav, leaves the ground.  The
+ * steps are not taken one by one: the sweep finds the first bad one from
+ * the lines near the path. */
+point entity_vector_move(entity_state *e, point const *v, level const *terrain, bool grav)
+{
+	rect n;
+	entity_hitbox(e, &n);
+
+	int dirx = v->x < 0 ? -1 : 1;
+	int diry = v->y < 0 ? -1 : 1;
+
+	int vx = v->x < 0 ? -v->x : v->x;
+	int vy = v->y < 0 ? -v->y : v->y;
+
+	int v_max = vx > vy ? vx : vy;
+	point out = { x: 0, y: 0 };
+	if (v_max == 0) {
+		return out;
+	}
+
+	sweep s = { from: n, dirx: dirx, diry: diry, vx: vx, vy: vy, n: v_max };
+	int stop = sweep_hit(&s, terrain);
+	if (grav) {
+		stop = sweep_fall(&s, terrain, stop);
+	}
+
+	int i = stop - 1;
+	if (i > 0) {
+		out.x = dirx * (i * vx) / v_max;
+		out.y = diry * (i * vy) / v_max;
+	}
+
+	e->pos.x += out.x;
+	e->pos.y += out.y;
+
+	return out;
+}
+
+static int entity_walk(entity_state *e, level const *terrain)
+{
+	point v = { x: e->dir * e->rule->walk_dist, y: 0 };
+	point r = entity_vector_move(e, &v, terrain, e->rule->has_gravity);
+	return r.x < 0 ? -r.x : r.x;
+}
+
+static int entity_start_jump(entity_state *e, level const *terrain, enum jump_type t)
+{
+	e->jump_timeout = e->rule->jump_time;
+	e->jump_type = t;
+
+	return entity_jump(e, terrain, t == JUMP_WIDE, true);
+}
+
+static int entity_jump(entity_state *e, level const *terrain, bool walk, bool jump)
+{
+	entity_rule const *r = e->rule;
+	if (e->jump_timeout == 0) {
+		return r->has_gravity ? 0 : jump ? entity_start_jump(e, terrain, JUMP_HIGH) : 0;
+	}
+
+	point v = { x: e->jump_type == JUMP_WIDE ? e->dir * r->jump_dist_x : r->has_gravity ? 0 : walk ? e->dir * r->walk_dist : 0,
+	                y: r->jump_dist_y };
+	if (r->has_gravity) { v.y += e->jump_timeout; }
+	v.y *= -1;
+	point w = entity_vector_move(e, &v, terrain, false);
+	if (w.y != v.y) {
+		e->jump_timeout = 0;
+	} else {
+		e->jump_timeout -= 1;
+	}
+	return -w.y;
+}
+
+static int entity_fall(entity_state *e, level const *terrain, bool walk)
+{
+	e->fall_time += 1;
+	point v, w;
+	if (e->rule->has_gravity) {
+		v = (point) { x: 0, y: 1 };
+		w = entity_vector_move(e, &v, terrain, false);
+		if (v.y != w.y) { e->fall_time = 0; return 0; }
+	}
+
+	entity_rule const *r = e->rule;
+	v = (point) { x: walk ? e->dir * r->walk_dist : 0,
+	                  y: r->fall_dist };
+	if (r->has_gravity) { v.y += e->fall_time; }
+	w = entity_vector_move(e, &v, terrain, false);
+	if (v.y != w.y) { e->fall_time = 0; }
+	return w.y;
+}
+
+void move_entity(entity_state *e, entity_event const *ev, level const *lvl, move_log *mlog)
+{
+	enum state st_begin = e->st;
+	*mlog = (move_log) { walked: 0, jumped: 0, fallen: 0, turned: false, hang: false };
+
+	switch (st_begin) {
+	case ST_IDLE:
+	case ST_WALK:
+		e->dir = ev->move_left ? DIR_LEFT : ev->move_right ? DIR_RIGHT : e->dir;
+		if (ev->move_jump) {
+			mlog->jumped = entity_start_jump(e, lvl, ev->walk ? e->rule->has_gravity ? JUMP_WIDE : JUMP_HIGH : JUMP_HIGH);
+		} else if (ev->walk) {
+			mlog->walked = entity_walk(e, lvl);
+		}
+		break;
+	case ST_HANG:
+		break;
+	case ST_JUMP:
+		e->dir = ev->move_left ? DIR_LEFT : ev->move_right ? DIR_RIGHT : e->dir;
+		mlog->jumped = entity_jump(e, lvl, ev->walk, ev->move_jump);
+		break;
+	case ST_FALL:
+		e->dir = ev->move_left ? DIR_LEFT : ev->move_right ? DIR_RIGHT : e->dir;
+		if (!e->rule->has_gravity) {
+			if (ev->move_jump) {
+				mlog->jumped = entity_start_jump(e, lvl, JUMP_HIGH);
+			} else if (ev->walk) {
+				mlog->walked = entity_walk(e, lvl);
+				mlog->fallen = entity_fall(e, lvl, false);
+			} else {
+				mlog->fallen = entity_fall(e, lvl, false);
+			}
+		} else {
+			mlog->fallen = entity_fall(e, lvl, ev->walk);
+			rect h;
+			entity_hitbox(e, &h);
+			if (mlog->fallen == 0 && !stands_on_terrain(&h, lvl)) {
+				h.y += 1;
+				enum hit where = collides_with_terrain(&h, lvl);
+				point v = { .x = -1, .y = 0 };
+				kick_entity(e, where, &v);
+			}
+		}
+		break;
+	case NSTATES:
+		break;
+	}
+
+	rect h;
+	entity_hitbox(e, &h);
+	e->st = mlog->jumped > 0 ? ST_JUMP : stands_on_terrain(&h, lvl) ? mlog->walked > 0 ? ST_WALK : ST_IDLE : ST_FALL;
+}
+
+/* collision */
+
+/* Builds the grids collides_with_terrain and stands_on_terrain look lines
+ * up in, and the columns collides_with_terrain_batch scans, once the lines
+ * are loaded and sorted. */
+void index_level(level *l)
+{
+	build_grid(&l->vgrid, &l->mem, l->vertical, l->nvertical);
+	build_grid(&l->hgrid, &l->mem, l->horizontal, l->nhorizontal);
+	index_columns(l);
+}
+
+/* only the columns, for a level whose grids came from the config cache */
+void index_columns(level *l)
+{
+	pack_lines(&l->vsoa, &l->mem, l->vertical, &l->vgrid);
+	pack_lines(&l->hsoa, &l->mem, l->horizontal, &l->hgrid);
+}
+
+/* Calls f with every terrain line that touches the box r, horizontal ones
+ * first, and returns how many there were. */
+int lines_in_rect(level const *lev, rect const *r, void (*f)(line const *, bool vertical, void *), void *data)
+{
+	rect qh = { x: r->y, y: r->x, w: r->h, h: r->w };
+	rect qv = *r;
+
+	return grid_visit(&lev->hgrid, lev->horizontal, &qh, false, f, data) +
+	       grid_visit(&lev->vgrid, lev->vertical, &qv, true, f, data);
+}
+
+/* The first line in array order that the box hits decides the result, so
+ * every candidate is tested and the hit with the lowest index is kept. */
+enum hit collides_with_terrain(rect const *r, level const *lev)
+{
+	enum hit a;
+
+	rect hb = *r;
+	hb.h -= 1;
+
+	/* the boxes, as p and span, a line has to pass through to be hit */
+	rect qh = { x: hb.y, y: r->x, w: hb.h, h: r->w };
+	rect qv = { x: r->x, y: hb.y, w: r->w, h: hb.h };
+
+	a = grid_hit(&lev->hgrid, lev->horizontal, &hb, &qh, intersects_x);
+	if (a != HIT_NONE) { return a; }
+
+	return grid_hit(&lev->vgrid, lev->vertical, &hb, &qv, intersects_y);
+}
+
+/* collides_with_terrain for n boxes at once, one direction after the
+ * other, so each pass keeps to one grid.  A box only looks at the cells
+ * it touches, whose lines lie side by side in the columns; lines_hit
+ * tests them several at a time, so out[i] is what collides_with_terrain
+ * says. */
+void collides_with_terrain_batch(rect const *r, int n, level const *lev, enum hit *out)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		rect hb = r[i];
+		hb.h -= 1;
+		rect qh = { x: hb.y, y: hb.x, w: hb.h, h: hb.w };
+		out[i] = cells_hit(&lev->hgrid, &lev->hsoa, &hb, &qh, false);
+	}
+	for (i = 0; i < n; i++) {
+		if (out[i] != HIT_NONE) { continue; }
+		rect hb = r[i];
+		hb.h -= 1;
+		out[i] = cells_hit(&lev->vgrid, &lev->vsoa, &hb, &hb, true);
+	}
+}
+
+bool stands_on_terrain(rect const *r, level const *t)
+{
+	point mid = entity_feet(r);
+	line_grid const *g = &t->hgrid;
+
+	int cp, cs, k;
+	if (!grid_span(g, mid.y, mid.y, true, &cp, &cp) || !grid_span(g, mid.x, mid.x, false, &cs, &cs)) {
+		return false;
+	}
+
+	int c = cp * g->ns + cs;
+	for (k = g->start[c]; k < g->start[c + 1]; k++) {
+		if (pt_on_line(&mid, &t->horizontal[g->idx[k]])) { return true; }
+	}
+
+	return false;
+}
+
+void entity_hitbox(entity_state const *s, rect *box)
+{
+	*box = (rect) { x: s->pos.x,
+			    y: s->pos.y + s->hitbox.y,
+			    w: s->hitbox.w,
+			    h: s->hitbox.h };
+	switch (s->dir) {
+	case DIR_LEFT:
+		box->x += s->hitbox.x;
+		break;
+	case DIR_RIGHT:
+		box->x += s->spawn.w - s->hitbox.x - s->hitbox.w;
+		break;
+	}
+}
+
+int cmp_lines(void const *x, void const *y)
+{
+	line const *a = (line const *) x;
+	line const *b = (line const *) y;
+	if (a->p < b->p) { return -1; }
+	return a->p > b->p;
+}
+
+point entity_feet(rect const *r)
+{
+	return (point) { x: r->x + r->w / 2, y: r->y + r->h };
+}
+
+bool pt_on_line(point const *p, line const *l)
+{
+	return p->y == l->p && between(p->x, l->a, l->b);
+}
+
+static enum hit intersects_x(line const *l, rect const *r)
+{
+	int rx1 = r->x;
+	int rxm = r->x + r->w / 2;
+	int rx2 = r->x + r->w;
+	int ry1 = r->y;
+	int ry2 = r->y + r->h;
+
+	if (between(l->p, ry1, ry2) &&
+		(between(rx1, l->a, l->b) || (between(rxm, l->a, l->b)) ||
+		 between(l->a, rx1, rxm) || between(l->b, rx1, rxm))) {
+		return HIT_LEFT;
+	}
+
+	if (between(l->p, ry1, ry2) &&
+		(between(rxm, l->a, l->b) || (between(rx2, l->a, l->b)) ||
+		 between(l->a, rx1, rx2) || between(l->b, rx1, rx2))) {
+		return HIT_RIGHT;
+	}
+
+	return HIT_NONE;
+}
+
+static enum hit intersects_y(line const *l, rect const *r)
+{
+	int rx1 = r->x;
+	int rxm = r->x + r->w / 2;
+	int rx2 = r->x + r->w;
+	int ry1 = r->y;
+	int ry2 = r->y + r->h;
+
+	if (between(l->p, rx1, rxm) &&
+		(between(ry1, l->a, l->b) || (between(ry2, l->a, l->b)) ||
+		 between(l->a, ry1, ry2) || between(l->b, ry1, ry2))) {
+		return HIT_LEFT;
+	}
+
+	if (between(l->p, rxm, rx2) &&
+		(between(ry1, l->a, l->b) || (between(ry2, l->a, l->b)) ||
+		 between(l->a, ry1, ry2) || between(l->b, ry1, ry2))) {
+		return HIT_RIGHT;
+	}
+
+	return HIT_NONE;
+}
+
+/* line grids */
+#define GRID_CELL 64
+#define GRID_MAX_CELLS (1 << 20)
+
+static void build_grid(line_grid *g, arena *mem, line const *l, int n)
+{
+	*g = (line_grid) { cell: GRID_CELL };
+	if (n == 0) {
+		return;
+	}
+
+	int i, p0, p1, s0, s1;
+	p0 = p1 = l[0].p;
+	s0 = s1 = l[0].a;
+	for (i = 0; i < n; i++) {
+		if (l[i].p < p0) { p0 = l[i].p; }
+		if (l[i].p > p1) { p1 = l[i].p; }
+		if (l[i].a < s0) { s0 = l[i].a; }
+		if (l[i].b < s0) { s0 = l[i].b; }
+		if (l[i].a > s1) { s1 = l[i].a; }
+		if (l[i].b > s1) { s1 = l[i].b; }
+	}
+
+	/* keep huge levels from eating memory, at the cost of fuller cells */
+	while ((double) ((p1 - p0) / g->cell + 1) * ((s1 - s0) / g->cell + 1) > GRID_MAX_CELLS) {
+		g->cell *= 2;
+	}
+	g->p0 = p0;
+	g->s0 = s0;
+	g->np = (p1 - p0) / g->cell + 1;
+	g->ns = (s1 - s0) / g->cell + 1;
+
+	int nc = g->np * g->ns;
+	g->start = arena_alloc(mem, sizeof(int) * (nc + 1));
+	memset(g->start, 0, sizeof(int) * (nc + 1));
+
+	/* count the lines per cell, turn the counts into offsets and then
+	 * fill the cells in line order, which keeps every cell sorted */
+	int pass, c, cp, c0, c1;
+	int *fill = 0;
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < n; i++) {
+			int lo = l[i].a < l[i].b ? l[i].a : l[i].b;
+			int hi = l[i].a < l[i].b ? l[i].b : l[i].a;
+			/* the grid was sized around every line */
+			if (!grid_span(g, l[i].p, l[i].p, true, &cp, &cp) ||
+			    !grid_span(g, lo, hi, false, &c0, &c1)) {
+				continue;
+			}
+			for (c = cp * g->ns + c0; c <= cp * g->ns + c1; c++) {
+				if (pass == 0) {
+					g->start[c + 1] += 1;
+				} else {
+					g->idx[fill[c]++] = i;
+				}
+			}
+		}
+
+		if (pass == 0) {
+			for (c = 0; c < nc; c++) {
+				g->start[c + 1] += g->start[c];
+			}
+			g->idx = arena_alloc(mem, sizeof(int) * g->start[nc]);
+			fill = malloc(sizeof(int) * nc);
+			memcpy(fill, g->start, sizeof(int) * nc);
+		}
+	}
+	free(fill);
+}
+
+/* line columns */
+
+/* The columns of the n lines l, which are sorted by p, and where each of
+ * the rows of g starts in them. */
+static void pack_lines(line_soa *s, arena *mem, line const *l, line_grid const *g)
+{
+	int k, n = g->start ? g->start[g->np * g->ns] : 0;
+
+	s->n = n;
+	s->p = arena_alloc(mem, sizeof(int) * n);
+	s->a = arena_alloc(mem, sizeof(int) * n);
+	s->b = arena_alloc(mem, sizeof(int) * n);
+	s->id = arena_alloc(mem, sizeof(int) * n);
+	for (k = 0; k < n; k++) {
+		line const *ln = &l[g->idx[k]];
+		s->p[k] = ln->p;
+		s->a[k] = ln->a;
+		s->b[k] = ln->b;
+		s->id[k] = g->idx[k];
+	}
+}
+
+/* the cells lo..hi covers along p or along the span, false if none */
+static bool grid_span(line_grid const *g, int lo, int hi, bool p, int *c0, int *c1)
+{
+	int o = p ? g->p0 : g->s0;
+	int n = p ? g->np : g->ns;
+
+	if (n == 0 || hi < o || lo > o + n * g->cell - 1) {
+		return false;
+	}
+
+	*c0 = lo < o ? 0 : (lo - o) / g->cell;
+	*c1 = (hi - o) / g->cell;
+	if (*c1 >= n) { *c1 = n - 1; }
+
+	return true;
+}
+
+/* q holds the range of p in x and w and the range of the span in y and h,
+ * either of which may run backwards for boxes without height */
+static bool grid_cells(line_grid const *g, rect const *q, int *p0, int *p1, int *s0, int *s1)
+{
+	return grid_span(g, q->w < 0 ? q->x + q->w : q->x, q->w < 0 ? q->x : q->x + q->w, true, p0, p1) &&
+	       grid_span(g, q->h < 0 ? q->y + q->h : q->y, q->h < 0 ? q->y : q->y + q->h, false, s0, s1);
+}
+
+static enum hit grid_hit(line_grid const *g, line const *l, rect const *r, rect const *q,
+			 enum hit (*hit)(line const *, rect const *))
+{
+	enum hit a = HIT_NONE;
+	int best = -1;
+
+	int p0, p1, s0, s1;
+	if (!grid_cells(g, q, &p0, &p1, &s0, &s1)) {
+		return a;
+	}
+
+	int cp, cs, k;
+	for (cp = p0; cp <= p1; cp++) {
+		for (cs = s0; cs <= s1; cs++) {
+			int c = cp * g->ns + cs;
+			for (k = g->start[c]; k < g->start[c + 1]; k++) {
+				int i = g->idx[k];
+				if (best >= 0 && i >= best) { break; }
+
+				enum hit h = hit(&l[i], r);
+				if (h != HIT_NONE) {
+					a = h;
+					best = i;
+				}
+			}
+		}
+	}
+
+	return a;
+}
+
+/* grid_hit over the columns: the lowest line in array order that r hits
+ * decides, so in every further cell only the lines before it are tested */
+static enum hit cells_hit(line_grid const *g, line_soa const *s, rect const *r, rect const *q, bool vertical)
+{
+	enum hit a = HIT_NONE;
+	int best = -1;
+
+	int p0, p1, s0, s1;
+	if (!grid_cells(g, q, &p0, &p1, &s0, &s1)) {
+		return a;
+	}
+
+	int cp, cs;
+	for (cp = p0; cp <= p1; cp++) {
+		for (cs = s0; cs <= s1; cs++) {
+			int c = cp * g->ns + cs;
+			int k = g->start[c], end = g->start[c + 1];
+			while (best >= 0 && end > k && s->id[end - 1] >= best) { end--; }
+			if (k == end) { continue; }
+
+			enum hit h;
+			int j = lines_hit(s, k, end, r, vertical, &h);
+			if (j < end) {
+				a = h;
+				best = s->id[j];
+			}
+		}
+	}
+
+	return a;
+}
+
+/* Visits the lines of g that touch q, with q in grid coordinates (p along
+ * x).  A line is listed in every cell along its span, so it is only taken
+ * in the first of those that q covers. */
+static int grid_visit(line_grid const *g, line const *l, rect const *q, bool vertical,
+		      void (*f)(line const *, bool, void *), void *data)
+{
+	int p0, p1, s0, s1;
+	if (!grid_cells(g, q, &p0, &p1, &s0, &s1)) {
+		return 0;
+	}
+
+	int cp, cs, k, n = 0;
+	for (cp = p0; cp <= p1; cp++) {
+		for (cs = s0; cs <= s1; cs++) {
+			int c = cp * g->ns + cs;
+			for (k = g->start[c]; k < g->start[c + 1]; k++) {
+				line const *ln = &l[g->idx[k]];
+				int lo = ln->a < ln->b ? ln->a : ln->b;
+				int hi = ln->a < ln->b ? ln->b : ln->a;
+
+				/* listed in c, the line always spans some cell */
+				int first, last;
+				if (grid_span(g, lo, hi, false, &first, &last) &&
+				    cs != (first > s0 ? first : s0)) {
+					continue;
+				}
+
+				if (ln->p < q->x || ln->p > q->x + q->w || hi < q->y || lo > q->y + q->h) {
+					continue;
+				}
+
+				f(ln, vertical, data);
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+/* sweeps */
+
+/* The first step at which the box hits a line, n + 1 if it never does.
+ * Every condition intersects_x and intersects_y test is an interval of
+ * positions, which the monotonic steps turn into an interval of steps. */
+static int sweep_hit(sweep const *s, level const *lev)
+{
+	int first = s->n + 1;
+
+	int h = s->from.h - 1;
+	int x0 = s->from.x + (s->dirx < 0 ? -s->vx : 0);
+	int x1 = s->from.x + (s->dirx < 0 ? 0 : s->vx);
+	int y0 = s->from.y + (s->diry < 0 ? -s->vy : 0) + (h < 0 ? h : 0);
+	int y1 = s->from.y + (s->diry < 0 ? 0 : s->vy) + (h < 0 ? 0 : h);
+
+	/* the area the lines have to pass through, as p and span */
+	rect qh = { x: y0, y: x0, w: y1 - y0, h: x1 - x0 + s->from.w };
+	rect qv = { x: x0, y: y0, w: x1 - x0 + s->from.w, h: y1 - y0 };
+
+	int p0, p1, s0, s1, cp, cs, k;
+	if (grid_cells(&lev->hgrid, &qh, &p0, &p1, &s0, &s1)) {
+		line_grid const *g = &lev->hgrid;
+		for (cp = p0; cp <= p1; cp++) {
+			for (cs = s0; cs <= s1; cs++) {
+				int c = cp * g->ns + cs;
+				for (k = g->start[c]; k < g->start[c + 1]; k++) {
+					int i = hline_step(s, &lev->horizontal[g->idx[k]]);
+					if (i < first) { first = i; }
+				}
+			}
+		}
+	}
+	if (grid_cells(&lev->vgrid, &qv, &p0, &p1, &s0, &s1)) {
+		line_grid const *g = &lev->vgrid;
+		for (cp = p0; cp <= p1; cp++) {
+			for (cs = s0; cs <= s1; cs++) {
+				int c = cp * g->ns + cs;
+				for (k = g->start[c]; k < g->start[c + 1]; k++) {
+					int i = vline_step(s, &lev->vertical[g->idx[k]]);
+					if (i < first) { first = i; }
+				}
+			}
+		}
+	}
+
+	return first;
+}
+
+/* The first step before limit at which the box's feet are on no line,
+ * limit if they stay on the ground.  The steps each line carries the feet
+ * over are an interval, so the first step is found by hopping from one
+ * interval's end to the next until no line covers it. */
+static int sweep_fall(sweep const *s, level const *lev, int limit)
+{
+	line_grid const *g = &lev->hgrid;
+	int m = s->from.w / 2;
+	int h = s->from.h;
+
+	int x0 = s->from.x + (s->dirx < 0 ? -s->vx : 0) + m;
+	int x1 = s->from.x + (s->dirx < 0 ? 0 : s->vx) + m;
+	int y0 = s->from.y + (s->diry < 0 ? -s->vy : 0) + h;
+	int y1 = s->from.y + (s->diry < 0 ? 0 : s->vy) + h;
+	rect q = { x: y0, y: x0, w: y1 - y0, h: x1 - x0 };
+
+	int p0, p1, s0, s1;
+	if (!grid_cells(g, &q, &p0, &p1, &s0, &s1)) {
+		return 1 < limit ? 1 : limit;
+	}
+
+	int cur = 1;
+	bool moved = true;
+	while (cur < limit && moved) {
+		moved = false;
+
+		int cp, cs, k;
+		for (cp = p0; cp <= p1; cp++) {
+			for (cs = s0; cs <= s1; cs++) {
+				int c = cp * g->ns + cs;
+				for (k = g->start[c]; k < g->start[c + 1]; k++) {
+					line const *l = &lev->horizontal[g->idx[k]];
+					int ix[2], iy[2];
+					sweep_y(s, l->p - h, l->p - h, &iy[0], &iy[1]);
+					sweep_x(s, l->a - m, l->b - m, &ix[0], &ix[1]);
+					if (between(cur, ix[0], ix[1]) && between(cur, iy[0], iy[1])) {
+						cur = (ix[1] < iy[1] ? ix[1] : iy[1]) + 1;
+						moved = true;
+					}
+				}
+			}
+		}
+	}
+
+	return cur < limit ? cur : limit;
+}
+
+/* the first step at which intersects_x is true for l, n + 1 if never */
+static int hline_step(sweep const *s, line const *l)
+{
+	int w = s->from.w;
+	int m = w / 2;
+	int h = s->from.h - 1;
+	int a = l->a;
+	int b = l->b;
+
+	int iy[1][2];
+	sweep_y(s, l->p - h, l->p, &iy[0][0], &iy[0][1]);
+	if (iy[0][0] > iy[0][1]) {
+		return s->n + 1;
+	}
+
+	int const xs[7][2] = {
+		{ a, b }, { a - m, b - m }, { a - m, a }, { b - m, b },
+		{ a - w, b - w }, { a - w, a }, { b - w, b } };
+	int ix[7][2];
+	int j;
+	for (j = 0; j < 7; j++) {
+		sweep_x(s, xs[j][0], xs[j][1], &ix[j][0], &ix[j][1]);
+	}
+
+	return first_common(ix, 7, iy, 1, s->n + 1);
+}
+
+/* the first step at which intersects_y is true for l, n + 1 if never */
+static int vline_step(sweep const *s, line const *l)
+{
+	int w = s->from.w;
+	int m = w / 2;
+	int h = s->from.h - 1;
+	int p = l->p;
+	int a = l->a;
+	int b = l->b;
+
+	int const xs[2][2] = { { p - m, p }, { p - w, p - m } };
+	int const ys[4][2] = { { a, b }, { a - h, b - h }, { a - h, a }, { b - h, b } };
+	int ix[2][2], iy[4][2];
+	int j;
+	for (j = 0; j < 2; j++) {
+		sweep_x(s, xs[j][0], xs[j][1], &ix[j][0], &ix[j][1]);
+	}
+	for (j = 0; j < 4; j++) {
+		sweep_y(s, ys[j][0], ys[j][1], &iy[j][0], &iy[j][1]);
+	}
+
+	return first_common(ix, 2, iy, 4, s->n + 1);
+}
+
+/* the steps at which the box's x lies in lo..hi */
+static void sweep_x(sweep const *s, int lo, int hi, int *i0, int *i1)
+{
+	if (s->dirx < 0) {
+		sweep_steps(s->vx, s->n, s->from.x - hi, s->from.x - lo, i0, i1);
+	} else {
+		sweep_steps(s->vx, s->n, lo - s->from.x, hi - s->from.x, i0, i1);
+	}
+}
+
+static void sweep_y(sweep const *s, int lo, int hi, int *i0, int *i1)
+{
+	if (s->diry < 0) {
+		sweep_steps(s->vy, s->n, s->from.y - hi, s->from.y - lo, i0, i1);
+	} else {
+		sweep_steps(s->vy, s->n, lo - s->from.y, hi - s->from.y, i0, i1);
+	}
+}
+
+/* The steps 1..n at which floor(i * v / n) lies in lo..hi, an empty
+ * interval if there are none.  v <= n, so every offset up to v is met. */
+static void sweep_steps(int v, int n, int lo, int hi, int *i0, int *i1)
+{
+	*i0 = n + 1;
+	*i1 = 0;
+
+	if (lo > hi || hi < 0 || lo > v) {
+		return;
+	}
+
+	*i0 = lo <= 0 ? 1 : (int) (((long) lo * n + v - 1) / v);
+	*i1 = hi >= v ? n : (int) (((long) (hi + 1) * n - 1) / v);
+	if (*i0 < 1) { *i0 = 1; }
+}
+
+/* the first step in one interval of a and one of b, none if there is none */
+static int first_common(int (*a)[2], int na, int (*b)[2], int nb, int none)
+{
+	int first = none;
+
+	int i, j;
+	for (i = 0; i < na; i++) {
+		for (j = 0; j < nb; j++) {
+			int lo = a[i][0] > b[j][0] ? a[i][0] : b[j][0];
+			int hi = a[i][1] < b[j][1] ? a[i][1] : b[j][1];
+			if (lo <= hi && lo < first) {
+				first = lo;
+			}
+		}
+	}
+
+	return first;
+}
+
+/* general low-level */
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* Formats a path into a buffer of the calling thread's own, valid until
+ * that thread calls set_path again. */
+char const *set_path(char const *fmt, ...)
+{
+	static THREAD_LOCAL char buf[MAX_PATH];
+
+	va_list ap;
+	va_start(ap, fmt);
+
+	vsnprintf(buf, MAX_PATH - 1, fmt, ap);
+	va_end(ap);
+
+	return buf;
+}
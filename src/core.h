@@ -0,0 +1,378 @@
+#ifndef FRIDGE_CORE_H
+#define FRIDGE_CORE_H
+
+/* The simulation core: geometry, terrain, animation, movement and the game
+ * rules.  Nothing in here may depend on SDL, so the simulation can run
+ * without a window or renderer (see sim.c). */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+
+#define MAX_PATH 500
+#define CONF_DIR  "conf"
+#define ASSET_DIR "assets"
+
+#define streq(s1, s2) !strcmp(s1, s2)
+#define between(x, y1, y2) (x >= y1 && x <= y2)
+
+enum dir { DIR_LEFT = -1, DIR_RIGHT = 1 };
+enum hit { HIT_NONE = 0, HIT_TOP = 1, HIT_LEFT = 1 << 1, HIT_RIGHT = 1 << 2, HIT_BOT = 1 << 3 };
+enum state { ST_IDLE, ST_WALK, ST_FALL, ST_JUMP, ST_HANG, NSTATES };
+static char const * const st_names[] = { "idle", "walk", "fall", "jump", "hang" };
+
+typedef struct {
+	int x;
+	int y;
+} point;
+
+typedef struct {
+	int x;
+	int y;
+	int w;
+	int h;
+} rect;
+
+typedef struct {
+	int p;
+	int a;
+	int b;
+} line;
+
+/* Memory that is handed out in order and given back all at once, see
+ * arena.c.  Zeroed, or after arena_init, it is empty. */
+typedef struct arena_block arena_block;
+typedef struct {
+	arena_block *head;
+	size_t used; /* of head */
+} arena;
+
+/* A uniform grid over the lines of one direction, keyed on their position
+ * p and their span a..b.  Each cell lists the indices of the lines passing
+ * through it in ascending order; the cells are stored row by row, by p,
+ * as the ranges start[c]..start[c + 1] of idx. */
+typedef struct {
+	int p0, s0;
+	int cell;
+	int np, ns;
+	int *start;
+	int *idx;
+} line_grid;
+
+/* The lines of one direction again, cell by cell as the grid lists them,
+ * as one array per field for the batched tests in hit.c.  Cell c holds
+ * start[c]..start[c + 1] of them, as in the grid's idx, and id is each
+ * line's index in the level's own array. */
+typedef struct {
+	int n;
+	int *p;
+	int *a;
+	int *b;
+	int *id;
+} line_soa;
+
+typedef struct {
+	rect dim;
+	int nvertical;
+	int nhorizontal;
+	line *vertical;
+	line *horizontal;
+	line_grid vgrid;
+	line_grid hgrid;
+	line_soa vsoa;
+	line_soa hsoa;
+	int active_radius; /* enemies further from the player stand still; 0 for none */
+	arena mem; /* the lines, grids and columns above */
+} level;
+
+/* Frame i shows for duration[i] + 1 ticks.  timeline holds the index of
+ * the frame showing at each of the period ticks of one loop, so where an
+ * animation is follows from when it began alone. */
+typedef struct {
+	unsigned len;
+	unsigned *frames;
+	unsigned *duration;
+	unsigned period;
+	unsigned *timeline;
+	rect box;
+} animation_rule;
+
+typedef struct {
+	rect start_dim;
+	int walk_dist;
+	int jump_dist_x;
+	int jump_dist_y;
+	int jump_time;
+	int fall_dist;
+	bool has_gravity;
+	double a_wide;
+	double a_high;
+	animation_rule anim[NSTATES];
+	void *tex; /* owned by the render layer, opaque to the core */
+	point sheet; /* where the frames start in tex */
+} entity_rule;
+
+typedef struct {
+	unsigned start; /* the game clock when the animation began */
+} animation_state;
+
+enum jump_type { JUMP_WIDE, JUMP_HIGH, JUMP_HANG };
+
+typedef struct {
+	bool active;
+	point pos;
+	rect hitbox;
+	rect spawn;
+	enum dir dir;
+	enum state st;
+	int jump_timeout;
+	enum jump_type jump_type;
+	int fall_time;
+	animation_state anim;
+	entity_rule const *rule;
+} entity_state;
+
+typedef struct {
+	bool walk;
+	bool move_left;
+	bool move_right;
+	bool move_jump;
+} entity_event;
+
+typedef struct {
+	int walked;
+	int jumped;
+	int fallen;
+	bool turned;
+	bool hang;
+} move_log;
+
+typedef struct {
+	bool active;
+	bool frames;
+	bool hitboxes;
+	bool pause;
+	bool show_terrain_collision;
+	bool message_positions;
+} debug_state;
+
+/* game rules */
+enum mode { MODE_LOGO, MODE_INTRO, MODE_GAME, MODE_EXIT };
+
+enum msg_frequency { MSG_NEVER, MSG_ONCE, MSG_ALWAYS };
+static char const * const frq_names[] = { "never", "once", "always" };
+
+typedef struct {
+	enum msg_frequency when;
+	point pos;
+} message;
+
+typedef struct {
+	unsigned n;
+	int timeout;
+	message *msgs;
+} msg_info;
+
+typedef struct {
+	point pos;
+	message win;
+	message loss;
+} finish;
+
+enum trigger_kind { TRIGGER_MESSAGE, TRIGGER_FINISH };
+
+typedef struct {
+	enum trigger_kind kind;
+	int i;
+	point pos;
+} trigger;
+
+/* the triggers bucketed into a grid, cells row by row as the ranges
+ * start[c]..start[c + 1] of idx, and the ones found by the last lookup */
+typedef struct {
+	int n;
+	trigger *t;
+	int x0, y0;
+	int nx, ny;
+	int *start;
+	int *idx;
+	bool cached;
+	rect cells;
+	int nnear;
+	int *near;
+} trigger_index;
+
+typedef struct {
+	level level;
+	msg_info msg;
+	finish finish;
+	trigger_index triggers;
+} world;
+
+/* what changes about an entity from tick to tick, besides where it is */
+typedef struct {
+	enum state st;
+	enum dir dir;
+	int jump_timeout;
+	enum jump_type jump_type;
+	int fall_time;
+} entity_motion;
+
+/* The entities of a group, field by field, so the passes over all of them
+ * only touch what they need.  group_get and group_put go through one
+ * entity as an entity_state.  box is the hitbox in level coordinates,
+ * kept up to date by group_put. */
+typedef struct {
+	unsigned n;
+	bool *active;
+	point *pos;
+	rect *box;
+	entity_motion *motion;
+	/* rarely needed */
+	animation_state *anim;
+	rect *hitbox;
+	rect *spawn;
+	entity_rule const **rule;
+} group;
+
+enum group { GROUP_PLAYER, GROUP_OBJECTS, GROUP_ENEMIES, NGROUPS };
+
+/* a box in the broadphase, as its corners */
+typedef struct {
+	bool live;
+	int x0, y0;
+	int x1, y1;
+} bp_box;
+
+typedef struct {
+	int a, b;
+} bp_pair;
+
+typedef struct {
+	int n;
+	bp_box *box;
+	int *order;
+	bp_pair *pairs;
+	int npairs;
+	int pairs_cap;
+} broadphase;
+
+typedef struct {
+	int need_to_collect;
+	entity_state logo;
+	entity_state intro;
+	group entities[NGROUPS];
+	message const *msg;
+	unsigned msg_timeout;
+	enum mode run;
+	unsigned clock; /* ticks since the current mode began; animations run on it */
+	debug_state debug;
+	broadphase bp;
+} game_state;
+
+typedef struct {
+	entity_event player;
+	bool toggle_pause;
+	bool toggle_debug;
+	bool toggle_terrain;
+	bool reload_conf;
+	bool exit;
+	bool keyboard;
+	bool reset;
+} game_event;
+
+/* loading (conf.c) */
+void load_anim(json_t *src, char const *name, char const *key, arena *mem, animation_rule *a);
+void load_entity_rule(json_t *src, entity_rule *er, char const *n);
+json_t *load_entity_rules(char const *root, char const *file, arena *mem, entity_rule **rules);
+bool load_entity_resource(json_t *src, char const *n, arena *mem, entity_rule *er, char const *root);
+json_t *load_level(level *l, json_t *game, char const *root);
+bool load_finish(finish *f, json_t *game);
+bool load_messages(msg_info *mi, arena *mem, json_t *game);
+
+/* state */
+void load_state(entity_state *es, unsigned now);
+void init_entity_state(entity_state *es, entity_rule const *er, enum state st, unsigned now);
+void clear_debug(debug_state *d);
+
+/* teardown */
+void destroy_level(level *l);
+
+/* state updates */
+void clear_order(entity_event *o);
+unsigned anim_pos(entity_state const *e, unsigned now);
+unsigned anim_frame(entity_state const *e, unsigned now);
+int kick_entity(entity_state *e, enum hit h, point const *v);
+
+/* movement */
+point entity_vector_move(entity_state *e, point const *v, level const *terrain, bool grav);
+void move_entity(entity_state *e, entity_event const *ev, level const *lvl, move_log *mlog);
+
+/* collision */
+void index_level(level *l);
+void index_columns(level *l);
+enum hit collides_with_terrain(rect const *r, level const *lev);
+void collides_with_terrain_batch(rect const *r, int n, level const *lev, enum hit *out);
+int lines_in_rect(level const *lev, rect const *r, void (*f)(line const *, bool vertical, void *), void *data);
+bool stands_on_terrain(rect const *r, level const *t);
+void entity_hitbox(entity_state const *s, rect *box);
+int cmp_lines(void const *x, void const *y);
+point entity_feet(rect const *r);
+
+/* game (game.c) */
+void update_gamestate(world *w, game_state *gs, game_event const *ev);
+void alloc_group(group *g, arena *mem, int n);
+void group_get(group const *g, int i, entity_state *e);
+void group_put(group *g, int i, entity_state const *e);
+void set_group_state(group *g, enum state st, unsigned now);
+void enemy_movement(level const *terrain, group *nmi, rect const *player);
+void clear_game(game_state *gs);
+void clear_event(game_event *ev);
+void destroy_world(world *w);
+void destroy_game(game_state *gs);
+bool in_rect(point const *p, rect const *r);
+bool have_collision(rect const *r1, rect const *r2);
+
+/* hit tests (hit.c); bit i of mask is set when q touches candidate i */
+void boxes_hit(rect const *q, rect const *r, int n, uint32_t *mask);
+void points_hit(rect const *q, point const *p, int n, uint32_t *mask);
+int lines_hit(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h);
+char const *hit_kernels(void);
+
+/* broadphase (broadphase.c) */
+void bp_resize(broadphase *bp, int n);
+void bp_set(broadphase *bp, int id, rect const *r);
+void bp_remove(broadphase *bp, int id);
+int bp_collide(broadphase *bp);
+void bp_destroy(broadphase *bp);
+
+/* triggers (trigger.c) */
+void index_triggers(world *w, arena *mem);
+int near_triggers(world *w, rect const *r, int const **ids);
+
+/* arenas (arena.c) */
+void arena_init(arena *a);
+void *arena_alloc(arena *a, size_t n);
+void *arena_copy(arena *a, void const *src, size_t n);
+void arena_free(arena *a);
+
+/* snapshots (snapshot.c) */
+size_t snapshot_size(world const *w, game_state const *gs);
+void snapshot_save(world const *w, game_state const *gs, void *buf);
+bool snapshot_restore(world *w, game_state *gs, void const *buf, size_t size);
+uint32_t snapshot_hash(world const *w, game_state const *gs);
+
+/* low-level json */
+char const *get_asset(json_t *a, char const *k);
+bool get_int_field(json_t *o, char const *n, char const *s, int *r);
+bool get_float_field(json_t *o, char const *n, char const *s, double *r);
+
+/* general low-level */
+char const *set_path(char const *fmt, ...);
+
+#endif
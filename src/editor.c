@@ -43,17 +43,23 @@ typedef struct {
 	SDL_bool panning;
 	SDL_Point view;
 	TTF_Font *font;
+	glyph_atlas text;
 	tile floor;
 	tile platf;
 	tile wall;
 	tile ceil;
 	unsigned ticks;
+	unsigned clock; /* the player's animation runs on it */
 	entity_state player;
 	json_t *platforms;
 	json_t *rooms;
 	level *cached;
+	SDL_Texture *background;
 	debug_state debug;
 	SDL_Texture *scenery;
+	input_latency input;
+	sprite_atlas sprites;
+	arena rules; /* the entity rules, the player's among them */
 	SDL_Renderer *r;
 	SDL_Window *w;
 } editor_state;
@@ -113,7 +119,7 @@ static void draw_platform(SDL_Renderer *r, SDL_Rect *p, tile const *t)
 	draw_tiles(r, p, t, SDL_FALSE);
 }
 
-static void draw_platforms(SDL_Renderer *r, json_t const *ps, tile const *t, SDL_Rect const *off)
+static void draw_platforms(SDL_Renderer *r, json_t const *ps, tile const *t, rect const *off)
 {
 	int i;
 	json_t *m;
@@ -151,7 +157,7 @@ static void draw_room(SDL_Renderer *rend, SDL_Rect const *r, tile const *floor,
 	draw_tiles(rend, &loor, floor, SDL_FALSE);
 }
 
-static void draw_rooms(SDL_Renderer *r, json_t const *ps, tile const *floor, tile const *wall, tile const *ceil, SDL_Rect const *off)
+static void draw_rooms(SDL_Renderer *r, json_t const *ps, tile const *floor, tile const *wall, tile const *ceil, rect const *off)
 {
 	int i;
 	json_t *m;
@@ -185,11 +191,12 @@ static level *static_level(json_t *platforms, json_t *rooms)
 	level *l = malloc(sizeof(level));
 	int p = json_array_size(platforms);
 	int r = json_array_size(rooms);
-	l->dim = (SDL_Rect) { 0, 0, 0, 0 };
-	l->background = 0;
+	l->dim = (rect) { 0, 0, 0, 0 };
+	l->active_radius = 0;
 
-	l->horizontal = malloc(sizeof(line) * (p + 2 * r));
-	l->vertical = malloc(sizeof(line) * 2 * r);
+	arena_init(&l->mem);
+	l->horizontal = arena_alloc(&l->mem, sizeof(line) * (p + 2 * r));
+	l->vertical = arena_alloc(&l->mem, sizeof(line) * 2 * r);
 	l->nhorizontal = 0;
 	l->nvertical = 0;
 
@@ -233,6 +240,7 @@ static level *static_level(json_t *platforms, json_t *rooms)
 
 	qsort(l->vertical, l->nvertical, sizeof(line), cmp_lines);
 	qsort(l->horizontal, l->nhorizontal, sizeof(line), cmp_lines);
+	index_level(l);
 
 	l->dim.x -= 24;
 	l->dim.y -= 24;
@@ -278,8 +286,8 @@ static void update_terrain(editor_action const *a, editor_state *s)
 		destroy_level(s->cached);
 		free(s->cached);
 		s->cached = static_level(s->platforms, s->rooms);
-		SDL_DestroyTexture(s->cached->background);
-		s->cached->background = redraw_background(s);
+		SDL_DestroyTexture(s->background);
+		s->background = redraw_background(s);
 	}
 }
 
@@ -350,7 +358,7 @@ static void update_state(editor_action const *a, editor_state *s)
 		move_log log;
 		move_entity(&s->player, &a->player, s->cached, &log);
 
-		tick_animation(&s->player);
+		s->clock += 1;
 	}
 }
 
@@ -406,14 +414,17 @@ static void handle_event(SDL_Event const *e, editor_action *a)
 		a->coord.y = e->button.y;
 		break;
 	case SDL_MOUSEMOTION:
+		/* several motions in one frame add up to one */
 		a->move_mouse = SDL_TRUE;
 		a->coord.x = e->motion.x;
 		a->coord.y = e->motion.y;
-		a->movement.x = e->motion.xrel;
-		a->movement.y = e->motion.yrel;
+		a->movement.x += e->motion.xrel;
+		a->movement.y += e->motion.yrel;
 		break;
 	case SDL_WINDOWEVENT:
-		a->resized = e->window.event == SDL_WINDOWEVENT_RESIZED;
+		if (e->window.event == SDL_WINDOWEVENT_RESIZED) {
+			a->resized = SDL_TRUE;
+		}
 		break;
 	default:
 		break;
@@ -438,7 +449,7 @@ void clear_action(editor_action *a)
 	clear_order(&a->player);
 }
 
-static void render(editor_state const *s)
+static void render(editor_state *s)
 {
 	SDL_SetRenderDrawColor(s->r, 20, 40, 170, 255); /* blue */
 	SDL_RenderClear(s->r);
@@ -448,7 +459,7 @@ static void render(editor_state const *s)
 	}
 
 	SDL_Rect r = { s->view.x + s->cached->dim.x, s->view.y + s->cached->dim.y, s->cached->dim.w, s->cached->dim.h };
-	SDL_RenderCopy(s->r, s->cached->background, 0, &r);
+	SDL_RenderCopy(s->r, s->background, 0, &r);
 
 	int w, h;
 	SDL_GetWindowSize(s->w, &w, &h);
@@ -465,7 +476,8 @@ static void render(editor_state const *s)
 		}
 	}
 
-	draw_entity(s->r, &screen, &s->player, 0);
+	draw_entity(s->r, &screen, &s->player, s->clock, 0);
+	flush_sprites(s->r, &s->sprites);
 
 	if (s->debug.show_terrain_collision) {
 		draw_terrain_lines(s->r, s->cached, &screen);
@@ -473,9 +485,9 @@ static void render(editor_state const *s)
 
 	if (s->font) {
 		int l = 0;
-		render_line(s->r, mode_names[s->md], s->font, l++);
-		render_line(s->r, st_names[s->player.st], s->font, l++);
-		if (s->selecting) { render_line(s->r, "selecting...", s->font, l++); }
+		render_line(s->r, mode_names[s->md], &s->text, l++);
+		render_line(s->r, st_names[s->player.st], &s->text, l++);
+		if (s->selecting) { render_line(s->r, "selecting...", &s->text, l++); }
 	}
 
 	SDL_RenderPresent(s->r);
@@ -579,6 +591,7 @@ static SDL_bool init_editor(editor_state *st, SDL_Renderer *rend, SDL_Window *w)
 				"Warning: There will be no on-screen text\n",
 			file, TTF_GetError());
 	}
+	load_glyphs(&st->text, st->r, st->font);
 
 	SDL_Surface *srf;
 	file = json_string_value(json_object_get(conf, "scenery"));
@@ -605,12 +618,12 @@ static SDL_bool init_editor(editor_state *st, SDL_Renderer *rend, SDL_Window *w)
 	ok = load_tile(rend, til, "wall", &st->wall);
 	if (!ok) { return SDL_FALSE; }
 
-	SDL_Texture **e_texs;
 	entity_rule *e_rules;
 	json_t *entities;
 	file = json_string_value(json_object_get(conf, "entities"));
 	path = set_path("%s/%s/%s", "..", CONF_DIR, file);
-	entities = load_entities("..", path, rend, &e_texs, &e_rules);
+	arena_init(&st->rules);
+	entities = load_entities("..", path, rend, &st->rules, &e_rules, &st->sprites);
 	if (!entities) { return SDL_FALSE; }
 
 	int pi;
@@ -618,11 +631,11 @@ static SDL_bool init_editor(editor_state *st, SDL_Renderer *rend, SDL_Window *w)
 	character = json_object_get(entities, "man");
 	pi = json_integer_value(json_object_get(character, "index"));
 
-	st->player.spawn = (SDL_Rect) { x: 100, y: 100 };
-	init_entity_state(&st->player, &e_rules[pi], e_texs[pi], ST_IDLE);
+	st->player.spawn = (rect) { x: 100, y: 100 };
+	init_entity_state(&st->player, &e_rules[pi], ST_IDLE, 0);
 
-	SDL_Rect hb;
-	SDL_Point ft;
+	rect hb;
+	point ft;
 	entity_hitbox(&st->player, &hb);
 	ft = entity_feet(&hb);
 
@@ -630,11 +643,12 @@ static SDL_bool init_editor(editor_state *st, SDL_Renderer *rend, SDL_Window *w)
 	add_rect(st->platforms, &plat);
 
 	st->cached = static_level(st->platforms, st->rooms);
-	st->cached->background = redraw_background(st);
+	st->background = redraw_background(st);
 	clear_debug(&st->debug);
 	json_decref(conf);
 
 	st->ticks = SDL_GetTicks();
+	st->clock = 0;
 
 	return SDL_TRUE;
 }
@@ -647,12 +661,16 @@ static void destroy_tile(tile const *t)
 	}
 }
 
-static void destroy_state(editor_state const *st)
+static void destroy_state(editor_state *st)
 {
 	json_decref(st->platforms);
 	json_decref(st->rooms);
+	destroy_glyphs(&st->text);
+	destroy_sprites(&st->sprites);
+	arena_free(&st->rules);
 	if (st->font) { TTF_CloseFont(st->font); }
 	destroy_level(st->cached);
+	SDL_DestroyTexture(st->background);
 	destroy_tile(&st->wall);
 	destroy_tile(&st->floor);
 	destroy_tile(&st->platf);
@@ -663,7 +681,6 @@ static void destroy_state(editor_state const *st)
 
 int main(void)
 {
-	int have_event;
 	SDL_Renderer *r;
 	SDL_Window *w;
 	SDL_bool ok;
@@ -679,21 +696,33 @@ int main(void)
 	while (st.run) {
 		SDL_Event ev;
 
+		/* take everything pending, but stop after a click: a press and
+		 * a release in the same action would cancel out, and the
+		 * position of the press would be lost to later motion */
 		clear_action(&act);
-		have_event = SDL_PollEvent(&ev);
-		if (have_event) {
+		while (SDL_PollEvent(&ev)) {
+			latency_event(&st.input, &ev);
 			handle_event(&ev, &act);
+			if (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEBUTTONUP) {
+				break;
+			}
 		}
 
 		unsigned char const *keystate = SDL_GetKeyboardState(0);
 		keystate_to_movement(keystate, &act.player);
 
 		update_state(&act, &st);
+		latency_consume(&st.input, SDL_GetTicks());
 
 		render(&st);
 		SDL_Delay(TICK / 4);
 	}
 
+	if (st.input.events > 0) {
+		printf("input latency: %u ms mean, %u ms max over %u events\n",
+		       latency_mean(&st.input), (unsigned) st.input.max, st.input.events);
+	}
+
 	destroy_state(&st);
 	SDL_Quit();
 
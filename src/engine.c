@@ -1,49 +1,18 @@
-#include "engine.h"
-
-SDL_bool pt_on_line(SDL_Point const *p, line const *l);
-static enum hit intersects_x(line const *l, SDL_Rect const *r);
-static enum hit intersects_y(line const *l, SDL_Rect const *r);
-
-static int entity_jump(entity_state *e, level const *terrain, SDL_bool walk, SDL_bool jump);
-
-/* loading */
-void load_anim(json_t *src, char const *name, char const *key, animation_rule *a)
-{
-	json_t *o, *frames, *dur, *box;
-	o = json_object_get(src, key);
-	if (!o) {
-		#ifdef VERBOSE
-		fprintf(stderr, "Warning: No %s animation for %s\n", key, name);
-		#endif
-		return;
-	}
+#define _XOPEN_SOURCE 700
 
-	frames = json_object_get(o, "frames");
-	dur = json_object_get(o, "duration");
+#include <sys/stat.h>
 
-	int k, l;
-	l = json_array_size(frames);
-	k = json_array_size(dur);
-	if (k != l) {
-		fprintf(stderr, "error: have %d frames but %d durations\n", l, k);
-		return;
-	}
-	a->len = l;
-	a->frames   = malloc(sizeof(unsigned) * l);
-	a->duration = malloc(sizeof(unsigned) * l);
-	int i;
-	for (i = 0; i < l; i++) {
-		a->frames[i] = json_integer_value(json_array_get(frames, i));
-		a->duration[i] = json_integer_value(json_array_get(dur, i));
-	}
+#include "engine.h"
 
-	box = json_object_get(o, "box");
-	a->box.x = json_integer_value(json_array_get(box, 0));
-	a->box.y = json_integer_value(json_array_get(box, 1));
-	a->box.w = json_integer_value(json_array_get(box, 2));
-	a->box.h = json_integer_value(json_array_get(box, 3));
-}
+static int decode_worker(void *data);
+static resource *find_resource(resource_cache *c, char const *path, uint32_t hash, int size);
+static resource *add_resource(resource_cache *c, char *path, uint32_t hash, int size);
+static void *read_file(char const *path, size_t *len);
+static char *canonical_path(char const *p);
+static long long file_time(struct stat const *st);
+static uint32_t fnv1a(void const *data, size_t n);
 
+/* loading */
 SDL_Texture *load_asset_tex(json_t *a, char const *root, SDL_Renderer *r, char const *k)
 {
 	char const *f, *p;
@@ -56,532 +25,779 @@ SDL_Texture *load_asset_tex(json_t *a, char const *root, SDL_Renderer *r, char c
 	return load_texture(r, p);
 }
 
-void load_entity_rule(json_t *src, entity_rule *er, char const *n)
-{
-	get_int_field(src, n, "walk-dist", &er->walk_dist);
-	get_int_field(src, n, "jump-dist-y", &er->jump_dist_y);
-	get_int_field(src, n, "jump-dist-x", &er->jump_dist_x);
-	get_int_field(src, n, "jump-time", &er->jump_time);
-	get_int_field(src, n, "fall-dist", &er->fall_dist);
-	get_float_field(src, n, "wide-jump-factor", &er->a_wide);
-	get_float_field(src, n, "high-jump-factor", &er->a_high);
-	json_t *o = json_object_get(src, "has-gravity");
-        if (o || !streq(n, "custom-rule")) {
-                er->has_gravity = o ? streq(json_string_value(json_object_get(src, "has-gravity")), "yes") : SDL_TRUE;
-        }
-}
-
-
-json_t *load_entities(char const *root, char const *file, SDL_Renderer *r, SDL_Texture ***textures, entity_rule **rules)
+json_t *load_entities(char const *root, char const *file, SDL_Renderer *r, arena *mem, entity_rule **rules, sprite_atlas *atlas)
 {
 	json_t *ent;
-	json_error_t e;
-	ent = json_load_file(file, 0, &e);
-	if (*e.text != 0) {
-		fprintf(stderr, "Error at %s:%d: %s\n", file, e.line, e.text);
-		return 0;
-	}
+	ent = load_entity_rules(root, file, mem, rules);
+	if (!ent) { return 0; }
 
-	int k;
-	k = json_object_size(ent);
-	*textures = malloc(sizeof(SDL_Texture *) * k);
-	*rules = malloc(sizeof(entity_rule) * k);
+	int n = json_object_size(ent);
+	int *slot = malloc(sizeof(int) * (n ? n : 1));
+	resource_cache cache = { 0 };
+	image_batch batch = { cache: &cache };
 
 	json_t *o;
-	int i = 0;
-	SDL_bool ok;
 	char const *name;
-	entity_rule *rule = *rules;
-	SDL_Texture **tex = *textures;
+	int i = 0;
 	json_object_foreach(ent, name, o) {
-
-		ok = load_entity_resource(o, name, tex, r, rule, root);
-		if (!ok) {
-			return 0;
+		slot[i] = queue_image(&batch, root, get_asset(o, "asset"));
+		if (slot[i] < 0) {
+			fprintf(stderr, "Warning: No texture for `%s'\n", name);
 		}
-
-		/* save the index in the buffer, so the items in groups can
-		 * link directly to their rules and textures later: */
-		json_object_set_new(o, "index", json_integer(i));
 		i += 1;
-		rule += 1;
-		tex += 1;
+	}
+	decode_images(&batch);
+
+	SDL_Surface **img = calloc(n ? n : 1, sizeof(SDL_Surface *));
+	for (i = 0; i < n; i++) {
+		img[i] = batch_image(&batch, slot[i]);
+	}
+
+	bool ok = load_sprites(atlas, r, img, *rules, n);
+	free(img);
+	free(slot);
+	free_images(&batch);
+	destroy_cache(&cache);
+	if (!ok) {
+		json_decref(ent);
+		return 0;
 	}
 
 	return ent;
 }
 
-SDL_bool load_entity_resource(json_t *src, char const *n, SDL_Texture **t, SDL_Renderer *r, entity_rule *er, char const *root)
+/* Converts the decoded image img and cuts it into chunks.  Nothing is
+ * uploaded until it is first drawn. */
+bool load_background(chunked_bg *bg, SDL_Surface *img)
 {
-	json_t *o;
-	char const *ps;
-	o = json_object_get(src, "resource");
-	ps = json_string_value(o);
-	char const *path;
-	path = set_path("%s/%s/%s", root, CONF_DIR, ps);
-
-        load_entity_rule(src, er, n);
+	if (!img) { return false; }
 
-	json_error_t e;
-	o = json_load_file(path, 0, &e);
-	if (*e.text != 0) {
-		fprintf(stderr, "Error at %s:%d: %s\n", path, e.line, e.text);
-		return SDL_FALSE;
+	/* one pixel format so chunks can be copied straight out of it */
+	bg->blend = img->format->Amask ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE;
+	bg->img = SDL_ConvertSurfaceFormat(img, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (!bg->img) {
+		fprintf(stderr, "Could not convert the background: %s\n", SDL_GetError());
+		return false;
 	}
 
-        if (t) {
-                *t = load_asset_tex(o, root, r, "asset");
-                if (!t) { return SDL_FALSE; }
-        }
+	bg->nx = (bg->img->w + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	bg->ny = (bg->img->h + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	bg->tex = calloc(bg->nx * bg->ny, sizeof(SDL_Texture *));
+	bg->kept = (SDL_Rect) { 0, 0, 0, 0 };
+	bg->resident = 0;
 
-	json_t *siz;
-	siz = json_object_get(o, "frame_size");
-	er->start_dim.w = json_integer_value(json_array_get(siz, 0));
-	er->start_dim.h = json_integer_value(json_array_get(siz, 1));
+	return true;
+}
 
+void destroy_background(chunked_bg *bg)
+{
 	int i;
-	for (i = 0; i < NSTATES; i++) {
-		er->anim[i].frames = 0;
-		load_anim(o, n, st_names[i], &er->anim[i]);
-		if (!er->anim[i].frames) {
-			er->anim[i] = er->anim[ST_IDLE];
+	if (bg->tex) {
+		for (i = 0; i < bg->nx * bg->ny; i++) {
+			if (bg->tex[i]) { SDL_DestroyTexture(bg->tex[i]); }
 		}
 	}
+	free(bg->tex);
+	if (bg->img) { SDL_FreeSurface(bg->img); }
+	*bg = (chunked_bg) { 0 };
+}
 
-	json_decref(o);
+/* sprites */
+#define ATLAS_PAGE 2048
+#define ATLAS_PAD 1
 
-	return SDL_TRUE;
-}
+typedef struct {
+	int i;
+	int h;
+	uintptr_t img;
+} by_height;
 
-void load_state(entity_state *es)
+static int cmp_height(void const *a, void const *b)
 {
-	animation_rule ar = es->rule->anim[es->st];
-	es->anim.pos = 0;
-	es->anim.frame = ar.frames[0];
-	es->anim.remaining = ar.duration[0];
-	es->hitbox.x = ar.box.x;
-	es->hitbox.y = ar.box.y;
-	es->hitbox.w = ar.box.w;
-	es->hitbox.h = ar.box.h;
+	by_height const *x = a;
+	by_height const *y = b;
+	if (x->h != y->h) { return y->h - x->h; }
+	if (x->img != y->img) { return x->img < y->img ? -1 : 1; }
+	return x->i - y->i;
 }
 
-void init_entity_state(entity_state *es, entity_rule const *er, SDL_Texture *t, enum state st)
+/* Packs the sprite strips img[0..n) onto as few textures as possible, in
+ * shelves of falling height, and points every rule at its page and place
+ * on it.  A strip wider than a page gets a page of its own, and rules
+ * that share a strip share its place. */
+bool load_sprites(sprite_atlas *a, SDL_Renderer *r, SDL_Surface **img, entity_rule *rules, int n)
 {
-	if (!er) {
-		er = es->rule;
-	} else {
-		es->rule = er;
-		es->tex = t;
+	int i, k;
+	by_height *order = malloc(sizeof(by_height) * n);
+	int *page = malloc(sizeof(int) * n);
+	point *at = malloc(sizeof(point) * n);
+
+	for (i = 0; i < n; i++) {
+		order[i] = (by_height) { i: i, h: img[i] ? img[i]->h : 0, img: (uintptr_t) img[i] };
 	}
+	qsort(order, n, sizeof(by_height), cmp_height);
+
+	/* place the strips first, to know how big each page has to be */
+	SDL_Point *size = malloc(sizeof(SDL_Point) * (n + 1));
+	int npages = 0;
+	int open = -1;
+	int x = 0, y = 0, shelf = 0;
+	for (k = 0; k < n; k++) {
+		i = order[k].i;
+		page[i] = -1;
+		if (!img[i]) { continue; }
+
+		/* the same strip sorts next to itself */
+		if (k > 0 && img[order[k - 1].i] == img[i]) {
+			page[i] = page[order[k - 1].i];
+			at[i] = at[order[k - 1].i];
+			continue;
+		}
 
-	es->active = SDL_TRUE;
-	es->dir = DIR_LEFT;
-	es->st = st;
-	load_state(es);
-	es->pos.x = es->spawn.x;
-	es->pos.y = es->spawn.y;
-	es->spawn.w = er->start_dim.w;
-	es->spawn.h = er->start_dim.h;
-	es->jump_timeout = 0;
-	es->fall_time = 0;
-}
+		int w = img[i]->w + ATLAS_PAD;
+		int h = img[i]->h + ATLAS_PAD;
+		if (w > ATLAS_PAGE || h > ATLAS_PAGE) {
+			page[i] = npages;
+			at[i] = (point) { 0, 0 };
+			size[npages++] = (SDL_Point) { w, h };
+			continue;
+		}
 
-void clear_debug(debug_state *d)
-{
-	d->active = SDL_FALSE;
-	d->pause = SDL_FALSE;
-	d->frames = SDL_TRUE;
-	d->hitboxes = SDL_TRUE;
-	d->show_terrain_collision = SDL_FALSE;
-	d->message_positions = SDL_TRUE;
-}
+		if (open >= 0 && x + w > ATLAS_PAGE) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if (open < 0 || y + h > ATLAS_PAGE) {
+			x = y = shelf = 0;
+			open = npages;
+			size[npages++] = (SDL_Point) { 0, 0 };
+		}
 
-/* teardown */
-void destroy_level(level *l)
-{
-	free(l->vertical);
-	free(l->horizontal);
+		page[i] = open;
+		at[i] = (point) { x, y };
+		x += w;
+		if (h > shelf) { shelf = h; }
+		if (x > size[open].x) { size[open].x = x; }
+		if (y + h > size[open].y) { size[open].y = y + h; }
+	}
+	free(order);
+
+	a->npages = npages;
+	a->pages = calloc(npages + 1, sizeof(sprite_page));
+
+	bool ok = true;
+	SDL_Surface **srf = calloc(npages + 1, sizeof(SDL_Surface *));
+	for (k = 0; k < npages; k++) {
+		srf[k] = SDL_CreateRGBSurfaceWithFormat(0, size[k].x, size[k].y, 32, SDL_PIXELFORMAT_ARGB8888);
+		if (!srf[k]) { ok = false; }
+	}
+
+	for (i = 0; ok && i < n; i++) {
+		rules[i].tex = 0;
+		if (page[i] < 0) { continue; }
+
+		SDL_Rect dst = { x: at[i].x, y: at[i].y, w: img[i]->w, h: img[i]->h };
+		SDL_SetSurfaceBlendMode(img[i], SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(img[i], 0, srf[page[i]], &dst);
+		rules[i].tex = &a->pages[page[i]];
+		rules[i].sheet = at[i];
+	}
+
+	for (k = 0; k < npages; k++) {
+		if (!srf[k]) { continue; }
+		if (ok) {
+			a->pages[k].tex = SDL_CreateTextureFromSurface(r, srf[k]);
+			a->pages[k].w = size[k].x;
+			a->pages[k].h = size[k].y;
+			if (!a->pages[k].tex) { ok = false; }
+			SDL_SetTextureBlendMode(a->pages[k].tex, SDL_BLENDMODE_BLEND);
+		}
+		SDL_FreeSurface(srf[k]);
+	}
+	free(srf);
+	free(size);
+	free(page);
+	free(at);
+
+	if (!ok) {
+		fprintf(stderr, "Could not create the sprite atlas: %s\n", SDL_GetError());
+		destroy_sprites(a);
+	}
+
+	return ok;
 }
 
-/* state updates */
-void clear_order(entity_event *o)
+void destroy_sprites(sprite_atlas *a)
 {
-	o->move_left = SDL_FALSE;
-	o->move_right = SDL_FALSE;
-	o->move_jump = SDL_FALSE;
-	o->walk = SDL_FALSE;
+	int i;
+	for (i = 0; i < a->npages; i++) {
+		if (a->pages[i].tex) { SDL_DestroyTexture(a->pages[i].tex); }
+		free(a->pages[i].v);
+		free(a->pages[i].idx);
+	}
+	free(a->pages);
+	*a = (sprite_atlas) { 0 };
 }
 
-void tick_animation(entity_state *es)
+/* resources */
+
+/* The font at path in the given size, opened again only when the file
+ * changed since. */
+resource *cache_font(resource_cache *c, char const *path, int size)
 {
-	animation_state *as = &es->anim;
-	animation_rule ar = es->rule->anim[es->st];
-	as->remaining -= 1;
-	int i;
-	if (as->remaining < 0) {
-		i = (as->pos + 1) % ar.len;
-		as->pos = i;
-		as->frame = ar.frames[i];
-		as->remaining = ar.duration[i];
+	size_t len;
+	void *data = read_file(path, &len);
+	if (!data) { return 0; }
+	uint32_t hash = fnv1a(data, len);
+	free(data);
+
+	char *cp = canonical_path(path);
+	resource *r = find_resource(c, cp, hash, size);
+	if (r) {
+		free(cp);
+		r->refs += 1;
+		return r;
 	}
+
+	TTF_Font *font = TTF_OpenFont(path, size);
+	if (!font) {
+		fprintf(stderr, "error: could not load font %s: %s\n", path, TTF_GetError());
+		free(cp);
+		return 0;
+	}
+	r = add_resource(c, cp, hash, size);
+	r->font = font;
+
+	return r;
 }
 
-int kick_entity(entity_state *e, enum hit h, SDL_Point const *v)
+/* drops one reference to r, freeing it with the last */
+void release_resource(resource_cache *c, resource *r)
 {
-	if (h == HIT_NONE || h & HIT_TOP) { return 0; }
-	if ((h & HIT_RIGHT && h & HIT_LEFT)) { return 0; }
+	if (!r || --r->refs > 0) { return; }
 
-	e->pos.x += v->x * (h & HIT_RIGHT ? -1 : 1);
-	e->pos.y += v->y;
+	int i;
+	for (i = 0; i < c->n && c->r[i] != r; i++) {}
+	if (i < c->n) {
+		c->r[i] = c->r[--c->n];
+	}
 
-	return 0;
+	if (r->img) { SDL_FreeSurface(r->img); }
+	if (r->font) { TTF_CloseFont(r->font); }
+	free(r->path);
+	free(r);
 }
 
-/* movement */
-static SDL_Point entity_vector_move(entity_state *e, SDL_Point const *v, level const *terrain, SDL_bool grav)
+void destroy_cache(resource_cache *c)
 {
-	SDL_Rect r, n;
-	entity_hitbox(e, &r);
-	entity_hitbox(e, &n);
+	while (c->n > 0) {
+		resource *r = c->r[c->n - 1];
+		r->refs = 1;
+		release_resource(c, r);
+	}
+	free(c->r);
+	*c = (resource_cache) { 0 };
+}
 
-	int dirx = v->x < 0 ? -1 : 1;
-	int diry = v->y < 0 ? -1 : 1;
+/* Adds the image f under root's assets to the batch and returns its slot,
+ * or -1 if it cannot be read.  An image already in the batch keeps its
+ * slot, one the cache holds with the same contents is not decoded again.
+ * A file with the time and size the cache saw last is not even read. */
+int queue_image(image_batch *b, char const *root, char const *f)
+{
+	if (!f) { return -1; }
 
-	int vx = v->x < 0 ? -v->x : v->x;
-	int vy = v->y < 0 ? -v->y : v->y;
+	char const *p = set_path("%s/%s/%s", root, ASSET_DIR, f);
+	struct stat st;
+	if (stat(p, &st) != 0) {
+		fprintf(stderr, "Could not load image `%s'\n", p);
+		return -1;
+	}
+	char *cp = canonical_path(p);
 
-	int v_max = vx > vy ? vx : vy;
 	int i;
-	SDL_Point out = { x: 0, y: 0 };
-	enum hit h;
-
-	for (i = 1; i < v_max + 1; i++) {
-		int dx = dirx * (i * vx) / v_max;
-		int dy = diry * (i * vy) / v_max;
-		r.x = n.x + dx;
-		r.y = n.y + dy;
-		h = collides_with_terrain(&r, terrain);
-		if (h != HIT_NONE) { break; }
-		if (grav && !stands_on_terrain(&r, terrain)) {
-			break; // or kick
-			r.y += 1;
-			h = collides_with_terrain(&r, terrain);
-			SDL_Point v = { .x = e->hitbox.w / 2, .y = e->hitbox.h / 5 };
-			kick_entity(e, h, &v);
+	resource *r = 0;
+	for (i = 0; i < b->cache->n && !r; i++) {
+		resource *c = b->cache->r[i];
+		if (c->size == 0 && c->mtime == file_time(&st) && c->bytes == st.st_size && streq(c->path, cp)) {
+			r = c;
 		}
-		out.x = dx;
-		out.y = dy;
 	}
 
-	e->pos.x += out.x;
-	e->pos.y += out.y;
+	size_t len = 0;
+	void *data = 0;
+	uint32_t hash = 0;
+	if (!r) {
+		data = read_file(p, &len);
+		if (!data) {
+			fprintf(stderr, "Could not load image `%s'\n", p);
+			free(cp);
+			return -1;
+		}
+		hash = fnv1a(data, len);
+		r = find_resource(b->cache, cp, hash, 0);
+	}
+
+	for (i = 0; i < b->n && r; i++) {
+		if (b->jobs[i].res == r) {
+			free(cp);
+			free(data);
+			return i;
+		}
+	}
+
+	if (b->n == b->cap) {
+		b->cap = b->cap ? b->cap * 2 : 8;
+		b->jobs = realloc(b->jobs, sizeof(image_job) * b->cap);
+	}
+	image_job *j = &b->jobs[b->n];
+	*j = (image_job) { res: r };
+
+	if (r) {
+		r->refs += 1;
+		r->mtime = file_time(&st);
+		r->bytes = st.st_size;
+		free(cp);
+		free(data);
+	} else {
+		/* SDL_image tells TGA files by their extension only */
+		char const *ext = strrchr(f, '.');
+		j->res = add_resource(b->cache, cp, hash, 0);
+		j->res->mtime = file_time(&st);
+		j->res->bytes = st.st_size;
+		j->data = data;
+		j->len = len;
+		j->type = ext ? ext + 1 : 0;
+	}
 
-	return out;
+	return b->n++;
 }
 
-static int entity_walk(entity_state *e, level const *terrain)
+/* Decodes every queued image the cache did not have, the calling thread
+ * taking its share.  Only the decoders run on the other threads; nothing
+ * touches the renderer or the cache. */
+void decode_images(image_batch *b)
 {
-	SDL_Point v = { x: e->dir * e->rule->walk_dist, y: 0 };
-	SDL_Point r = entity_vector_move(e, &v, terrain, e->rule->has_gravity);
-	return r.x < 0 ? -r.x : r.x;
+	int i, n = SDL_GetCPUCount() - 1;
+	if (n > b->n - 1) { n = b->n - 1; }
+	if (n < 0) { n = 0; }
+
+	/* the decoder libraries are loaded once, before any thread needs them */
+	IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+
+	SDL_AtomicSet(&b->next, 0);
+	SDL_Thread **t = malloc(sizeof(SDL_Thread *) * (n ? n : 1));
+	for (i = 0; i < n; i++) {
+		t[i] = SDL_CreateThread(decode_worker, "decode", b);
+	}
+	decode_worker(b);
+	for (i = 0; i < n; i++) {
+		/* a thread that failed to start leaves its share to the others */
+		if (t[i]) { SDL_WaitThread(t[i], 0); }
+	}
+	free(t);
 }
 
-static int entity_start_jump(entity_state *e, level const *terrain, enum jump_type t)
+/* the decoded image in slot i, 0 if there is none; the batch keeps it */
+SDL_Surface *batch_image(image_batch const *b, int i)
 {
-	e->jump_timeout = e->rule->jump_time;
-	e->jump_type = t;
-
-	return entity_jump(e, terrain, t == JUMP_WIDE, SDL_TRUE);
+	return i >= 0 && i < b->n ? b->jobs[i].res->img : 0;
 }
 
-static int entity_jump(entity_state *e, level const *terrain, SDL_bool walk, SDL_bool jump)
+void free_images(image_batch *b)
 {
-	entity_rule const *r = e->rule;
-	if (e->jump_timeout == 0) {
-		return r->has_gravity ? 0 : jump ? entity_start_jump(e, terrain, JUMP_HIGH) : 0;
+	int i;
+	for (i = 0; i < b->n; i++) {
+		free(b->jobs[i].data);
+		release_resource(b->cache, b->jobs[i].res);
 	}
+	free(b->jobs);
+	*b = (image_batch) { cache: b->cache };
+}
 
-	SDL_Point v = { x: e->jump_type == JUMP_WIDE ? e->dir * r->jump_dist_x : r->has_gravity ? 0 : walk ? e->dir * r->walk_dist : 0,
-	                y: r->jump_dist_y };
-	if (r->has_gravity) { v.y += e->jump_timeout; }
-	v.y *= -1;
-	SDL_Point w = entity_vector_move(e, &v, terrain, SDL_FALSE);
-	if (w.y != v.y) {
-		e->jump_timeout = 0;
-	} else {
-		e->jump_timeout -= 1;
+static int decode_worker(void *data)
+{
+	image_batch *b = data;
+	int i;
+	while ((i = SDL_AtomicAdd(&b->next, 1)) < b->n) {
+		image_job *j = &b->jobs[i];
+		if (!j->data) { continue; }
+
+		SDL_RWops *rw = SDL_RWFromConstMem(j->data, j->len);
+		j->res->img = IMG_LoadTyped_RW(rw, 1, j->type);
+		if (!j->res->img) {
+			fprintf(stderr, "Could not load image `%s': %s\n", j->res->path, IMG_GetError());
+		}
+		free(j->data);
+		j->data = 0;
 	}
-	return -w.y;
+
+	return 0;
 }
 
-static int entity_fall(entity_state *e, level const *terrain, SDL_bool walk)
+static resource *find_resource(resource_cache *c, char const *path, uint32_t hash, int size)
 {
-	e->fall_time += 1;
-	SDL_Point v, w;
-	if (e->rule->has_gravity) {
-		v = (SDL_Point) { x: 0, y: 1 };
-		w = entity_vector_move(e, &v, terrain, SDL_FALSE);
-		if (v.y != w.y) { e->fall_time = 0; return 0; }
+	int i;
+	for (i = 0; i < c->n; i++) {
+		resource *r = c->r[i];
+		if (r->hash == hash && r->size == size && streq(r->path, path)) {
+			return r;
+		}
 	}
 
-	entity_rule const *r = e->rule;
-	v = (SDL_Point) { x: walk ? e->dir * r->walk_dist : 0,
-	                  y: r->fall_dist };
-	if (r->has_gravity) { v.y += e->fall_time; }
-	w = entity_vector_move(e, &v, terrain, SDL_FALSE);
-	if (v.y != w.y) { e->fall_time = 0; }
-	return w.y;
+	return 0;
 }
 
-void keystate_to_movement(unsigned char const *ks, entity_event *e)
+/* a new resource holding one reference, taking over path */
+static resource *add_resource(resource_cache *c, char *path, uint32_t hash, int size)
 {
-	if (ks[SDL_SCANCODE_LEFT ]) { e->move_left  = SDL_TRUE; e->walk = SDL_TRUE; }
-	if (ks[SDL_SCANCODE_RIGHT]) { e->move_right = SDL_TRUE; e->walk = SDL_TRUE; }
-	if (ks[SDL_SCANCODE_SPACE]) { e->move_jump = SDL_TRUE; }
+	if (c->n == c->cap) {
+		c->cap = c->cap ? c->cap * 2 : 16;
+		c->r = realloc(c->r, sizeof(resource *) * c->cap);
+	}
+
+	resource *r = malloc(sizeof(resource));
+	*r = (resource) { path: path, hash: hash, size: size, refs: 1 };
+	c->r[c->n++] = r;
+
+	return r;
 }
 
-void move_entity(entity_state *e, entity_event const *ev, level const *lvl, move_log *mlog)
+static void *read_file(char const *path, size_t *len)
 {
-	enum state st_begin = e->st;
-	*mlog = (move_log) { walked: 0, jumped: 0, fallen: 0, turned: SDL_FALSE, hang: SDL_FALSE };
+	FILE *fd = fopen(path, "rb");
+	if (!fd) { return 0; }
 
-	switch (st_begin) {
-	case ST_IDLE:
-	case ST_WALK:
-		e->dir = ev->move_left ? DIR_LEFT : ev->move_right ? DIR_RIGHT : e->dir;
-		if (ev->move_jump) {
-			mlog->jumped = entity_start_jump(e, lvl, ev->walk ? e->rule->has_gravity ? JUMP_WIDE : JUMP_HIGH : JUMP_HIGH);
-		} else if (ev->walk) {
-			mlog->walked = entity_walk(e, lvl);
+	void *data = 0;
+	long n = fseek(fd, 0, SEEK_END) == 0 ? ftell(fd) : -1;
+	if (n >= 0) {
+		rewind(fd);
+		data = malloc(n ? n : 1);
+		if (fread(data, 1, n, fd) != (size_t) n) {
+			free(data);
+			data = 0;
 		}
-		break;
-	case ST_HANG:
-		break;
-	case ST_JUMP:
-		e->dir = ev->move_left ? DIR_LEFT : ev->move_right ? DIR_RIGHT : e->dir;
-		mlog->jumped = entity_jump(e, lvl, ev->walk, ev->move_jump);
-		break;
-	case ST_FALL:
-		e->dir = ev->move_left ? DIR_LEFT : ev->move_right ? DIR_RIGHT : e->dir;
-		if (!e->rule->has_gravity) {
-			if (ev->move_jump) {
-				mlog->jumped = entity_start_jump(e, lvl, JUMP_HIGH);
-			} else if (ev->walk) {
-				mlog->walked = entity_walk(e, lvl);
-				mlog->fallen = entity_fall(e, lvl, SDL_FALSE);
-			} else {
-				mlog->fallen = entity_fall(e, lvl, SDL_FALSE);
-			}
-		} else {
-			mlog->fallen = entity_fall(e, lvl, ev->walk);
-			SDL_Rect h;
-			entity_hitbox(e, &h);
-			if (mlog->fallen == 0 && !stands_on_terrain(&h, lvl)) {
-				h.y += 1;
-				enum hit where = collides_with_terrain(&h, lvl);
-				SDL_Point v = { .x = -1, .y = 0 };
-				kick_entity(e, where, &v);
-			}
-		}
-		break;
-	case NSTATES:
-		break;
+		*len = n;
 	}
+	fclose(fd);
 
-	SDL_Rect h;
-	entity_hitbox(e, &h);
-	e->st = mlog->jumped > 0 ? ST_JUMP : stands_on_terrain(&h, lvl) ? mlog->walked > 0 ? ST_WALK : ST_IDLE : ST_FALL;
+	return data;
 }
 
-/* collision */
-static int first_idx(line const *a, int n, int x)
+/* the path with links and dots resolved, so one file has one name */
+static char *canonical_path(char const *p)
 {
-	int r, l, i;
-	l = 0;
-	r = n;
-	while (l + 1 < r) {
-		i = l + (r - l) / 2;
-		if (x < a[i].p) {
-			r = i - 1;
-		} else if (x > a[i].p) {
-			l = i + 1;
-		} else {
-			r = i;
-		}
+#ifndef _WIN32
+	char *c = realpath(p, 0);
+#else
+	char *c = _fullpath(0, p, 0);
+#endif
+	if (!c) {
+		c = malloc(strlen(p) + 1);
+		strcpy(c, p);
 	}
 
-	return l;
+	return c;
 }
 
-enum hit collides_with_terrain(SDL_Rect const *r, level const *lev)
+/* the mtime in nanoseconds, so an edit within the second of the last
+ * load still reads the file again */
+static long long file_time(struct stat const *st)
 {
-	enum hit a = HIT_NONE;
+	long long t = (long long) st->st_mtime * 1000000000;
+#ifndef _WIN32
+	t += st->st_mtim.tv_nsec;
+#endif
 
-	SDL_Rect hb = *r;
-	hb.h -= 1;
+	return t;
+}
 
-	int i;
-	for (i = first_idx(lev->horizontal, lev->nhorizontal, r->y); i < lev->nhorizontal && lev->horizontal[i].p <= r->y + r->h; i++) {
-		a = intersects_x(&lev->horizontal[i], &hb);
-		if (a != HIT_NONE) { return a; }
-	}
-	for (i = first_idx(lev->vertical, lev->nvertical, r->x); i < lev->nvertical && lev->vertical[i].p <= r->x + r->w; i++) {
-		a = intersects_y(&lev->vertical[i], &hb);
-		if (a != HIT_NONE) { return a; }
+static uint32_t fnv1a(void const *data, size_t n)
+{
+	unsigned char const *p = data;
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		h = (h ^ p[i]) * 16777619u;
 	}
 
-	return a;
+	return h;
 }
 
-SDL_bool stands_on_terrain(SDL_Rect const *r, level const *t)
+/* input */
+void keystate_to_movement(unsigned char const *ks, entity_event *e)
 {
-	SDL_Point mid = entity_feet(r);
+	if (ks[SDL_SCANCODE_LEFT ]) { e->move_left  = true; e->walk = true; }
+	if (ks[SDL_SCANCODE_RIGHT]) { e->move_right = true; e->walk = true; }
+	if (ks[SDL_SCANCODE_SPACE]) { e->move_jump = true; }
+}
 
-	int i;
-	for (i = first_idx(t->horizontal, t->nhorizontal, mid.y); i < t->nhorizontal && t->horizontal[i].p <= mid.y; i++) {
-		if (pt_on_line(&mid, &t->horizontal[i])) { return SDL_TRUE; }
+/* Notes an event that has been read but not acted upon yet. */
+void latency_event(input_latency *l, SDL_Event const *ev)
+{
+	switch (ev->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+	case SDL_MOUSEMOTION:
+		break;
+	default:
+		return;
 	}
 
-	return SDL_FALSE;
+	if (l->pending == 0) {
+		l->oldest = ev->common.timestamp;
+	}
+	l->pending++;
+	l->stamps += ev->common.timestamp;
 }
 
-void entity_hitbox(entity_state const *s, SDL_Rect *box)
+/* Charges every pending event with the time until now, when a tick used
+ * them. */
+void latency_consume(input_latency *l, Uint32 now)
 {
-	*box = (SDL_Rect) { x: s->pos.x,
-			    y: s->pos.y + s->hitbox.y,
-			    w: s->hitbox.w,
-			    h: s->hitbox.h };
-	switch (s->dir) {
-	case DIR_LEFT:
-		box->x += s->hitbox.x;
-		break;
-	case DIR_RIGHT:
-		box->x += s->spawn.w - s->hitbox.x - s->hitbox.w;
-		break;
+	if (l->pending == 0) { return; }
+
+	l->total += (Uint64) l->pending * now - l->stamps;
+	if (now - l->oldest > l->max) {
+		l->max = now - l->oldest;
 	}
+	l->events += l->pending;
+	l->pending = 0;
+	l->stamps = 0;
 }
 
-int cmp_lines(void const *x, void const *y)
+unsigned latency_mean(input_latency const *l)
 {
-	line const *a = (line const *) x;
-	line const *b = (line const *) y;
-	if (a->p < b->p) { return -1; }
-	return a->p > b->p;
+	return l->events ? l->total / l->events : 0;
 }
 
-SDL_Point entity_feet(SDL_Rect const *r)
+/* rendering */
+
+/* the chunks that overlap rect a grown by margin on every side, as a
+ * range of columns and rows */
+static SDL_Rect chunk_range(chunked_bg const *bg, SDL_Rect const *a, int margin)
 {
-	return (SDL_Point) { x: r->x + r->w / 2, y: r->y + r->h };
+	int x0 = (a->x - margin) / CHUNK_SIZE;
+	int y0 = (a->y - margin) / CHUNK_SIZE;
+	int x1 = (a->x + a->w + margin - 1) / CHUNK_SIZE;
+	int y1 = (a->y + a->h + margin - 1) / CHUNK_SIZE;
+
+	if (x0 < 0) { x0 = 0; }
+	if (y0 < 0) { y0 = 0; }
+	if (x1 >= bg->nx) { x1 = bg->nx - 1; }
+	if (y1 >= bg->ny) { y1 = bg->ny - 1; }
+
+	return (SDL_Rect) { x: x0, y: y0, w: x1 - x0 + 1, h: y1 - y0 + 1 };
 }
 
-SDL_bool pt_on_line(SDL_Point const *p, line const *l)
+static SDL_Rect chunk_rect(chunked_bg const *bg, int cx, int cy)
 {
-	return p->y == l->p && between(p->x, l->a, l->b);
+	SDL_Rect c = { x: cx * CHUNK_SIZE, y: cy * CHUNK_SIZE, w: CHUNK_SIZE, h: CHUNK_SIZE };
+	if (c.x + c.w > bg->img->w) { c.w = bg->img->w - c.x; }
+	if (c.y + c.h > bg->img->h) { c.h = bg->img->h - c.y; }
+	return c;
 }
 
-static enum hit intersects_x(line const *l, SDL_Rect const *r)
+static SDL_Texture *upload_chunk(SDL_Renderer *r, chunked_bg *bg, int cx, int cy)
 {
-	int rx1 = r->x;
-	int rxm = r->x + r->w / 2;
-	int rx2 = r->x + r->w;
-	int ry1 = r->y;
-	int ry2 = r->y + r->h;
-
-	if (between(l->p, ry1, ry2) &&
-		(between(rx1, l->a, l->b) || (between(rxm, l->a, l->b)) ||
-		 between(l->a, rx1, rxm) || between(l->b, rx1, rxm))) {
-		return HIT_LEFT;
+	SDL_Rect c = chunk_rect(bg, cx, cy);
+	SDL_Texture *t = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, c.w, c.h);
+	if (!t) {
+		fprintf(stderr, "Could not create background chunk: %s\n", SDL_GetError());
+		return 0;
 	}
 
-	if (between(l->p, ry1, ry2) &&
-		(between(rxm, l->a, l->b) || (between(rx2, l->a, l->b)) ||
-		 between(l->a, rx1, rx2) || between(l->b, rx1, rx2))) {
-		return HIT_RIGHT;
-	}
+	Uint8 const *px = bg->img->pixels;
+	SDL_UpdateTexture(t, 0, px + c.y * bg->img->pitch + c.x * 4, bg->img->pitch);
+	SDL_SetTextureBlendMode(t, bg->blend);
+	bg->resident++;
 
-	return HIT_NONE;
+	return t;
 }
 
-static enum hit intersects_y(line const *l, SDL_Rect const *r)
+static bool in_range(SDL_Rect const *c, int cx, int cy)
 {
-	int rx1 = r->x;
-	int rxm = r->x + r->w / 2;
-	int rx2 = r->x + r->w;
-	int ry1 = r->y;
-	int ry2 = r->y + r->h;
+	return cx >= c->x && cx < c->x + c->w && cy >= c->y && cy < c->y + c->h;
+}
 
-	if (between(l->p, rx1, rxm) &&
-		(between(ry1, l->a, l->b) || (between(ry2, l->a, l->b)) ||
-		 between(l->a, ry1, ry2) || between(l->b, ry1, ry2))) {
-		return HIT_LEFT;
+/* Draws the part of the background under screen.  Chunks within one chunk
+ * of the screen are uploaded ahead of time, chunks further than two away
+ * are dropped, so the textures held follow the screen size rather than the
+ * level size. */
+void draw_background(SDL_Renderer *r, chunked_bg *bg, SDL_Rect const *screen)
+{
+	int cx, cy;
+	SDL_Rect keep = chunk_range(bg, screen, 2 * CHUNK_SIZE);
+	SDL_Rect want = chunk_range(bg, screen, CHUNK_SIZE);
+	SDL_Rect show = chunk_range(bg, screen, 0);
+
+	/* every uploaded chunk lies in the range kept last time */
+	for (cy = bg->kept.y; cy < bg->kept.y + bg->kept.h; cy++) {
+		for (cx = bg->kept.x; cx < bg->kept.x + bg->kept.w; cx++) {
+			SDL_Texture **t = &bg->tex[cy * bg->nx + cx];
+			if (*t && !in_range(&keep, cx, cy)) {
+				SDL_DestroyTexture(*t);
+				*t = 0;
+				bg->resident--;
+			}
+		}
 	}
+	bg->kept = keep;
 
-	if (between(l->p, rxm, rx2) &&
-		(between(ry1, l->a, l->b) || (between(ry2, l->a, l->b)) ||
-		 between(l->a, ry1, ry2) || between(l->b, ry1, ry2))) {
-		return HIT_RIGHT;
+	for (cy = want.y; cy < want.y + want.h; cy++) {
+		for (cx = want.x; cx < want.x + want.w; cx++) {
+			SDL_Texture **t = &bg->tex[cy * bg->nx + cx];
+			if (!*t) {
+				*t = upload_chunk(r, bg, cx, cy);
+			}
+		}
 	}
 
-	return HIT_NONE;
+	for (cy = show.y; cy < show.y + show.h; cy++) {
+		for (cx = show.x; cx < show.x + show.w; cx++) {
+			SDL_Texture *t = bg->tex[cy * bg->nx + cx];
+			if (!t) { continue; }
+
+			SDL_Rect dst = chunk_rect(bg, cx, cy);
+			dst.x -= screen->x;
+			dst.y -= screen->y;
+			SDL_RenderCopy(r, t, 0, &dst);
+		}
+	}
 }
 
-/* rendering */
-void draw_background(SDL_Renderer *r, SDL_Texture *bg, SDL_Rect const *screen)
+typedef struct {
+	SDL_Renderer *r;
+	SDL_Rect const *screen;
+} line_target;
+
+static void draw_line(line const *l, bool vertical, void *data)
 {
-	SDL_RenderCopy(r, bg, screen, 0);
+	line_target const *t = data;
+	int sx = t->screen->x;
+	int sy = t->screen->y;
+	if (vertical) {
+		SDL_RenderDrawLine(t->r, l->p - sx, l->a - sy, l->p - sx, l->b - sy);
+	} else {
+		SDL_RenderDrawLine(t->r, l->a - sx, l->p - sy, l->b - sx, l->p - sy);
+	}
 }
 
-void draw_terrain_lines(SDL_Renderer *r, level const *lev, SDL_Rect const *screen)
+/* Draws the terrain lines on screen and returns how many. */
+int draw_terrain_lines(SDL_Renderer *r, level const *lev, SDL_Rect const *screen)
 {
 	SDL_SetRenderDrawColor(r, 200, 20, 7, 255); /* red */
-	int i;
-	for (i = 0; i < lev->nhorizontal; i++) {
-		SDL_RenderDrawLine(r,
-				   lev->horizontal[i].a - screen->x,
-				   lev->horizontal[i].p - screen->y,
-				   lev->horizontal[i].b - screen->x,
-				   lev->horizontal[i].p - screen->y);
-	}
-	for (i = 0; i < lev->nvertical; i++) {
-		SDL_RenderDrawLine(r,
-				   lev->vertical[i].p - screen->x,
-				   lev->vertical[i].a - screen->y,
-				   lev->vertical[i].p - screen->x,
-				   lev->vertical[i].b - screen->y);
-	}
+	line_target t = { r: r, screen: screen };
+	rect q = { x: screen->x, y: screen->y, w: screen->w, h: screen->h };
+	return lines_in_rect(lev, &q, draw_line, &t);
 }
 
-void render_line(SDL_Renderer *r, char const *s, TTF_Font *font, int l)
+bool entity_visible(SDL_Rect const *scr, entity_state const *s)
 {
-	if (!font) { return; }
+	entity_rule const *rl = s->rule;
+	return s->pos.x < scr->x + scr->w && s->pos.x + rl->start_dim.w > scr->x &&
+	       s->pos.y < scr->y + scr->h && s->pos.y + rl->start_dim.h > scr->y;
+}
 
-	SDL_Surface *text;
-	SDL_Texture *tex;
+/* Draws s as line l from the top, glyph by glyph out of the atlas.  All
+ * copies come from the same texture, so SDL batches them together. */
+void render_line(SDL_Renderer *r, char const *s, glyph_atlas const *g, int l)
+{
+	if (!g->tex) { return; }
 
-	SDL_Color col = {200, 20, 7, 255}; /* red */
-	text = TTF_RenderText_Blended(font, s, col);
-	tex = SDL_CreateTextureFromSurface(r, text);
-	SDL_Rect dest = { x: 0, y: l * text->h, w: text->w, h: text->h };
-	SDL_FreeSurface(text);
+	SDL_Rect dest = { x: 0, y: l * g->height, w: 0, h: g->height };
+	char const *c;
+	for (c = s; *c; c++) {
+		if (between(*c, GLYPH_FIRST, GLYPH_LAST)) {
+			dest.w += g->advance[*c - GLYPH_FIRST];
+		}
+	}
 
 	SDL_SetRenderDrawColor(r, 0, 0, 0, 180);
 	SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
 	SDL_RenderFillRect(r, &dest);
-	SDL_RenderCopy(r, tex, 0, &dest);
-	SDL_DestroyTexture(tex);
+
+	SDL_SetTextureColorMod(g->tex, 200, 20, 7); /* red */
+	int x = 0;
+	for (c = s; *c; c++) {
+		if (!between(*c, GLYPH_FIRST, GLYPH_LAST)) {
+			continue;
+		}
+
+		SDL_Rect const *src = &g->src[*c - GLYPH_FIRST];
+		SDL_Rect d = { x: x, y: dest.y, w: src->w, h: src->h };
+		SDL_RenderCopy(r, g->tex, src, &d);
+		x += g->advance[*c - GLYPH_FIRST];
+	}
 }
 
-void draw_entity(SDL_Renderer *r, SDL_Rect const *scr, entity_state const *s, debug_state const *debug)
+static void queue_sprite(sprite_page *pg, SDL_Rect const *d, float u0, float v0, float u1, float v1)
+{
+	if (pg->n == pg->cap) {
+		pg->cap = pg->cap ? 2 * pg->cap : 64;
+		pg->v = realloc(pg->v, sizeof(SDL_Vertex) * 4 * pg->cap);
+		pg->idx = realloc(pg->idx, sizeof(int) * 6 * pg->cap);
+	}
+
+	SDL_Color c = { 255, 255, 255, 255 };
+	SDL_Vertex *v = &pg->v[4 * pg->n];
+	v[0] = (SDL_Vertex) { { d->x,        d->y        }, c, { u0, v0 } };
+	v[1] = (SDL_Vertex) { { d->x + d->w, d->y        }, c, { u1, v0 } };
+	v[2] = (SDL_Vertex) { { d->x + d->w, d->y + d->h }, c, { u1, v1 } };
+	v[3] = (SDL_Vertex) { { d->x,        d->y + d->h }, c, { u0, v1 } };
+
+	int *ix = &pg->idx[6 * pg->n];
+	int b = 4 * pg->n;
+	ix[0] = b; ix[1] = b + 1; ix[2] = b + 2;
+	ix[3] = b; ix[4] = b + 2; ix[5] = b + 3;
+	pg->n++;
+}
+
+static void flush_page(SDL_Renderer *r, sprite_page *pg)
+{
+	if (pg->n == 0) { return; }
+	SDL_RenderGeometry(r, pg->tex, pg->v, 4 * pg->n, pg->idx, 6 * pg->n);
+	pg->n = 0;
+}
+
+/* Draws everything queued by draw_entity, one call per atlas page. */
+void flush_sprites(SDL_Renderer *r, sprite_atlas *a)
+{
+	int i;
+	for (i = 0; i < a->npages; i++) {
+		flush_page(r, &a->pages[i]);
+	}
+}
+
+/* Queues s, as it looks at the tick now, for drawing with the rest of its
+ * atlas page.  Debug frames go on top, so in debug mode the page is drawn
+ * straight away. */
+void draw_entity(SDL_Renderer *r, SDL_Rect const *scr, entity_state const *s, unsigned now, debug_state const *debug)
 {
 	entity_rule const *rl = s->rule;
 	int w = rl->start_dim.w;
 	int h = rl->start_dim.h;
-	SDL_Rect src = { x: s->anim.frame * s->spawn.w, y: 0, w: w, h: h };
 	SDL_Rect dst = { x: s->pos.x - scr->x, y: s->pos.y - scr->y, w: w, h: h };
 
-	SDL_bool flip = s->dir == DIR_RIGHT;
-	SDL_RenderCopyEx(r, s->tex, &src, &dst, 0, 0, flip ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+	sprite_page *pg = rl->tex;
+	if (pg) {
+		float u0 = (float) (rl->sheet.x + anim_frame(s, now) * s->spawn.w) / pg->w;
+		float u1 = u0 + (float) w / pg->w;
+		float v0 = (float) rl->sheet.y / pg->h;
+		float v1 = v0 + (float) h / pg->h;
+		if (s->dir == DIR_RIGHT) {
+			float t = u0;
+			u0 = u1;
+			u1 = t;
+		}
+		queue_sprite(pg, &dst, u0, v0, u1, v1);
+	}
+
 	if (debug && debug->active) {
+		if (pg) { flush_page(r, pg); }
 
 		if (debug->frames) {
 			SDL_SetRenderDrawColor(r, 255, 105, 180, 255); /* pink */
@@ -589,8 +805,9 @@ void draw_entity(SDL_Renderer *r, SDL_Rect const *scr, entity_state const *s, de
 		}
 
 		if (debug->hitboxes) {
-			SDL_Rect box;
-			entity_hitbox(s, &box);
+			rect hb;
+			entity_hitbox(s, &hb);
+			SDL_Rect box = sdl_rect(&hb);
 			box.x -= scr->x;
 			box.y -= scr->y;
 			SDL_SetRenderDrawColor(r, 23, 225, 38, 255); /* lime */
@@ -599,58 +816,68 @@ void draw_entity(SDL_Renderer *r, SDL_Rect const *scr, entity_state const *s, de
 	}
 }
 
-/* low level json */
-char const *get_asset(json_t *a, char const *k)
-{
-	json_t *v;
+/* text */
+#define ATLAS_WIDTH 512
 
-	v = json_object_get(a, k);
-	if (!v) {
-		fprintf(stderr, "no %s in %p\n", k, a);
-		json_dumpf(a, stderr, 0);
-		fprintf(stderr, "no %s\n", k);
-		return 0;
-	}
+/* Renders every glyph of font in white, packed in rows, into g->tex, to
+ * be tinted when drawn.  Without a font g stays empty and draws nothing. */
+bool load_glyphs(glyph_atlas *g, SDL_Renderer *r, TTF_Font *font)
+{
+	*g = (glyph_atlas) { tex: 0 };
+	if (!font) { return false; }
 
-	char const *r = json_string_value(v);
+	SDL_Color white = { 255, 255, 255, 255 };
+	SDL_Surface *glyphs[NGLYPHS];
+	int i, x = 0, y = 0;
+	g->height = TTF_FontHeight(font);
+	for (i = 0; i < NGLYPHS; i++) {
+		int minx, maxx, miny, maxy;
+		glyphs[i] = TTF_RenderGlyph_Blended(font, GLYPH_FIRST + i, white);
+		if (!glyphs[i] || TTF_GlyphMetrics(font, GLYPH_FIRST + i, &minx, &maxx, &miny, &maxy, &g->advance[i]) != 0) {
+			g->advance[i] = 0;
+			g->src[i] = (SDL_Rect) { x: 0, y: 0, w: 0, h: 0 };
+			continue;
+		}
 
-	return r;
-}
+		if (x + glyphs[i]->w > ATLAS_WIDTH) {
+			x = 0;
+			y += g->height;
+		}
+		g->src[i] = (SDL_Rect) { x: x, y: y, w: glyphs[i]->w, h: glyphs[i]->h };
+		x += glyphs[i]->w;
+	}
 
-SDL_bool get_int_field(json_t *o, char const *n, char const *s, int *r)
-{
-	json_t *var;
+	SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, ATLAS_WIDTH, y + g->height, 32, SDL_PIXELFORMAT_RGBA32);
+	for (i = 0; i < NGLYPHS; i++) {
+		if (!glyphs[i]) { continue; }
+		if (atlas) {
+			SDL_SetSurfaceBlendMode(glyphs[i], SDL_BLENDMODE_NONE);
+			SDL_BlitSurface(glyphs[i], 0, atlas, &g->src[i]);
+		}
+		SDL_FreeSurface(glyphs[i]);
+	}
+	if (!atlas) {
+		fprintf(stderr, "error: could not create glyph atlas: %s\n", SDL_GetError());
+		return false;
+	}
 
-	var = json_object_get(o, s);
-	if (!var) {
-		#ifdef VERBOSE
-		fprintf(stderr, "Warning: No %s for %s\n", s, n);
-		#endif
-                if (!streq(n, "custom-rule")) {
-                        *r = 0;
-                }
-		return SDL_FALSE;
+	g->tex = SDL_CreateTextureFromSurface(r, atlas);
+	SDL_FreeSurface(atlas);
+	if (!g->tex) {
+		fprintf(stderr, "error: could not create glyph atlas: %s\n", SDL_GetError());
+		return false;
 	}
-	*r = json_integer_value(var);
+	SDL_SetTextureBlendMode(g->tex, SDL_BLENDMODE_BLEND);
 
-	return SDL_TRUE;
+	return true;
 }
 
-SDL_bool get_float_field(json_t *o, char const *n, char const *s, double *r)
+void destroy_glyphs(glyph_atlas *g)
 {
-	json_t *var;
-
-	var = json_object_get(o, s);
-	if (!var) {
-		#ifdef VERBOSE
-		fprintf(stderr, "Warning: No %s for %s\n", s, n);
-		#endif
-		*r = 0;
-		return SDL_FALSE;
+	if (g->tex) {
+		SDL_DestroyTexture(g->tex);
 	}
-	*r = json_real_value(var);
-
-	return SDL_TRUE;
+	g->tex = 0;
 }
 
 /* low-level SDL */
@@ -670,17 +897,7 @@ SDL_Texture *load_texture(SDL_Renderer *r, char const *file)
 	return tex;
 }
 
-
-/* general low-level */
-char const *set_path(char const *fmt, ...)
+SDL_Rect sdl_rect(rect const *r)
 {
-	static char buf[MAX_PATH];
-
-	va_list ap;
-	va_start(ap, fmt);
-
-	vsnprintf(buf, MAX_PATH - 1, fmt, ap);
-	va_end(ap);
-
-	return buf;
+	return (SDL_Rect) { x: r->x, y: r->y, w: r->w, h: r->h };
 }
@@ -1,149 +1,133 @@
-#include <stdarg.h>
-
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include <SDL_image.h>
 
-#include <jansson.h>
-
-#define MAX_PATH 500
-#define CONF_DIR  "conf"
-#define ASSET_DIR "assets"
+#include "core.h"
 
-#define streq(s1, s2) !strcmp(s1, s2)
-#define between(x, y1, y2) (x >= y1 && x <= y2)
-
-enum dir { DIR_LEFT = -1, DIR_RIGHT = 1 };
-enum hit { HIT_NONE = 0, HIT_TOP = 1, HIT_LEFT = 1 << 1, HIT_RIGHT = 1 << 2, HIT_BOT = 1 << 3 };
-enum state { ST_IDLE, ST_WALK, ST_FALL, ST_JUMP, ST_HANG, NSTATES };
-static char const * const st_names[] = { "idle", "walk", "fall", "jump", "hang" };
+/* the printable ASCII characters */
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST '~'
+#define NGLYPHS (GLYPH_LAST - GLYPH_FIRST + 1)
 
+/* the glyphs of a font rendered once into a single texture */
 typedef struct {
-	int p;
-	int a;
-	int b;
-} line;
+	SDL_Texture *tex;
+	int height;
+	SDL_Rect src[NGLYPHS];
+	int advance[NGLYPHS];
+} glyph_atlas;
 
+/* one texture of packed sprite strips, and the sprites queued on it */
 typedef struct {
-	SDL_Texture *background;
-	SDL_Rect dim;
-	int nvertical;
-	int nhorizontal;
-	line *vertical;
-	line *horizontal;
-} level;
-
+	SDL_Texture *tex;
+	int w, h;
+	SDL_Vertex *v;
+	int *idx;
+	int n, cap;
+} sprite_page;
+
+/* all entity sprites, packed at load time; entity_rule.tex points at the
+ * page a rule's frames are on */
 typedef struct {
-	unsigned len;
-	unsigned *frames;
-	unsigned *duration;
-	SDL_Rect box;
-} animation_rule;
+	int npages;
+	sprite_page *pages;
+} sprite_atlas;
 
-typedef struct {
-	SDL_Rect start_dim;
-	int walk_dist;
-	int jump_dist_x;
-	int jump_dist_y;
-	int jump_time;
-	int fall_dist;
-	SDL_bool has_gravity;
-	double a_wide;
-	double a_high;
-	animation_rule anim[NSTATES];
-} entity_rule;
+/* edge length of the pieces a level background is uploaded in */
+#define CHUNK_SIZE 256
 
+/* A level background, kept decoded in memory and uploaded to the GPU only
+ * in the chunks around the screen. */
 typedef struct {
-	int pos;
-	int frame;
-	int remaining;
-} animation_state;
-
-enum jump_type { JUMP_WIDE, JUMP_HIGH, JUMP_HANG };
-
+	SDL_Surface *img;
+	SDL_BlendMode blend;
+	int nx, ny;
+	SDL_Texture **tex;
+	SDL_Rect kept;
+	int resident;
+} chunked_bg;
+
+/* A decoded image or an opened font, shared by everything that asks for
+ * the same file with the same contents and freed with its last user. */
 typedef struct {
-	SDL_bool active;
-	SDL_Point pos;
-	SDL_Rect hitbox;
-	SDL_Rect spawn;
-	enum dir dir;
-	enum state st;
-	int jump_timeout;
-	enum jump_type jump_type;
-	int fall_time;
-	animation_state anim;
-	entity_rule const *rule;
-	SDL_Texture *tex;
-} entity_state;
+	char *path;    /* canonical */
+	uint32_t hash; /* of the file's contents */
+	long long mtime, bytes; /* mtime in ns */
+	int size;      /* point size of a font, 0 for an image */
+	int refs;
+	SDL_Surface *img;
+	TTF_Font *font;
+} resource;
 
 typedef struct {
-	SDL_bool walk;
-	SDL_bool move_left;
-	SDL_bool move_right;
-	SDL_bool move_jump;
-} entity_event;
+	resource **r;
+	int n, cap;
+} resource_cache;
+
+/* Images to decode before anything is uploaded: the paths are collected
+ * first, then whatever the cache does not hold yet is decoded on as many
+ * threads as there are cores, and only the surfaces handed to the
+ * renderer afterwards.  The batch holds one reference to every image in
+ * it until it is freed. */
+typedef struct {
+	resource *res;
+	void *data; /* the file, until it is decoded */
+	size_t len;
+	char const *type;
+} image_job;
 
 typedef struct {
-	int walked;
-	int jumped;
-	int fallen;
-	SDL_bool turned;
-	SDL_bool hang;
-} move_log;
+	resource_cache *cache;
+	image_job *jobs;
+	int n, cap;
+	SDL_atomic_t next;
+} image_batch;
 
+/* how long input events wait until a tick acts on them */
 typedef struct {
-	SDL_bool active;
-	SDL_bool frames;
-	SDL_bool hitboxes;
-	SDL_bool pause;
-	SDL_bool show_terrain_collision;
-	SDL_Texture *terrain_collision;
-	SDL_bool message_positions;
-	TTF_Font *font;
-} debug_state;
+	unsigned pending;
+	Uint32 oldest;
+	Uint64 stamps;
+	unsigned events;
+	Uint64 total;
+	Uint32 max;
+} input_latency;
 
 /* loading */
-void load_anim(json_t *src, char const *name, char const *key, animation_rule *a);
 SDL_Texture *load_asset_tex(json_t *a, char const *d, SDL_Renderer *r, char const *k);
-void load_entity_rule(json_t *src, entity_rule *er, char const *n);
-json_t *load_entities(char const *root, char const *file, SDL_Renderer *r, SDL_Texture ***textures, entity_rule **rules);
-SDL_bool load_entity_resource(json_t *src, char const *n, SDL_Texture **t, SDL_Renderer *r, entity_rule *er, char const *root);
-void load_state(entity_state *es);
-void init_entity_state(entity_state *es, entity_rule const *er, SDL_Texture *t, enum state st);
-void clear_debug(debug_state *d);
-
-/* teardown */
-void destroy_level(level *l);
-
-/* state updates */
-void clear_order(entity_event *o);
-void tick_animation(entity_state *as);
-int kick_entity(entity_state *e, enum hit h, SDL_Point const *v);
-
-/* movement */
+json_t *load_entities(char const *root, char const *file, SDL_Renderer *r, arena *mem, entity_rule **rules, sprite_atlas *atlas);
+bool load_sprites(sprite_atlas *a, SDL_Renderer *r, SDL_Surface **img, entity_rule *rules, int n);
+void destroy_sprites(sprite_atlas *a);
+bool load_background(chunked_bg *bg, SDL_Surface *img);
+void destroy_background(chunked_bg *bg);
+
+/* resources */
+resource *cache_font(resource_cache *c, char const *path, int size);
+void release_resource(resource_cache *c, resource *r);
+void destroy_cache(resource_cache *c);
+int queue_image(image_batch *b, char const *root, char const *f);
+void decode_images(image_batch *b);
+SDL_Surface *batch_image(image_batch const *b, int i);
+void free_images(image_batch *b);
+
+/* input */
 void keystate_to_movement(unsigned char const *ks, entity_event *e);
-void move_entity(entity_state *e, entity_event const *ev, level const *lvl, move_log *mlog);
-
-/* collision */
-enum hit collides_with_terrain(SDL_Rect const *r, level const *lev);
-SDL_bool stands_on_terrain(SDL_Rect const *r, level const *t);
-void entity_hitbox(entity_state const *s, SDL_Rect *box);
-int cmp_lines(void const *x, void const *y);
-SDL_Point entity_feet(SDL_Rect const *r);
+void latency_event(input_latency *l, SDL_Event const *ev);
+void latency_consume(input_latency *l, Uint32 now);
+unsigned latency_mean(input_latency const *l);
 
 /* rendering */
-void draw_background(SDL_Renderer *r, SDL_Texture *bg, SDL_Rect const *screen);
-void draw_terrain_lines(SDL_Renderer *r, level const *lev, SDL_Rect const *screen);
-void render_line(SDL_Renderer *r, char const *s, TTF_Font *font, int l);
-void draw_entity(SDL_Renderer *r, SDL_Rect const *scr, entity_state const *s, debug_state const *debug);
+void draw_background(SDL_Renderer *r, chunked_bg *bg, SDL_Rect const *screen);
+int draw_terrain_lines(SDL_Renderer *r, level const *lev, SDL_Rect const *screen);
+bool entity_visible(SDL_Rect const *scr, entity_state const *s);
+void render_line(SDL_Renderer *r, char const *s, glyph_atlas const *g, int l);
+void draw_entity(SDL_Renderer *r, SDL_Rect const *scr, entity_state const *s, unsigned now, debug_state const *debug);
+void flush_sprites(SDL_Renderer *r, sprite_atlas *a);
 
-/* low-level json */
-char const *get_asset(json_t *a, char const *k);
-SDL_bool get_int_field(json_t *o, char const *n, char const *s, int *r);
-SDL_bool get_float_field(json_t *o, char const *n, char const *s, double *r);
+/* text */
+bool load_glyphs(glyph_atlas *g, SDL_Renderer *r, TTF_Font *font);
+void destroy_glyphs(glyph_atlas *g);
 
 /* low-level SDL */
 SDL_Texture *load_texture(SDL_Renderer *r, char const *file);
-
-/* general low-level */
-char const *set_path(char const *fmt, ...);
+SDL_Rect sdl_rect(rect const *r);
@@ -8,154 +8,109 @@
 #include <SDL_image.h>
 
 #include "engine.h"
+#include "bake.h"
+#include "replay.h"
+#include "watch.h"
 
 #define TICK 40
+#define SCRUB_TICKS (5000 / TICK)
+/* after a longer stall the game slows down rather than racing to catch up */
+#define MAX_LAG (5 * TICK)
+/* moves longer than this between two ticks are respawns, not interpolated */
+#define SNAP_DIST 64
 
 #define MSG_LINES 2
+/* more files changing at once than this reload everything */
+#define MAX_CHANGED 16
 
 #define ROOTVAR "FRIDGE_ROOT"
 #define GAME_CONF "game.json"
 
-enum mode { MODE_LOGO, MODE_INTRO, MODE_GAME, MODE_EXIT };
-
-enum msg_frequency { MSG_NEVER, MSG_ONCE, MSG_ALWAYS };
-static char const * const frq_names[] = { "never", "once", "always" };
-
 typedef struct {
-	enum msg_frequency when;
-	SDL_Point pos;
 	struct {
 		SDL_Point size;
 		SDL_Texture *tex;
 	} lines[MSG_LINES];
-} message;
+} message_text;
 
 typedef struct {
-	unsigned n;
-	int timeout;
 	SDL_Texture *tex;
-	message *msgs;
 	SDL_Rect box;
 	SDL_Rect line;
-} msg_info;
-
-typedef struct {
-	SDL_Point pos;
-	message win;
-	message loss;
-} finish;
+	int n;
+	message_text *text;
+	message_text win;
+	message_text loss;
+} msg_gfx;
 
 typedef struct {
 	SDL_Window *w;
 	SDL_Renderer *r;
-	level level;
-	msg_info msg;
-	finish finish;
+	world world;
+	chunked_bg background;
+	sprite_atlas sprites;
+	msg_gfx msg;
+	/* what the config loaded last holds on to, until the next one has
+	 * taken what it shares with it */
+	resource_cache cache;
+	image_batch images;
+	resource *font;
+	/* the rules, the groups and the world but its level, all of the last
+	 * config and gone with the next */
+	arena conf;
+	entity_rule *rules;
+	int nrules;
+	file_watch watch;
+	SDL_bool watching;
+	TTF_Font *debug_font;
+	glyph_atlas debug_text;
 	SDL_Point screen;
+	point *prev;
+	int nprev;
+	input_latency input;
 } session;
 
+/* the files a poll of the watcher reported */
 typedef struct {
-	unsigned n;
-	entity_state *e;
-} group;
-
-enum group { GROUP_PLAYER, GROUP_OBJECTS, GROUP_ENEMIES, NGROUPS };
-
-typedef struct {
-	int need_to_collect;
-	entity_state logo;
-	entity_state intro;
-	group entities[NGROUPS];
-	message const *msg;
-	unsigned msg_timeout;
-	enum mode run;
-	debug_state debug;
-} game_state;
-
-typedef struct {
-	entity_event player;
-	SDL_bool toggle_pause;
-	SDL_bool toggle_debug;
-	SDL_bool toggle_terrain;
-	SDL_bool reload_conf;
-	SDL_bool exit;
-	SDL_bool keyboard;
-	SDL_bool reset;
-} game_event;
+	bool conf;
+	bool game;
+	int nassets;
+	char assets[MAX_CHANGED][MAX_PATH];
+} changes;
 
 /* high level init */
 static SDL_bool init_game(session *s, game_state *g, char const *root);
 static SDL_bool load_config(session *s, game_state *gs, json_t *game, char const *root);
-static void load_intro(entity_state *intro, session const *s, json_t *o, char const *k, entity_rule const *e_rules, SDL_Texture **e_texs);
-void init_group(group *g, json_t const *game, json_t const *entities, char const *key, SDL_Texture **e_texs, entity_rule const *e_rules, enum state st);
+static image_batch decode_config(session *s, bake const *b, json_t *game, char const *root, int *msg, int *bg, int *slot);
+static void keep_images(session *s, image_batch *batch);
+static void keep_message(session const *s, game_state *gs, msg_info const *old);
 
 /* high level game */
 static void process_event(SDL_Event const *ev, game_event *r);
-static void update_gamestate(session *s, game_state *gs, game_event const *ev);
-static void set_group_state(group *g, enum state st);
-static void enemy_movement(level const *terrain, group *nmi, SDL_Rect const *player);
-static void render(session const *s, game_state const *gs);
-static void clear_game(game_state *gs);
-static void clear_event(game_event *ev);
-
-/* collisions */
-static SDL_bool in_rect(SDL_Point const *p, SDL_Rect const *r);
-static SDL_bool have_collision(SDL_Rect const *r1, SDL_Rect const *r2);
+static int replay_scrub(SDL_Event const *ev);
+static void step_game(session *s, game_state *gs, game_event const *ev);
+static void reload_config(session *s, game_state *gs);
+static bool hot_reload(session *s, game_state *gs);
+static void note_change(enum watch_dir d, char const *name, void *data);
+static bool is_resource(json_t *game, char const *k, char const *name);
+static void render(session *s, game_state const *gs, float t);
+static void save_positions(session *s, game_state const *gs);
+static point lerp_pos(point const *a, point const *b, float t);
 
 /* low level interactions */
-static SDL_bool load_finish(session *s, json_t *game, TTF_Font *font, int fontsize);
-static SDL_bool load_messages(session *s, json_t *game, TTF_Font *font, int fontsize, char const *root);
-static int load_collisions(level *level, json_t const *o);
-static SDL_Surface *load_asset_surf(json_t *a, char const *d, char const *k);
-static void render_message(message *ms, SDL_Renderer *r, TTF_Font *font, json_t *m, unsigned offset);
+static SDL_bool render_finish(session *s, json_t *game, TTF_Font *font);
+static SDL_bool render_messages(session *s, json_t *game, TTF_Font *font, int fontsize, SDL_Surface *msg_srf);
+static void destroy_message(message_text *ms);
+static void destroy_messages(msg_gfx *m);
+static void render_message(message_text *ms, SDL_Renderer *r, TTF_Font *font, json_t *m, unsigned offset);
+static message_text const *message_lines(session const *s, message const *m);
 static void draw_message_boxes(SDL_Renderer *r, msg_info const *msgs, SDL_Rect const *screen);
-static void render_entity_info(SDL_Renderer *r, TTF_Font *font, entity_state const *e);
-static void draw_message(SDL_Renderer *r, SDL_Texture *t, message const *m, SDL_Rect const *box, SDL_Rect const *line);
+static int render_entity_info(SDL_Renderer *r, glyph_atlas const *g, entity_state const *e);
+static void draw_message(SDL_Renderer *r, SDL_Texture *t, message_text const *m, SDL_Rect const *box, SDL_Rect const *line);
 #if 0
 static void print_hit(enum hit h);
 #endif
 
-static void print_event(FILE *fd, game_event *e)
-{
-	if (e->player.walk)       { fputs("walk\n",  fd); }
-	if (e->player.move_left)  { fputs("left\n",  fd); }
-	if (e->player.move_right) { fputs("right\n", fd); }
-	if (e->player.move_jump)  { fputs("jump\n",  fd); }
-
-	if (e->toggle_pause)   { fputs("pause\n",    fd); }
-	if (e->toggle_debug)   { fputs("debug\n",    fd); }
-	if (e->toggle_terrain) { fputs("hits\n",     fd); }
-	if (e->reload_conf)    { fputs("conf\n",     fd); }
-	if (e->exit)           { fputs("exit\n",     fd); }
-	if (e->keyboard)       { fputs("keyboard\n", fd); }
-	if (e->reset)          { fputs("spawn\n",    fd); }
-
-	fputs("tick\n", fd);
-}
-
-static void read_event(FILE *fd, game_event *e)
-{
-	char buf[MAX_PATH];
-	while (1) {
-	fgets(buf, MAX_PATH - 1, fd);
-	switch (*buf) {
-	case 'w': e->player.walk = SDL_TRUE; break;
-	case 'l': e->player.move_left = SDL_TRUE; break;
-	case 'r': e->player.move_right = SDL_TRUE; break;
-	case 'j': e->player.move_jump = SDL_TRUE; break;
-	case 'p': e->toggle_pause = SDL_TRUE; break;
-	case 'd': e->toggle_debug = SDL_TRUE; break;
-	case 'h': e->toggle_terrain = SDL_TRUE; break;
-	case 'c': e->reload_conf = SDL_TRUE; break;
-	case 'e': e->exit = SDL_TRUE; break;
-	case 'k': e->keyboard = SDL_TRUE; break;
-	case 's': e->reset = SDL_TRUE; break;
-	case 't': return;
-	default: break;
-	}
-	}
-}
-
 int main(int argc, char **argv) {
 	SDL_bool ok;
 	char const *root = getenv(ROOTVAR);
@@ -166,22 +121,28 @@ int main(int argc, char **argv) {
 	}
 
 	FILE *rp = 0;
+	replay_writer rw;
+	replay rr;
 	SDL_bool rp_play = SDL_FALSE;
 	SDL_bool rp_save = SDL_FALSE;
 	if (argc > 1) {
 		if (streq(argv[1], "--save-replay") || streq(argv[1], "-s")) {
-			char const *fname = "replay.txt";
+			char const *fname = "replay.rpl";
 			if (argc == 3) { fname = argv[2]; }
 			printf("saving replay to `%s'\n", fname);
-			rp = fopen(fname, "w");
+			rp = fopen(fname, "wb");
+			if (!rp || !replay_create(&rw, rp)) {
+				fprintf(stderr, "error: could not create replay `%s'\n", fname);
+				return 1;
+			}
 			rp_save = SDL_TRUE;
 		}
 
 		if (streq(argv[1], "--replay") || streq(argv[1], "-r")) {
-			char const *fname = "replay.txt";
+			char const *fname = "replay.rpl";
 			if (argc == 3) { fname = argv[2]; }
 			printf("loading replay `%s'\n", fname);
-			rp = fopen(fname, "r");
+			if (!replay_open(&rr, fname)) { return 1; }
 			rp_play = SDL_TRUE;
 		}
 	}
@@ -191,62 +152,121 @@ int main(int argc, char **argv) {
 	ok = init_game(&s, &gs, root);
 	if (!ok) { return 1; }
 
+	/* replays have to run on the config they were made with; a recording
+	 * may reload, and is then only checked up to the first reload */
+	s.watching = !rp_play && watch_open(&s.watch, root) ? SDL_TRUE : SDL_FALSE;
+
 	game_event ge;
 	clear_event(&ge);
 
-	unsigned ticks;
-	unsigned old_ticks = SDL_GetTicks();
+	/* the simulation runs in fixed ticks, paid for out of the time that
+	 * passed, so none is lost to rounding.  With vsync every frame is drawn
+	 * between the last two ticks, as far along as the time left over. */
+	unsigned now, last = SDL_GetTicks();
+	unsigned lag = 0;
+	SDL_RendererInfo info;
+	SDL_bool vsync = SDL_GetRendererInfo(s.r, &info) == 0 && info.flags & SDL_RENDERER_PRESENTVSYNC;
+	save_positions(&s, &gs);
 
-	int have_ev;
 	SDL_Event event;
 	while (gs.run != MODE_EXIT) {
-		if (!rp_play) {
-			have_ev = SDL_PollEvent(&event);
-			if (have_ev) {
-				process_event(&event, &ge);
-			}
+		/* everything that came in since the last frame goes into the
+		 * next tick, instead of one event per frame */
+		while (SDL_PollEvent(&event)) {
+			latency_event(&s.input, &event);
+			process_event(&event, &ge);
+			if (!rp_play) { continue; }
+
+			/* a replay only listens for quitting and scrubbing */
+			if (ge.exit) { break; }
+			clear_event(&ge);
 
-			unsigned char const *keystate = SDL_GetKeyboardState(0);
-			keystate_to_movement(keystate, &ge.player);
-		} else {
-			have_ev = SDL_PollEvent(&event);
-			if (have_ev) {
-				process_event(&event, &ge);
-				if (ge.exit) { break; }
-				clear_event(&ge);
+			int d = replay_scrub(&event);
+			if (d != 0) {
+				long t = (long) rr.tick + d;
+				if (!replay_jump(&rr, &s.world, &gs, t < 0 ? 0 : t)) {
+					fprintf(stderr, "Warning: this replay has no keyframes to go back to\n");
+				}
+				save_positions(&s, &gs);
 			}
 		}
+		if (rp_play && ge.exit) { break; }
+		if (s.watching && hot_reload(&s, &gs) && rp_save) {
+			replay_reloaded(&rw);
+		}
+
+		now = SDL_GetTicks();
+		lag += now - last;
+		last = now;
+		if (lag > MAX_LAG) { lag = MAX_LAG; }
+
+		SDL_bool stepped = SDL_FALSE;
+		while (lag >= TICK && gs.run != MODE_EXIT) {
+			if (!rp_play) {
+				unsigned char const *keystate = SDL_GetKeyboardState(0);
+				keystate_to_movement(keystate, &ge.player);
+			}
 
-		ticks = SDL_GetTicks();
-		if (ticks - old_ticks >= TICK) {
-			if (rp_save) { print_event(rp, &ge); }
-			else if (rp_play) { read_event(rp, &ge); }
-			update_gamestate(&s, &gs, &ge);
+			save_positions(&s, &gs);
+			if (rp_save) {
+				replay_keyframe(&rw, &s.world, &gs);
+				replay_record(&rw, &ge);
+			}
+			else if (rp_play && !replay_next(&rr, &ge)) {
+				/* as in sim, the replay is over after its last tick */
+				printf("replay ended after %u ticks\n", rr.tick);
+				gs.run = MODE_EXIT;
+				break;
+			}
+			step_game(&s, &gs, &ge);
+			if (rp_save) { replay_hash(&rw, &s.world, &gs); }
 			clear_event(&ge);
-			/*
-			printf("%d\n", ticks - old_ticks);
-			*/
-			old_ticks = ticks;
-		}
+			latency_consume(&s.input, SDL_GetTicks());
 
-		render(&s, &gs);
-		SDL_Delay(TICK / 4);
-	}
+			lag -= TICK;
+			stepped = SDL_TRUE;
+		}
 
-	int i;
-	for (i = 0; i < NGROUPS; i++) {
-		free(gs.entities[i].e);
+		if (vsync) {
+			/* presenting waits for the display */
+			render(&s, &gs, (float) lag / TICK);
+		} else {
+			/* nothing to pace frames with: draw each tick once and sleep
+			 * towards the next, waking up in between for input */
+			if (stepped) {
+				render(&s, &gs, 1);
+			}
+			SDL_Delay(TICK - lag < TICK / 4 ? TICK - lag : TICK / 4);
+		}
 	}
 
-	destroy_level(&s.level);
-	SDL_DestroyTexture(s.level.background);
-
-	if (gs.debug.font) {
-		TTF_CloseFont(gs.debug.font);
+	destroy_game(&gs);
+	destroy_world(&s.world);
+	arena_free(&s.conf);
+	destroy_background(&s.background);
+	destroy_sprites(&s.sprites);
+	destroy_messages(&s.msg);
+	free_images(&s.images);
+	release_resource(&s.cache, s.font);
+	destroy_cache(&s.cache);
+	if (s.watching) { watch_close(&s.watch); }
+
+	destroy_glyphs(&s.debug_text);
+	if (s.debug_font) {
+		TTF_CloseFont(s.debug_font);
 	};
 
-	if (rp) { fclose(rp); }
-	free(s.msg.msgs);
+	if (rp_save) {
+		replay_finish(&rw);
+		fclose(rp);
+	}
+	if (rp_play) { replay_close(&rr); }
+	free(s.prev);
+
+	if (s.input.events > 0) {
+		printf("input latency: %u ms mean, %u ms max over %u events\n",
+		       latency_mean(&s.input), (unsigned) s.input.max, s.input.events);
+	}
 
 	SDL_DestroyRenderer(s.r);
 	SDL_DestroyWindow(s.w);
@@ -300,9 +320,21 @@ static SDL_bool init_game(session *s, game_state *gs, char const *root)
 		SDL_FreeSurface(ico);
 	}
 
-	s->r = SDL_CreateRenderer(s->w, -1, 0);
-
-	gs->debug.font = 0;
+	s->r = SDL_CreateRenderer(s->w, -1, SDL_RENDERER_PRESENTVSYNC);
+	s->prev = 0;
+	s->nprev = 0;
+	s->input = (input_latency) { 0 };
+	s->background = (chunked_bg) { 0 };
+	s->sprites = (sprite_atlas) { 0 };
+	s->msg = (msg_gfx) { 0 };
+	s->cache = (resource_cache) { 0 };
+	s->images = (image_batch) { cache: &s->cache };
+	s->font = 0;
+	arena_init(&s->conf);
+	s->rules = 0;
+	s->nrules = 0;
+
+	s->debug_font = 0;
 	SDL_bool ok = load_config(s, gs, game, root);
 	if (!ok) { return SDL_FALSE; }
 
@@ -314,144 +346,144 @@ static SDL_bool init_game(session *s, game_state *gs, char const *root)
 
 static SDL_bool load_config(session *s, game_state *gs, json_t *game, char const *root)
 {
-	json_t *entities, *fnt, *level;
-	char const *file, *path;
+	json_t *fnt;
+	char const *path;
 
 	/* load config */
 	fnt = json_object_get(game, "font");
 	path = set_path("%s/%s/%s", root, ASSET_DIR, json_string_value(json_object_get(fnt, "resource")));
 	int fnt_siz = json_integer_value(json_object_get(fnt, "size"));
-	TTF_Font *font = TTF_OpenFont(path, fnt_siz);
-	if (!font) {
-		fprintf(stderr, "error: could not load font %s: %s\n", path, TTF_GetError());
-		return SDL_FALSE;
-	}
+	resource *font = cache_font(&s->cache, path, fnt_siz);
+	if (!font) { return SDL_FALSE; }
 
-	if (!gs->debug.font) {
-		gs->debug.font = TTF_OpenFont("debug_font.ttf", 14);
+	if (!s->debug_font) {
+		s->debug_font = TTF_OpenFont("debug_font.ttf", 14);
+		load_glyphs(&s->debug_text, s->r, s->debug_font);
 	}
 
-	SDL_bool ok;
-	ok = load_finish(s, game, font, fnt_siz);
-	if (!ok) { return SDL_FALSE; }
-
-	ok = load_messages(s, game, font, fnt_siz, root);
-	if (!ok) { return SDL_FALSE; }
-	TTF_CloseFont(font);
-
-	level = json_object_get(game, "level");
-	if (!ok) { return SDL_FALSE; }
-	path = set_path("%s/%s/%s", root, CONF_DIR, json_string_value(level));
-	json_error_t e;
-	level = json_load_file(path, 0, &e);
-	if (*e.text != 0) {
-		fprintf(stderr, "Error at %s:%d: %s\n", path, e.line, e.text);
+	bake b;
+	if (!bake_open(&b, root, GAME_CONF)) {
+		release_resource(&s->cache, font);
+		json_decref(game);
 		return SDL_FALSE;
 	}
 
-	s->level.background = load_asset_tex(level, root, s->r, "resource");
-	if (!s->level.background) { return SDL_FALSE; }
-
-	load_collisions(&s->level, level);
-	json_decref(level);
+	/* The new config is built next to the running one, which it only
+	 * replaces once all of it loaded; until then the entities keep the
+	 * groups and rules they have. */
+	world old_world = s->world;
+	arena old_conf = s->conf;
+	msg_gfx old_msg = s->msg;
+	chunked_bg old_bg = s->background;
+	sprite_atlas old_sprites = s->sprites;
+	s->msg = (msg_gfx) { 0 };
+	s->background = (chunked_bg) { 0 };
+	s->sprites = (sprite_atlas) { 0 };
+	arena_init(&s->conf);
+	bake_world(&b, &s->conf, &s->world);
 
 	entity_rule *e_rules;
-	SDL_Texture **e_texs;
-	entities = json_object_get(game, "entities");
-	if (!entities) {
-		fprintf(stderr, "Error: No entities defined, need player\n");
-		return SDL_FALSE;
-	}
-
-	file = json_string_value(json_object_get(entities, "resource"));
-	path = set_path("%s/%s/%s", root, CONF_DIR, file);
-	entities = load_entities(root, path, s->r, &e_texs, &e_rules);
-	if (!entities) {
-		fprintf(stderr, "Error: Could not load entities\n");
+	int i, n = bake_rules(&b, &s->conf, &e_rules);
+	int msg, bg, *slot = malloc(sizeof(int) * (n ? n : 1));
+	image_batch batch = decode_config(s, &b, game, root, &msg, &bg, slot);
+
+	bool ok;
+	ok = render_finish(s, game, font->font);
+	if (ok) {
+		ok = render_messages(s, game, font->font, fnt_siz, batch_image(&batch, msg));
+	}
+	ok = ok && load_background(&s->background, batch_image(&batch, bg));
+
+	SDL_Surface **img = calloc(n ? n : 1, sizeof(SDL_Surface *));
+	for (i = 0; i < n; i++) {
+		img[i] = batch_image(&batch, slot[i]);
+	}
+	ok = ok && load_sprites(&s->sprites, s->r, img, e_rules, n);
+	free(img);
+	free(slot);
+
+	if (!ok) {
+		destroy_world(&s->world);
+		arena_free(&s->conf);
+		destroy_messages(&s->msg);
+		destroy_background(&s->background);
+		destroy_sprites(&s->sprites);
+		s->world = old_world;
+		s->conf = old_conf;
+		s->msg = old_msg;
+		s->background = old_bg;
+		s->sprites = old_sprites;
+		free_images(&batch);
+		release_resource(&s->cache, font);
+		bake_close(&b);
+		json_decref(game);
 		return SDL_FALSE;
 	}
 
-	init_group(&gs->entities[GROUP_PLAYER ], game, entities, "players", e_texs, e_rules, ST_IDLE);
-	init_group(&gs->entities[GROUP_OBJECTS], game, entities, "objects", e_texs, e_rules, ST_IDLE);
-	init_group(&gs->entities[GROUP_ENEMIES], game, entities, "enemies", e_texs, e_rules, ST_WALK);
-
-	load_intro(&gs->logo, s, entities, "logo", e_rules, e_texs);
-	load_intro(&gs->intro, s, entities, "intro", e_rules, e_texs);
-
-	/* all texture pointers are copied by value, no need to hold onto the
-	 * e_texs buffer */
-	free(e_texs);
-
-	json_decref(entities);
+	point screen = { x: s->screen.x, y: s->screen.y };
+	bake_game(&b, &s->conf, gs, &screen, e_rules);
+	bake_close(&b);
 	json_decref(game);
 
+	/* only now may what the last config alone used go */
+	if (s->rules) {
+		keep_message(s, gs, &old_world.msg);
+		destroy_world(&old_world);
+		arena_free(&old_conf);
+	}
+	destroy_messages(&old_msg);
+	destroy_background(&old_bg);
+	destroy_sprites(&old_sprites);
+	keep_images(s, &batch);
+	release_resource(&s->cache, s->font);
+	s->font = font;
+	s->rules = e_rules;
+	s->nrules = n;
+
 	return SDL_TRUE;
 }
 
-static void load_intro(entity_state *intro, session const *s, json_t *o, char const *k, entity_rule const *e_rules, SDL_Texture **e_texs)
+/* Decodes the message box, the background and the sprite sheets of b, all
+ * at once and as far as the cache does not hold them yet, and gives their
+ * slots in the batch. */
+static image_batch decode_config(session *s, bake const *b, json_t *game, char const *root, int *msg, int *bg, int *slot)
 {
-	json_t *io;
-	io = json_object_get(o, k);
-	if (!io) {
-		fprintf(stderr, "Warning: No intro found for `%s'\n", k);
-		intro->active = SDL_FALSE;
-	} else {
-		int i = json_integer_value(json_object_get(io, "index"));
-		// TODO
-		intro->spawn.w = 640;
-		intro->spawn.h = 480;
-		intro->spawn.x = (s->screen.x - 640) / 2;
-		intro->spawn.y = (s->screen.y - 480) / 2;
-		init_entity_state(intro, &e_rules[i], e_texs[i], ST_IDLE);
+	image_batch batch = { cache: &s->cache };
+	int i;
+
+	*msg = queue_image(&batch, root, get_asset(json_object_get(game, "message"), "resource"));
+	*bg = queue_image(&batch, root, bake_background(b));
+	for (i = 0; i < b->hdr->nrules; i++) {
+		slot[i] = queue_image(&batch, root, bake_asset(b, i));
 	}
+	decode_images(&batch);
+
+	return batch;
 }
 
-void init_group(group *g, json_t const *game, json_t const *entities, char const *key, SDL_Texture **e_texs, entity_rule const *e_rules, enum state st)
+/* holds on to the images of batch instead of the last ones */
+static void keep_images(session *s, image_batch *batch)
 {
-	json_t *objs;
-	entity_state *a;
+	free_images(&s->images);
+	s->images = *batch;
+}
 
-	objs = json_object_get(game, key);
-	if (!objs) {
-		g->n = 0;
-		g->e = 0;
+/* Points the message showing into the new config, by its position as
+ * snapshots keep it, or hides it if the new config has no such message.
+ * The finish messages are part of the world, so they stay where they are. */
+static void keep_message(session const *s, game_state *gs, msg_info const *old)
+{
+	message const *m = gs->msg;
+	if (!m || m == &s->world.finish.win || m == &s->world.finish.loss) {
 		return;
 	}
 
-	int i, k;
-	i = 0;
-	k = 0;
-	json_t *o;
-	char const *name;
-	json_object_foreach(objs, name, o) {
-		k += json_array_size(o);
-	}
-
-	g->n = k;
-	a = malloc(sizeof(entity_state) * k);
-	g->e = a;
-
-	i = 0;
-	json_t *spawn;
-	json_object_foreach(objs, name, o) {
-		int ei, j;
-		json_t *entity, *rules;
-		entity = json_object_get(entities, name);
-		ei = json_integer_value(json_object_get(entity, "index"));
-		json_array_foreach(o, j, spawn) {
-			a[i].spawn.x = json_integer_value(json_array_get(spawn, 0));
-			a[i].spawn.y = json_integer_value(json_array_get(spawn, 1));
-                        init_entity_state(&a[i], &e_rules[ei], e_texs[ei], st);
-                        rules = json_array_get(spawn, 2);
-                        if (rules) {
-                                entity_rule *custom;
-                                custom = malloc(sizeof(entity_rule));
-                                *custom = *a[i].rule;
-                                load_entity_rule(rules, custom, "custom-rule");
-                                a[i].rule = custom;
-                        }
-			i += 1;
-		}
+	unsigned i = m - old->msgs;
+	if (i < s->world.msg.n) {
+		gs->msg = &s->world.msg.msgs[i];
+	} else {
+		gs->msg = 0;
+		gs->msg_timeout = 0;
 	}
 }
 
@@ -462,271 +494,300 @@ static void process_event(SDL_Event const *ev, game_event *r)
 
 	switch (ev->type) {
 	case SDL_QUIT:
-		r->exit = SDL_TRUE;
+		r->exit = true;
 		break;
 	case SDL_KEYUP:
-		r->keyboard = SDL_TRUE;
+		r->keyboard = true;
 		switch(key) {
 		case SDLK_q:
-			r->exit = SDL_TRUE;
+			r->exit = true;
 			break;
 		case SDLK_b:
-			r->toggle_terrain = SDL_TRUE;
+			r->toggle_terrain = true;
 			break;
 		case SDLK_u:
-			r->reload_conf = SDL_TRUE;
+			r->reload_conf = true;
 			break;
 		case SDLK_p:
-			r->toggle_pause = SDL_TRUE;
+			r->toggle_pause = true;
 			break;
 		case SDLK_SPACE:
-			r->player.move_jump = SDL_TRUE;
+			r->player.move_jump = true;
 			break;
 		case SDLK_r:
-			r->reset = SDL_TRUE;
+			r->reset = true;
 			break;
 		case SDLK_d:
-			r->toggle_debug = SDL_TRUE;
+			r->toggle_debug = true;
 			break;
 		}
 		break;
 	}
 }
 
-static void update_gamestate(session *s, game_state *gs, game_event const *ev)
+/* how many ticks to skip in a replay, if any */
+static int replay_scrub(SDL_Event const *ev)
 {
-	if (gs->run == MODE_LOGO) {
+	if (ev->type != SDL_KEYDOWN) { return 0; }
 
-		tick_animation(&gs->logo );
-
-		if (gs->logo.anim.pos == gs->logo.rule->anim[ST_IDLE].len - 1 ||
-		    ev->keyboard) {
-			gs->run = MODE_INTRO;
-		}
+	switch (ev->key.keysym.sym) {
+	case SDLK_RIGHT:
+		return SCRUB_TICKS;
+	case SDLK_LEFT:
+		return -SCRUB_TICKS;
 	}
 
-	if (gs->run == MODE_INTRO) {
-
-		tick_animation(&gs->intro);
-
-		if (ev->keyboard) {
-			gs->run = MODE_GAME;
-		}
-	}
+	return 0;
+}
 
-	if (gs->run != MODE_GAME) {
-		return;
-	}
+static void step_game(session *s, game_state *gs, game_event const *ev)
+{
+	update_gamestate(&s->world, gs, ev);
 
-	if (ev->toggle_debug) {
-		gs->debug.active = !gs->debug.active;
-		set_group_state(&gs->entities[GROUP_ENEMIES], gs->debug.pause && gs->debug.active ? ST_IDLE : ST_WALK);
+	/* re-loading needs the renderer, so it happens here instead of in
+	 * the core game rules */
+	if (ev->reload_conf && gs->run == MODE_GAME && gs->debug.active) {
+		reload_config(s, gs);
 	}
+}
 
-	if (ev->reload_conf && gs->debug.active) {
-		char const *r, *p;
-		r = getenv(ROOTVAR);
-		if (r && *r) {
-			p = set_path("%s/%s/%s", r, CONF_DIR, GAME_CONF);
-			json_t *g;
-			json_error_t e;
-			g = json_load_file(p, 0, &e);
-			if (*e.text != 0) {
-				fprintf(stderr, "error: in %s:%d: %s\n", p, e.line, e.text);
-			} else {
-				SDL_Point ps = gs->entities[GROUP_PLAYER].e[0].pos;
-				enum dir dr = gs->entities[GROUP_PLAYER].e[0].dir;
-				fprintf(stderr, "info: re-loading config\n");
-				load_config(s, gs, g, r);
-				gs->entities[GROUP_PLAYER].e[0].pos = ps;
-				gs->entities[GROUP_PLAYER].e[0].dir = dr;
+static void reload_config(session *s, game_state *gs)
+{
+	char const *r, *p;
+	r = getenv(ROOTVAR);
+	if (r && *r) {
+		p = set_path("%s/%s/%s", r, CONF_DIR, GAME_CONF);
+		json_t *g;
+		json_error_t e;
+		g = json_load_file(p, 0, &e);
+		if (*e.text != 0) {
+			fprintf(stderr, "error: in %s:%d: %s\n", p, e.line, e.text);
+		} else {
+			entity_state pl;
+			group_get(&gs->entities[GROUP_PLAYER], 0, &pl);
+			point ps = pl.pos;
+			enum dir dr = pl.dir;
+			fprintf(stderr, "info: re-loading config\n");
+			if (!load_config(s, gs, g, r)) {
+				fprintf(stderr, "Warning: keeping the config that was running\n");
+				return;
 			}
+			gs->clock = 0; /* the new entities start their animations over */
+			group_get(&gs->entities[GROUP_PLAYER], 0, &pl);
+			pl.pos = ps;
+			pl.dir = dr;
+			group_put(&gs->entities[GROUP_PLAYER], 0, &pl);
 		}
 	}
+}
 
-	if (ev->toggle_pause && gs->debug.active) {
-		gs->debug.pause = !gs->debug.pause;
-		set_group_state(&gs->entities[GROUP_ENEMIES], gs->debug.pause ? ST_IDLE : ST_WALK);
-	}
+/* Reloads only what the files that changed feed: the entity rules in
+ * place, the level's lines and their index, the sprites or the
+ * background, leaving every entity as it is.  game.json, the font and
+ * the message box still reload everything, as does a change to which
+ * entities there are.  Returns whether the game may now play out
+ * differently, as only sprites and the background leave it alone. */
+static bool hot_reload(session *s, game_state *gs)
+{
+	changes c = { 0 };
+	if (watch_poll(&s->watch, note_change, &c) == 0) { return false; }
 
-	if (ev->toggle_terrain && gs->debug.active) {
-		gs->debug.show_terrain_collision = !gs->debug.show_terrain_collision;
+	/* outside debug mode the game keeps the config it started with */
+	if (gs->run != MODE_GAME || !gs->debug.active) { return false; }
+	if (c.game) {
+		reload_config(s, gs);
+		return true;
 	}
 
-	int i;
-	enum group g;
-	for (g = 0; g < NGROUPS; g++) {
-		for (i = 0; i < gs->entities[g].n; i++) {
-			if (gs->entities[g].e[i].active) {
-				tick_animation(&gs->entities[g].e[i]);
-			}
-		}
-	}
-
-	if (!gs->debug.active || !gs->debug.pause) {
-		SDL_Rect h;
-		entity_hitbox(&gs->entities[GROUP_PLAYER].e[0], &h);
-		enemy_movement(&s->level, &gs->entities[GROUP_ENEMIES], &h);
+	char const *root = getenv(ROOTVAR);
+	char const *p = set_path("%s/%s/%s", root, CONF_DIR, GAME_CONF);
+	json_error_t e;
+	json_t *game = json_load_file(p, 0, &e);
+	if (*e.text != 0) {
+		fprintf(stderr, "error: in %s:%d: %s\n", p, e.line, e.text);
+		return false;
 	}
 
-	enum state old_state = gs->entities[GROUP_PLAYER].e[0].st;
-	move_log log;
-	move_entity(&gs->entities[GROUP_PLAYER].e[0], &ev->player, &s->level, &log);
-
-	if (old_state != gs->entities[GROUP_PLAYER].e[0].st) {
-		/* print_state
-		printf("%s -> %s\n", st_names[old_state], st_names[gs->entities[GROUP_PLAYER].e[0].st]);
-		*/
-		load_state(&gs->entities[GROUP_PLAYER].e[0]);
+	bake b;
+	if (!bake_open(&b, root, GAME_CONF)) {
+		json_decref(game);
+		return false;
 	}
 
-	if (ev->reset) {
-		init_entity_state(&gs->entities[GROUP_PLAYER].e[0], 0, 0, ST_IDLE);
+	Uint32 start = SDL_GetTicks();
+	bool full = false, sprites = c.conf, bg = false;
+	if (c.conf) {
+		if (bake_level_differs(&b, &s->world.level)) {
+			destroy_level(&s->world.level);
+			bake_level(&b, &s->world.level);
+		}
+		/* a sheet may have been swapped for another, so sprites follow */
+		full = !bake_update_rules(&b, &s->conf, gs, s->rules, s->nrules);
 	}
 
-	if (gs->msg_timeout > 0) {
-		gs->msg_timeout -= 1;
-	} else {
-		gs->msg = 0;
-	}
-	SDL_Rect r;
-	entity_hitbox(&gs->entities[GROUP_PLAYER].e[0], &r);
-	for (i = 0; i < s->msg.n; i++) {
-		if (s->msg.msgs[i].when == MSG_NEVER) {
+	int i, k;
+	for (i = 0; i < c.nassets && !full; i++) {
+		char const *a = c.assets[i], *f;
+		f = bake_background(&b);
+		if (f && streq(f, a)) {
+			bg = true;
 			continue;
 		}
-
-		if (in_rect(&s->msg.msgs[i].pos, &r)) {
-			gs->msg = &s->msg.msgs[i];
-			gs->msg_timeout = s->msg.timeout;
-			if (s->msg.msgs[i].when == MSG_ONCE) {
-				s->msg.msgs[i].when = MSG_NEVER;
-			}
+		bool sheet = false;
+		for (k = 0; k < s->nrules; k++) {
+			f = bake_asset(&b, k);
+			if (f && streq(f, a)) { sheet = true; }
 		}
+		sprites = sprites || sheet;
+		full = !sheet && (is_resource(game, "font", a) || is_resource(game, "message", a));
 	}
 
-	for (g = 0; g < NGROUPS; g++) {
-		for (i = 0; i < gs->entities[g].n; i++) {
-			if (!gs->entities[g].e[i].active) {
-				continue;
-			}
-
-			SDL_Rect hb;
-			entity_hitbox(&gs->entities[g].e[i], &hb);
-			if (have_collision(&r, &hb)) {
-				switch (g) {
-				case GROUP_OBJECTS:
-					gs->entities[g].e[i].active = SDL_FALSE;
-					gs->need_to_collect -= 1;
-					break;
-				case GROUP_ENEMIES:
-					init_entity_state(&gs->entities[GROUP_PLAYER].e[0], 0, 0, ST_IDLE);
-					break;
-				case GROUP_PLAYER:
-					break;
-				case NGROUPS:
-					fprintf(stderr, "line %d: can never happen\n", __LINE__);
-				}
+	if (!full && (sprites || bg)) {
+		int msg, bgs, *slot = malloc(sizeof(int) * (s->nrules ? s->nrules : 1));
+		image_batch batch = decode_config(s, &b, game, root, &msg, &bgs, slot);
+		if (bg) {
+			destroy_background(&s->background);
+			load_background(&s->background, batch_image(&batch, bgs));
+		}
+		if (sprites) {
+			SDL_Surface **img = calloc(s->nrules ? s->nrules : 1, sizeof(SDL_Surface *));
+			for (i = 0; i < s->nrules; i++) {
+				img[i] = batch_image(&batch, slot[i]);
 			}
+			destroy_sprites(&s->sprites);
+			load_sprites(&s->sprites, s->r, img, s->rules, s->nrules);
+			free(img);
 		}
+		keep_images(s, &batch);
+		free(slot);
 	}
 
-	entity_hitbox(&gs->entities[GROUP_PLAYER].e[0], &r);
-	if (in_rect(&s->finish.pos,  &r)) {
-		if (gs->need_to_collect <= 0) {
-			gs->msg = &s->finish.win;
-		} else {
-			gs->msg = &s->finish.loss;
-		}
-	}
+	bake_close(&b);
+	json_decref(game);
 
-	if (ev->exit) {
-		gs->run = MODE_EXIT;
+	if (full) {
+		reload_config(s, gs);
+	} else {
+		fprintf(stderr, "info: hot reload took %u ms\n", (unsigned) (SDL_GetTicks() - start));
 	}
+
+	return full || c.conf;
 }
 
-static void set_group_state(group *g, enum state st)
+static void note_change(enum watch_dir d, char const *name, void *data)
 {
-	int i;
-	for (i = 0; i < g->n; i++) {
-		g->e[i].st = st;
-		load_state(&g->e[i]);
+	changes *c = data;
+
+	if (d == WATCH_CONF) {
+		/* the config cache is written by the reload itself */
+		if (streq(name, BAKE_FILE)) { return; }
+		if (streq(name, GAME_CONF)) {
+			c->game = true;
+		} else {
+			c->conf = true;
+		}
+	} else if (c->nassets < MAX_CHANGED) {
+		snprintf(c->assets[c->nassets++], MAX_PATH, "%s", name);
+	} else {
+		c->game = true;
 	}
 }
 
-static void enemy_movement(level const *terrain, group *nmi, SDL_Rect const *player)
+static bool is_resource(json_t *game, char const *k, char const *name)
 {
-	int i;
-	for (i = 0; i < nmi->n; i++) {
-		entity_state *e = &nmi->e[i];
-		entity_event order;
-		clear_order(&order);
-		SDL_Rect h;
-		entity_hitbox(e, &h);
-		SDL_bool track = SDL_FALSE;
-		if (between(player->y, h.y, h.y + h.h) || between(h.y, player->y, player->y + player->h)) {
-			e->dir = (e->pos.x < player->x) ? DIR_RIGHT : DIR_LEFT;
-			track = SDL_TRUE;
-		}
-		if (between(player->x, h.x, h.x + h.w) && e->pos.y > player->y) {
-			order.move_jump = SDL_TRUE;
-			track = SDL_TRUE;
-		}
-		h.x += e->dir * e->rule->walk_dist;
-		if (collides_with_terrain(&h, terrain) == HIT_NONE && (!e->rule->has_gravity || stands_on_terrain(&h, terrain))) {
-			order.walk = SDL_TRUE;
-		}
-		move_log log;
-		move_entity(e, &order, terrain, &log);
-		if (!track && !order.walk) {
-			e->dir *= -1;
-		}
-	}
+	char const *r = json_string_value(json_object_get(json_object_get(game, k), "resource"));
+	return r && streq(r, name);
 }
 
-static void render(session const *s, game_state const *gs)
+/* Draws the game t of the way from the tick before the last one to the
+ * last one. */
+static void render(session *s, game_state const *gs, float t)
 {
-	int i;
+	int i, k;
 	SDL_RenderClear(s->r);
 
-	SDL_Rect screen = { x: gs->entities[GROUP_PLAYER].e[0].pos.x - (s->screen.x - gs->entities[GROUP_PLAYER].e[0].spawn.w) / 2,
-	                    y: gs->entities[GROUP_PLAYER].e[0].pos.y - (s->screen.y - gs->entities[GROUP_PLAYER].e[0].spawn.h) / 2,
+	int n = 0;
+	for (i = 0; i < NGROUPS; i++) {
+		n += gs->entities[i].n;
+	}
+	if (n != s->nprev) {
+		/* the entities were reloaded */
+		t = 1;
+	}
+
+	entity_state player;
+	group_get(&gs->entities[GROUP_PLAYER], 0, &player);
+	entity_state const now = player;
+	if (t < 1) {
+		player.pos = lerp_pos(&s->prev[0], &player.pos, t);
+	}
+
+	SDL_Rect screen = { x: player.pos.x - (s->screen.x - player.spawn.w) / 2,
+	                    y: player.pos.y - (s->screen.y - player.spawn.h) / 2,
 			    w: s->screen.x, h: s->screen.y };
 
 	switch (gs->run) {
 	case MODE_LOGO:
 		screen.x = screen.y = 0;
-		draw_entity(s->r, &screen, &gs->logo, 0);
+		draw_entity(s->r, &screen, &gs->logo, gs->clock, 0);
+		flush_sprites(s->r, &s->sprites);
 		break;
 	case MODE_INTRO:
 		screen.x = screen.y = 0;
-		draw_entity(s->r, &screen, &gs->intro, 0);
+		draw_entity(s->r, &screen, &gs->intro, gs->clock, 0);
+		flush_sprites(s->r, &s->sprites);
 		break;
 	case MODE_GAME:
-		draw_background(s->r, s->level.background, &screen);
+		draw_background(s->r, &s->background, &screen);
+
+		/* what is drawn and what is left out for being off screen */
+		int lines = 0, shown = 0, culled = 0;
 		if (gs->debug.active && gs->debug.show_terrain_collision) {
-			draw_terrain_lines(s->r, &s->level, &screen);
+			lines = draw_terrain_lines(s->r, &s->world.level, &screen);
 		}
 		int g;
-		for (g = 0; g < NGROUPS; g++) {
-			for (i = 0; i < gs->entities[g].n; i++) {
-				if (gs->entities[g].e[i].active) {
-					draw_entity(s->r, &screen, &gs->entities[g].e[i], &gs->debug);
+		for (g = 0, k = 0; g < NGROUPS; g++) {
+			for (i = 0; i < gs->entities[g].n; i++, k++) {
+				if (gs->entities[g].active[i]) {
+					entity_state e;
+					group_get(&gs->entities[g], i, &e);
+					if (t < 1) {
+						e.pos = lerp_pos(&s->prev[k], &e.pos, t);
+					}
+					if (!entity_visible(&screen, &e)) {
+						culled++;
+						continue;
+					}
+					draw_entity(s->r, &screen, &e, gs->clock, &gs->debug);
+					shown++;
 				}
 			}
 		}
+		flush_sprites(s->r, &s->sprites);
 
 		if (gs->debug.active && gs->debug.message_positions) {
-			draw_message_boxes(s->r, &s->msg, &screen);
+			draw_message_boxes(s->r, &s->world.msg, &screen);
 		}
 
-		draw_entity(s->r, &screen, &gs->entities[GROUP_PLAYER].e[0], &gs->debug);
+		draw_entity(s->r, &screen, &player, gs->clock, &gs->debug);
+		flush_sprites(s->r, &s->sprites);
 		if (gs->debug.active) {
-			render_entity_info(s->r, gs->debug.font, &gs->entities[GROUP_PLAYER].e[0]);
+			int l = render_entity_info(s->r, &s->debug_text, &now);
+			char const *in = set_path("input: %03u ms mean, %03u ms max",
+			                          latency_mean(&s->input), (unsigned) s->input.max);
+			render_line(s->r, in, &s->debug_text, l++);
+			if (gs->debug.show_terrain_collision) {
+				int all = s->world.level.nhorizontal + s->world.level.nvertical;
+				in = set_path("drawn: %d of %d entities, %d of %d lines",
+				              shown, shown + culled, lines, all);
+			} else {
+				in = set_path("drawn: %d of %d entities", shown, shown + culled);
+			}
+			render_line(s->r, in, &s->debug_text, l);
 		}
 
 		if (gs->msg) {
-			draw_message(s->r, s->msg.tex, gs->msg, &s->msg.box, &s->msg.line);
+			draw_message(s->r, s->msg.tex, message_lines(s, gs->msg), &s->msg.box, &s->msg.line);
 		}
 		break;
 	case MODE_EXIT:
@@ -736,47 +797,33 @@ static void render(session const *s, game_state const *gs)
 	SDL_RenderPresent(s->r);
 }
 
-static void clear_game(game_state *gs)
+/* remembers where every entity was before a tick, to draw it in between */
+static void save_positions(session *s, game_state const *gs)
 {
-	gs->msg = 0;
-
-	gs->need_to_collect = gs->entities[GROUP_OBJECTS].n;
-	clear_debug(&gs->debug);
-}
+	int g, i, k = 0;
+	for (g = 0; g < NGROUPS; g++) {
+		k += gs->entities[g].n;
+	}
+	if (k != s->nprev) {
+		s->prev = realloc(s->prev, sizeof(point) * k);
+		s->nprev = k;
+	}
 
-static void clear_event(game_event *ev)
-{
-	clear_order(&ev->player);
-	ev->exit = SDL_FALSE;
-	ev->toggle_debug = SDL_FALSE;
-	ev->toggle_pause = SDL_FALSE;
-	ev->toggle_terrain = SDL_FALSE;
-	ev->reload_conf = SDL_FALSE;
-	ev->keyboard = SDL_FALSE;
-	ev->reset = SDL_FALSE;
+	for (g = 0, k = 0; g < NGROUPS; g++) {
+		for (i = 0; i < gs->entities[g].n; i++, k++) {
+			s->prev[k] = gs->entities[g].pos[i];
+		}
+	}
 }
 
-/* collisions */
-static SDL_bool in_rect(SDL_Point const *p, SDL_Rect const *r)
+static point lerp_pos(point const *a, point const *b, float t)
 {
-	return between(p->x, r->x, r->x + r->w) &&
-	       between(p->y, r->y, r->y + r->h);
-}
+	if (abs(b->x - a->x) > SNAP_DIST || abs(b->y - a->y) > SNAP_DIST) {
+		return *b;
+	}
 
-static SDL_bool have_collision(SDL_Rect const *r1, SDL_Rect const *r2)
-{
-	int lf1 = r1->x;
-	int rt1 = lf1 + r1->w;
-	int tp1 = r1->y;
-	int bt1 = tp1 + r1->h;
-
-	int lf2 = r2->x;
-	int rt2 = lf2 + r2->w;
-	int tp2 = r2->y;
-	int bt2 = tp2 + r2->h;
-
-	return (between(lf1, lf2, rt2) || between(rt1, lf2, rt2) || between(lf2, lf1, rt1) || between(rt2, lf1, rt1)) &&
-	       (between(tp1, tp2, bt2) || between(bt1, tp2, bt2) || between(tp2, tp1, bt1) || between(bt2, tp1, bt1));
+	return (point) { x: a->x + (int) ((b->x - a->x) * t),
+	                 y: a->y + (int) ((b->y - a->y) * t) };
 }
 
 /* low level interactions */
@@ -809,32 +856,35 @@ static void draw_message_boxes(SDL_Renderer *r, msg_info const *msgs, SDL_Rect c
 	}
 }
 
-static void render_entity_info(SDL_Renderer *r, TTF_Font *font, entity_state const *e)
+/* returns the number of lines written */
+static int render_entity_info(SDL_Renderer *r, glyph_atlas const *g, entity_state const *e)
 {
 	char const *s;
 	s = set_path("pos:  %04d %04d, state: %s", e->pos.x, e->pos.y, st_names[e->st]);
 	int l = 0;
-	render_line(r, s, font, l++);
+	render_line(r, s, g, l++);
 
-	SDL_Rect hb;
+	rect hb;
 	entity_hitbox(e, &hb);
 
-	SDL_Point ft = entity_feet(&hb);
+	point ft = entity_feet(&hb);
 	s = set_path("feet: %04d %04d", ft.x, ft.y);
-	render_line(r, s, font, l++);
+	render_line(r, s, g, l++);
 
 	if (e->fall_time > 0) {
 		s = set_path("fall time: %03d", e->fall_time);
-		render_line(r, s, font, l++);
+		render_line(r, s, g, l++);
 	}
 
 	if (e->jump_timeout > 0) {
 		s = set_path("jump timeout: %03d", e->jump_timeout);
-		render_line(r, s, font, l++);
+		render_line(r, s, g, l++);
 	}
+
+	return l;
 }
 
-static void draw_message(SDL_Renderer *r, SDL_Texture *t, message const *m, SDL_Rect const *box, SDL_Rect const *line)
+static void draw_message(SDL_Renderer *r, SDL_Texture *t, message_text const *m, SDL_Rect const *box, SDL_Rect const *line)
 {
 	SDL_RenderCopy(r, t, 0, box);
 
@@ -851,135 +901,66 @@ static void draw_message(SDL_Renderer *r, SDL_Texture *t, message const *m, SDL_
 	}
 }
 
-static SDL_bool load_finish(session *s, json_t *game, TTF_Font *font, int fontsize)
+static message_text const *message_lines(session const *s, message const *m)
 {
-	finish *f = &s->finish;
-	json_t *fin = json_object_get(game, "finish");
-	if (!fin) { return SDL_FALSE; }
+	if (m == &s->world.finish.win) {
+		return &s->msg.win;
+	} else if (m == &s->world.finish.loss) {
+		return &s->msg.loss;
+	}
 
-	json_t *o = json_object_get(fin, "pos");
-	f->pos.x = json_integer_value(json_array_get(o, 0));
-	f->pos.y = json_integer_value(json_array_get(o, 1));
+	return &s->msg.text[m - s->world.msg.msgs];
+}
 
-	o = json_object_get(fin, "win");
-	f->win = (message) { pos: { x: f->pos.x,
-	                            y: f->pos.y },
-		             when: MSG_NEVER };
-	render_message(&f->win, s->r, font, o, 0);
+static SDL_bool render_finish(session *s, json_t *game, TTF_Font *font)
+{
+	json_t *fin = json_object_get(game, "finish");
+	if (!fin) { return SDL_FALSE; }
 
-	o = json_object_get(fin, "loss");
-	f->loss = (message) { pos: { x: f->pos.x,
-	                             y: f->pos.y },
-		              when: MSG_NEVER };
-	render_message(&f->loss, s->r, font, o, 0);
+	render_message(&s->msg.win, s->r, font, json_object_get(fin, "win"), 0);
+	render_message(&s->msg.loss, s->r, font, json_object_get(fin, "loss"), 0);
 
 	return SDL_TRUE;
 }
 
-static SDL_bool load_messages(session *s, json_t *game, TTF_Font *font, int fontsize, char const *root)
+static SDL_bool render_messages(session *s, json_t *game, TTF_Font *font, int fontsize, SDL_Surface *msg_srf)
 {
 	json_t *o = json_object_get(game, "message");
 	if (!o) { return SDL_FALSE; }
 
-	msg_info *mi = &s->msg;
+	msg_gfx *mg = &s->msg;
 
-	SDL_Surface *msg_srf;
-	msg_srf = load_asset_surf(o, root, "resource");
 	if (!msg_srf) {
 		fprintf(stderr, "Warning: Message texture missing\n");
-		mi->n = 0;
+		s->world.msg.n = 0;
 		return SDL_FALSE;
 	}
 
-	mi->tex = SDL_CreateTextureFromSurface(s->r, msg_srf);
-	mi->box = (SDL_Rect) { x: (s->screen.x - msg_srf->w) / 2,
+	mg->tex = SDL_CreateTextureFromSurface(s->r, msg_srf);
+	mg->box = (SDL_Rect) { x: (s->screen.x - msg_srf->w) / 2,
 	                       y: s->screen.y - msg_srf->h,
 			       w: msg_srf->w,
 			       h: msg_srf->h };
-	SDL_FreeSurface(msg_srf);
 
 	json_t *pos = json_object_get(o, "text-pos");
-	mi->line = (SDL_Rect) { x: json_integer_value(json_array_get(pos, 0)),
+	mg->line = (SDL_Rect) { x: json_integer_value(json_array_get(pos, 0)),
 	                        y: json_integer_value(json_array_get(pos, 1)),
 				h: fontsize };
-	mi->timeout = json_integer_value(json_object_get(o, "timeout"));
 
 	o = json_object_get(game, "messages");
-	int k = json_array_size(o);
-	mi->n = k;
-	message *ms = malloc(sizeof(message) * k);
-	mi->msgs = ms;
+	mg->n = json_array_size(o);
+	mg->text = malloc(sizeof(message_text) * mg->n);
 
 	int i;
 	json_t *m;
 	json_array_foreach(o, i, m) {
-		ms[i] = (message) {
-			pos: { x: json_integer_value(json_array_get(m, 0)),
-		               y: json_integer_value(json_array_get(m, 1)) },
-		        when: streq(frq_names[MSG_ONCE], json_string_value(json_array_get(m, 2))) ?
-				MSG_ONCE : MSG_ALWAYS };
-
-		render_message(&ms[i], s->r, font, m, 3);
+		render_message(&mg->text[i], s->r, font, m, 3);
 	}
 
 	return SDL_TRUE;
 }
 
-static int load_collisions(level *level, json_t const *o)
-{
-	json_t *lines_o = json_object_get(o, "collision-lines");
-
-	int k = json_array_size(lines_o);
-	level->vertical = malloc(sizeof(line) * k);
-	level->horizontal = malloc(sizeof(line) * k);
-	level->nvertical = 0;
-	level->nhorizontal = 0;
-
-	int i;
-	json_t *l;
-	json_array_foreach(lines_o, i, l) {
-		if (json_array_size(l) != 4) {
-			puts("incomplete line");
-			continue;
-		}
-		int ax, ay, bx, by;
-		ax = json_integer_value(json_array_get(l, 0));
-		ay = json_integer_value(json_array_get(l, 1));
-		bx = json_integer_value(json_array_get(l, 2));
-		by = json_integer_value(json_array_get(l, 3));
-
-		if (ax == bx) {
-			level->vertical[level->nvertical] = (line) { ax, ay, by };
-			level->nvertical += 1;
-		} else if (ay == by) {
-			level->horizontal[level->nhorizontal] = (line) { ay, ax, bx };
-			level->nhorizontal += 1;
-		} else {
-			fprintf(stderr, "Warning: Ignoring diagonal line %d %d - %d %d\n",
-					ax, ay, bx, by);
-		}
-	}
-
-	/* sort by p component */
-	qsort(level->vertical, level->nvertical, sizeof(line), cmp_lines);
-	qsort(level->horizontal, level->nhorizontal, sizeof(line), cmp_lines);
-
-	return k;
-}
-
-static SDL_Surface *load_asset_surf(json_t *a, char const *root, char const *k)
-{
-	char const *f, *p;
-
-	f = get_asset(a, k);
-	if (!f) { return 0; }
-
-	p = set_path("%s/%s/%s", root, ASSET_DIR, f);
-
-	return IMG_Load(p);
-}
-
-static void render_message(message *ms, SDL_Renderer *r, TTF_Font *font, json_t *m, unsigned offset)
+static void render_message(message_text *ms, SDL_Renderer *r, TTF_Font *font, json_t *m, unsigned offset)
 {
 	SDL_Surface *text;
 	SDL_Color col = {0, 0, 0, 255};
@@ -999,6 +980,28 @@ static void render_message(message *ms, SDL_Renderer *r, TTF_Font *font, json_t
 	}
 }
 
+static void destroy_message(message_text *ms)
+{
+	int j;
+	for (j = 0; j < MSG_LINES; j++) {
+		if (ms->lines[j].tex) { SDL_DestroyTexture(ms->lines[j].tex); }
+		ms->lines[j].tex = 0;
+	}
+}
+
+static void destroy_messages(msg_gfx *m)
+{
+	int i;
+	for (i = 0; i < m->n; i++) {
+		destroy_message(&m->text[i]);
+	}
+	destroy_message(&m->win);
+	destroy_message(&m->loss);
+	if (m->tex) { SDL_DestroyTexture(m->tex); }
+	free(m->text);
+	*m = (msg_gfx) { 0 };
+}
+
 #if 0
 static void print_hit(enum hit h)
 {
@@ -0,0 +1,441 @@
+#include "core.h"
+
+static void update_broadphase(game_state *gs);
+static int entity_id(game_state const *gs, enum group g, int i);
+static enum group id_entity(game_state const *gs, int id, int *i);
+static bool within(rect const *a, rect const *b, int d);
+static uint32_t triggers_in(world const *w, rect const *r, int const *near, int n);
+static void touch(game_state *gs, entity_state *pl, rect const *r, int const *other, rect const *box, int n);
+
+/* how many candidates go into one hit test */
+#define HIT_BATCH 32
+
+/* high level game */
+void update_gamestate(world *w, game_state *gs, game_event const *ev)
+{
+	if (gs->run == MODE_LOGO) {
+
+		gs->clock += 1;
+
+		if (anim_pos(&gs->logo, gs->clock) == gs->logo.rule->anim[ST_IDLE].len - 1 ||
+		    ev->keyboard) {
+			gs->run = MODE_INTRO;
+			gs->clock = 0;
+		}
+	}
+
+	if (gs->run == MODE_INTRO) {
+
+		gs->clock += 1;
+
+		if (ev->keyboard) {
+			gs->run = MODE_GAME;
+			gs->clock = 0;
+		}
+	}
+
+	if (gs->run != MODE_GAME) {
+		return;
+	}
+
+	if (ev->toggle_debug) {
+		gs->debug.active = !gs->debug.active;
+		set_group_state(&gs->entities[GROUP_ENEMIES], gs->debug.pause && gs->debug.active ? ST_IDLE : ST_WALK, gs->clock);
+	}
+
+	if (ev->toggle_pause && gs->debug.active) {
+		gs->debug.pause = !gs->debug.pause;
+		set_group_state(&gs->entities[GROUP_ENEMIES], gs->debug.pause ? ST_IDLE : ST_WALK, gs->clock);
+	}
+
+	if (ev->toggle_terrain && gs->debug.active) {
+		gs->debug.show_terrain_collision = !gs->debug.show_terrain_collision;
+	}
+
+	int i;
+	enum group g;
+	gs->clock += 1;
+
+	group *players = &gs->entities[GROUP_PLAYER];
+	entity_state pl;
+	group_get(players, 0, &pl);
+
+	if (!gs->debug.active || !gs->debug.pause) {
+		enemy_movement(&w->level, &gs->entities[GROUP_ENEMIES], &players->box[0]);
+	}
+
+	enum state old_state = pl.st;
+	move_log log;
+	move_entity(&pl, &ev->player, &w->level, &log);
+
+	if (old_state != pl.st) {
+		/* print_state
+		printf("%s -> %s\n", st_names[old_state], st_names[pl.st]);
+		*/
+		load_state(&pl, gs->clock);
+	}
+
+	if (ev->reset) {
+		init_entity_state(&pl, 0, ST_IDLE, gs->clock);
+	}
+	group_put(players, 0, &pl);
+
+	if (gs->msg_timeout > 0) {
+		gs->msg_timeout -= 1;
+	} else {
+		gs->msg = 0;
+	}
+	rect r = players->box[0];
+
+	/* the batches of triggers and boxes the player is tested against */
+	int const *near;
+	int k, j, n = near_triggers(w, &r, &near);
+	uint32_t hit;
+	for (k = 0; k < n; k += HIT_BATCH) {
+		int nb = n - k < HIT_BATCH ? n - k : HIT_BATCH;
+		hit = triggers_in(w, &r, near + k, nb);
+		for (j = 0; j < nb; j++) {
+			trigger const *t = &w->triggers.t[near[k + j]];
+			if (!(hit >> j & 1) || t->kind != TRIGGER_MESSAGE) {
+				continue;
+			}
+
+			message *m = &w->msg.msgs[t->i];
+			if (m->when == MSG_NEVER) {
+				continue;
+			}
+
+			gs->msg = m;
+			gs->msg_timeout = w->msg.timeout;
+			if (m->when == MSG_ONCE) {
+				m->when = MSG_NEVER;
+			}
+		}
+	}
+
+	/* what the player touches, from the pairs of the broadphase */
+	update_broadphase(gs);
+	n = bp_collide(&gs->bp);
+	int player = entity_id(gs, GROUP_PLAYER, 0);
+	int other[HIT_BATCH];
+	rect box[HIT_BATCH];
+	int nc = 0;
+	for (k = 0; k < n; k++) {
+		bp_pair const *p = &gs->bp.pairs[k];
+		if (p->a != player && p->b != player) {
+			continue;
+		}
+
+		other[nc] = p->a == player ? p->b : p->a;
+		g = id_entity(gs, other[nc], &i);
+		box[nc++] = gs->entities[g].box[i];
+		if (nc == HIT_BATCH) {
+			touch(gs, &pl, &r, other, box, nc);
+			nc = 0;
+		}
+	}
+	touch(gs, &pl, &r, other, box, nc);
+
+	r = players->box[0];
+	n = near_triggers(w, &r, &near);
+	for (k = 0; k < n; k += HIT_BATCH) {
+		int nb = n - k < HIT_BATCH ? n - k : HIT_BATCH;
+		hit = triggers_in(w, &r, near + k, nb);
+		for (j = 0; j < nb; j++) {
+			trigger const *t = &w->triggers.t[near[k + j]];
+			if (!(hit >> j & 1) || t->kind != TRIGGER_FINISH) {
+				continue;
+			}
+
+			if (gs->need_to_collect <= 0) {
+				gs->msg = &w->finish.win;
+			} else {
+				gs->msg = &w->finish.loss;
+			}
+		}
+	}
+
+	if (ev->exit) {
+		gs->run = MODE_EXIT;
+	}
+}
+
+/* entity groups */
+/* room for n entities out of mem, which frees it */
+void alloc_group(group *g, arena *mem, int n)
+{
+	g->n = n;
+	g->active = arena_alloc(mem, sizeof(bool) * n);
+	g->pos = arena_alloc(mem, sizeof(point) * n);
+	g->box = arena_alloc(mem, sizeof(rect) * n);
+	g->motion = arena_alloc(mem, sizeof(entity_motion) * n);
+	g->anim = arena_alloc(mem, sizeof(animation_state) * n);
+	g->hitbox = arena_alloc(mem, sizeof(rect) * n);
+	g->spawn = arena_alloc(mem, sizeof(rect) * n);
+	g->rule = arena_alloc(mem, sizeof(entity_rule const *) * n);
+}
+
+void group_get(group const *g, int i, entity_state *e)
+{
+	entity_motion const *m = &g->motion[i];
+	*e = (entity_state) {
+		active: g->active[i],
+		pos: g->pos[i],
+		hitbox: g->hitbox[i],
+		spawn: g->spawn[i],
+		dir: m->dir,
+		st: m->st,
+		jump_timeout: m->jump_timeout,
+		jump_type: m->jump_type,
+		fall_time: m->fall_time,
+		anim: g->anim[i],
+		rule: g->rule[i] };
+}
+
+void group_put(group *g, int i, entity_state const *e)
+{
+	g->active[i] = e->active;
+	g->pos[i] = e->pos;
+	g->hitbox[i] = e->hitbox;
+	g->spawn[i] = e->spawn;
+	g->motion[i] = (entity_motion) {
+		st: e->st,
+		dir: e->dir,
+		jump_timeout: e->jump_timeout,
+		jump_type: e->jump_type,
+		fall_time: e->fall_time };
+	g->anim[i] = e->anim;
+	g->rule[i] = e->rule;
+	entity_hitbox(e, &g->box[i]);
+}
+
+void set_group_state(group *g, enum state st, unsigned now)
+{
+	int i;
+	entity_state e;
+	for (i = 0; i < g->n; i++) {
+		group_get(g, i, &e);
+		e.st = st;
+		load_state(&e, now);
+		group_put(g, i, &e);
+	}
+}
+
+/* Moves the enemies near the player.  The rest keep their state untouched
+ * until the player comes within reach again, which depends only on the
+ * game state, so replays stay deterministic. */
+void enemy_movement(level const *terrain, group *nmi, rect const *player)
+{
+	entity_state es[HIT_BATCH];
+	entity_event order[HIT_BATCH];
+	bool track[HIT_BATCH];
+	rect probe[HIT_BATCH];
+	enum hit hit[HIT_BATCH];
+	int idx[HIT_BATCH];
+	int i, k, n;
+
+	/* Enemies only look at the player and the terrain, never at each
+	 * other, so the boxes they would walk into can be tested against the
+	 * terrain a batch at a time before any of them moves. */
+	for (i = 0; i < nmi->n; ) {
+		for (n = 0; n < HIT_BATCH && i < nmi->n; i++) {
+			rect h = nmi->box[i];
+			if (terrain->active_radius > 0 && !within(&h, player, terrain->active_radius)) {
+				continue;
+			}
+
+			entity_state *e = &es[n];
+			group_get(nmi, i, e);
+
+			clear_order(&order[n]);
+			track[n] = false;
+			if (between(player->y, h.y, h.y + h.h) || between(h.y, player->y, player->y + player->h)) {
+				e->dir = (e->pos.x < player->x) ? DIR_RIGHT : DIR_LEFT;
+				track[n] = true;
+			}
+			if (between(player->x, h.x, h.x + h.w) && e->pos.y > player->y) {
+				order[n].move_jump = true;
+				track[n] = true;
+			}
+			h.x += e->dir * e->rule->walk_dist;
+			probe[n] = h;
+			idx[n] = i;
+			n++;
+		}
+
+		collides_with_terrain_batch(probe, n, terrain, hit);
+
+		for (k = 0; k < n; k++) {
+			entity_state *e = &es[k];
+			if (hit[k] == HIT_NONE && (!e->rule->has_gravity || stands_on_terrain(&probe[k], terrain))) {
+				order[k].walk = true;
+			}
+			move_log log;
+			move_entity(e, &order[k], terrain, &log);
+			if (!track[k] && !order[k].walk) {
+				e->dir *= -1;
+			}
+			group_put(nmi, idx[k], e);
+		}
+	}
+}
+
+void clear_game(game_state *gs)
+{
+	gs->msg = 0;
+	gs->msg_timeout = 0;
+	gs->clock = 0;
+	gs->bp = (broadphase) { n: 0 };
+
+	gs->need_to_collect = gs->entities[GROUP_OBJECTS].n;
+	clear_debug(&gs->debug);
+}
+
+void clear_event(game_event *ev)
+{
+	clear_order(&ev->player);
+	ev->exit = false;
+	ev->toggle_debug = false;
+	ev->toggle_pause = false;
+	ev->toggle_terrain = false;
+	ev->reload_conf = false;
+	ev->keyboard = false;
+	ev->reset = false;
+}
+
+/* teardown; the messages, triggers and groups go with the arena of the
+ * config they were loaded from */
+void destroy_world(world *w)
+{
+	destroy_level(&w->level);
+}
+
+void destroy_game(game_state *gs)
+{
+	int i;
+	for (i = 0; i < NGROUPS; i++) {
+		gs->entities[i] = (group) { n: 0 };
+	}
+	bp_destroy(&gs->bp);
+}
+
+/* collisions */
+bool in_rect(point const *p, rect const *r)
+{
+	return between(p->x, r->x, r->x + r->w) &&
+	       between(p->y, r->y, r->y + r->h);
+}
+
+bool have_collision(rect const *r1, rect const *r2)
+{
+	int lf1 = r1->x;
+	int rt1 = lf1 + r1->w;
+	int tp1 = r1->y;
+	int bt1 = tp1 + r1->h;
+
+	int lf2 = r2->x;
+	int rt2 = lf2 + r2->w;
+	int tp2 = r2->y;
+	int bt2 = tp2 + r2->h;
+
+	return (between(lf1, lf2, rt2) || between(rt1, lf2, rt2) || between(lf2, lf1, rt1) || between(rt2, lf1, rt1)) &&
+	       (between(tp1, tp2, bt2) || between(bt1, tp2, bt2) || between(tp2, tp1, bt1) || between(bt2, tp1, bt1));
+}
+
+/* whether a comes within d of b on both axes */
+static bool within(rect const *a, rect const *b, int d)
+{
+	rect near = { x: b->x - d, y: b->y - d, w: b->w + 2 * d, h: b->h + 2 * d };
+	return have_collision(a, &near);
+}
+
+/* which of the triggers near[0..n) lie in r, n at most HIT_BATCH */
+static uint32_t triggers_in(world const *w, rect const *r, int const *near, int n)
+{
+	point pts[HIT_BATCH];
+	int i;
+	for (i = 0; i < n; i++) {
+		pts[i] = w->triggers.t[near[i]].pos;
+	}
+
+	uint32_t hit = 0;
+	points_hit(r, pts, n, &hit);
+	return hit;
+}
+
+/* Collects the objects and suffers the enemies among the n entities, by
+ * id, whose boxes touch the player's box r. */
+static void touch(game_state *gs, entity_state *pl, rect const *r, int const *other, rect const *box, int n)
+{
+	uint32_t hit = 0;
+	boxes_hit(r, box, n, &hit);
+
+	int k, i;
+	for (k = 0; k < n; k++) {
+		if (!(hit >> k & 1)) {
+			continue;
+		}
+
+		enum group g = id_entity(gs, other[k], &i);
+		switch (g) {
+		case GROUP_OBJECTS:
+			gs->entities[g].active[i] = false;
+			gs->need_to_collect -= 1;
+			break;
+		case GROUP_ENEMIES:
+			init_entity_state(pl, 0, ST_IDLE, gs->clock);
+			group_put(&gs->entities[GROUP_PLAYER], 0, pl);
+			break;
+		case GROUP_PLAYER:
+			break;
+		case NGROUPS:
+			fprintf(stderr, "line %d: can never happen\n", __LINE__);
+		}
+	}
+}
+
+/* broadphase */
+
+/* Puts the hitboxes of the active entities in the broadphase.  Entities
+ * are numbered group after group, and the broadphase starts over when the
+ * groups change size. */
+static void update_broadphase(game_state *gs)
+{
+	int n = entity_id(gs, NGROUPS, 0);
+	if (gs->bp.n != n) {
+		bp_resize(&gs->bp, n);
+	}
+
+	enum group g;
+	int i, id = 0;
+	for (g = 0; g < NGROUPS; g++) {
+		for (i = 0; i < gs->entities[g].n; i++, id++) {
+			if (gs->entities[g].active[i]) {
+				bp_set(&gs->bp, id, &gs->entities[g].box[i]);
+			} else {
+				bp_remove(&gs->bp, id);
+			}
+		}
+	}
+}
+
+static int entity_id(game_state const *gs, enum group g, int i)
+{
+	enum group k;
+	for (k = 0; k < g; k++) {
+		i += gs->entities[k].n;
+	}
+
+	return i;
+}
+
+static enum group id_entity(game_state const *gs, int id, int *i)
+{
+	enum group g;
+	for (g = 0; g < NGROUPS - 1 && id >= (int) gs->entities[g].n; g++) {
+		id -= gs->entities[g].n;
+	}
+	*i = id;
+
+	return g;
+}
@@ -0,0 +1,397 @@
+#include "core.h"
+
+/* Tests of one box against many, a bit per candidate.  They give the same
+ * answers as have_collision and in_rect for boxes of non-negative size,
+ * which is what hitboxes are.  On x86 the candidates are tested four at a
+ * time with SSE2 or eight at a time with AVX2, whichever the CPU has; the
+ * choice is made on the first call.  The same goes for the terrain lines
+ * of a level, kept as columns by index_level, against one box. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HIT_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*boxes_fn)(rect const *q, rect const *r, int n, uint32_t *mask);
+typedef void (*points_fn)(rect const *q, point const *p, int n, uint32_t *mask);
+typedef int (*lines_fn)(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h);
+
+static void boxes_scalar(rect const *q, rect const *r, int n, uint32_t *mask);
+static void points_scalar(rect const *q, point const *p, int n, uint32_t *mask);
+static int lines_scalar(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h);
+static void pick_kernels(void);
+
+static boxes_fn boxes_impl;
+static points_fn points_impl;
+static lines_fn lines_impl;
+
+void boxes_hit(rect const *q, rect const *r, int n, uint32_t *mask)
+{
+	if (!boxes_impl) { pick_kernels(); }
+	boxes_impl(q, r, n, mask);
+}
+
+void points_hit(rect const *q, point const *p, int n, uint32_t *mask)
+{
+	if (!points_impl) { pick_kernels(); }
+	points_impl(q, p, n, mask);
+}
+
+/* The first of the lines i..end-1 that r touches, end if none does, with
+ * what it says in h: the same as intersects_x (horizontal lines) or
+ * intersects_y (vertical) in core.c.  Runs too short to fill a vector are
+ * not worth the kernel's setup. */
+int lines_hit(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h)
+{
+	if (end - i < 4) { return lines_scalar(l, i, end, r, vertical, h); }
+	if (!lines_impl) { pick_kernels(); }
+	return lines_impl(l, i, end, r, vertical, h);
+}
+
+/* the tail that does not fill a vector, starting at i */
+static void boxes_scalar_from(rect const *q, rect const *r, int i, int n, uint32_t *mask)
+{
+	int qx1 = q->x + q->w;
+	int qy1 = q->y + q->h;
+	for (; i < n; i++) {
+		if (q->x <= r[i].x + r[i].w && r[i].x <= qx1 &&
+		    q->y <= r[i].y + r[i].h && r[i].y <= qy1) {
+			mask[i / 32] |= 1u << i % 32;
+		}
+	}
+}
+
+static void points_scalar_from(rect const *q, point const *p, int i, int n, uint32_t *mask)
+{
+	int qx1 = q->x + q->w;
+	int qy1 = q->y + q->h;
+	for (; i < n; i++) {
+		if (q->x <= p[i].x && p[i].x <= qx1 && q->y <= p[i].y && p[i].y <= qy1) {
+			mask[i / 32] |= 1u << i % 32;
+		}
+	}
+}
+
+static int lines_scalar(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h)
+{
+	int rx1 = r->x;
+	int rxm = r->x + r->w / 2;
+	int rx2 = r->x + r->w;
+	int ry1 = r->y;
+	int ry2 = r->y + r->h;
+
+	for (; i < end; i++) {
+		int p = l->p[i], a = l->a[i], b = l->b[i];
+		*h = HIT_NONE;
+		if (!vertical) {
+			if (!between(p, ry1, ry2)) { continue; }
+			if (between(rx1, a, b) || between(rxm, a, b) || between(a, rx1, rxm) || between(b, rx1, rxm)) {
+				*h = HIT_LEFT;
+			} else if (between(rxm, a, b) || between(rx2, a, b) || between(a, rx1, rx2) || between(b, rx1, rx2)) {
+				*h = HIT_RIGHT;
+			}
+		} else {
+			bool span = between(ry1, a, b) || between(ry2, a, b) || between(a, ry1, ry2) || between(b, ry1, ry2);
+			if (span && between(p, rx1, rxm)) {
+				*h = HIT_LEFT;
+			} else if (span && between(p, rxm, rx2)) {
+				*h = HIT_RIGHT;
+			}
+		}
+		if (*h != HIT_NONE) { return i; }
+	}
+
+	*h = HIT_NONE;
+	return end;
+}
+
+static void clear_mask(int n, uint32_t *mask)
+{
+	memset(mask, 0, sizeof(uint32_t) * ((n + 31) / 32));
+}
+
+static void boxes_scalar(rect const *q, rect const *r, int n, uint32_t *mask)
+{
+	clear_mask(n, mask);
+	boxes_scalar_from(q, r, 0, n, mask);
+}
+
+static void points_scalar(rect const *q, point const *p, int n, uint32_t *mask)
+{
+	clear_mask(n, mask);
+	points_scalar_from(q, p, 0, n, mask);
+}
+
+#ifdef HIT_X86
+/* A miss is any of x0 > qx1, qx0 > x1, y0 > qy1, qy0 > y1; the four lanes
+ * of x, y, w, h hold four boxes. */
+__attribute__((target("sse2")))
+static int miss4(__m128i x, __m128i y, __m128i x1, __m128i y1,
+		 __m128i qx0, __m128i qy0, __m128i qx1, __m128i qy1)
+{
+	__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(x, qx1), _mm_cmpgt_epi32(qx0, x1)),
+				 _mm_or_si128(_mm_cmpgt_epi32(y, qy1), _mm_cmpgt_epi32(qy0, y1)));
+	return _mm_movemask_ps(_mm_castsi128_ps(m));
+}
+
+__attribute__((target("sse2")))
+static void boxes_sse2(rect const *q, rect const *r, int n, uint32_t *mask)
+{
+	__m128i qx0 = _mm_set1_epi32(q->x);
+	__m128i qy0 = _mm_set1_epi32(q->y);
+	__m128i qx1 = _mm_set1_epi32(q->x + q->w);
+	__m128i qy1 = _mm_set1_epi32(q->y + q->h);
+
+	clear_mask(n, mask);
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		/* four boxes of x, y, w, h each, turned into x, y, w, h of four */
+		__m128i a = _mm_loadu_si128((__m128i const *) &r[i]);
+		__m128i b = _mm_loadu_si128((__m128i const *) &r[i + 1]);
+		__m128i c = _mm_loadu_si128((__m128i const *) &r[i + 2]);
+		__m128i d = _mm_loadu_si128((__m128i const *) &r[i + 3]);
+		__m128i ab0 = _mm_unpacklo_epi32(a, b);
+		__m128i ab1 = _mm_unpackhi_epi32(a, b);
+		__m128i cd0 = _mm_unpacklo_epi32(c, d);
+		__m128i cd1 = _mm_unpackhi_epi32(c, d);
+		__m128i x = _mm_unpacklo_epi64(ab0, cd0);
+		__m128i y = _mm_unpackhi_epi64(ab0, cd0);
+		__m128i w = _mm_unpacklo_epi64(ab1, cd1);
+		__m128i h = _mm_unpackhi_epi64(ab1, cd1);
+
+		int m = miss4(x, y, _mm_add_epi32(x, w), _mm_add_epi32(y, h), qx0, qy0, qx1, qy1);
+		mask[i / 32] |= (uint32_t) (~m & 0xf) << i % 32;
+	}
+	boxes_scalar_from(q, r, i, n, mask);
+}
+
+__attribute__((target("sse2")))
+static void points_sse2(rect const *q, point const *p, int n, uint32_t *mask)
+{
+	__m128i qx0 = _mm_set1_epi32(q->x);
+	__m128i qy0 = _mm_set1_epi32(q->y);
+	__m128i qx1 = _mm_set1_epi32(q->x + q->w);
+	__m128i qy1 = _mm_set1_epi32(q->y + q->h);
+
+	clear_mask(n, mask);
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128((__m128i const *) &p[i]));
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128((__m128i const *) &p[i + 2]));
+		__m128i x = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i y = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		int m = miss4(x, y, x, y, qx0, qy0, qx1, qy1);
+		mask[i / 32] |= (uint32_t) (~m & 0xf) << i % 32;
+	}
+	points_scalar_from(q, p, i, n, mask);
+}
+
+/* lo <= x <= hi, lane by lane */
+__attribute__((target("sse2")))
+static __m128i between4(__m128i x, __m128i lo, __m128i hi)
+{
+	__m128i out = _mm_or_si128(_mm_cmpgt_epi32(lo, x), _mm_cmpgt_epi32(x, hi));
+	return _mm_xor_si128(out, _mm_cmpeq_epi32(x, x));
+}
+
+/* Four lines at a time: the lines touching the left and the right half of
+ * r make two masks, and the first line in either decides. */
+__attribute__((target("sse2")))
+static int lines_sse2(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h)
+{
+	__m128i rx1 = _mm_set1_epi32(r->x);
+	__m128i rxm = _mm_set1_epi32(r->x + r->w / 2);
+	__m128i rx2 = _mm_set1_epi32(r->x + r->w);
+	__m128i ry1 = _mm_set1_epi32(r->y);
+	__m128i ry2 = _mm_set1_epi32(r->y + r->h);
+
+	for (; i + 4 <= end; i += 4) {
+		__m128i p = _mm_loadu_si128((__m128i const *) &l->p[i]);
+		__m128i a = _mm_loadu_si128((__m128i const *) &l->a[i]);
+		__m128i b = _mm_loadu_si128((__m128i const *) &l->b[i]);
+		__m128i left, right;
+		if (!vertical) {
+			__m128i on = between4(p, ry1, ry2);
+			left = _mm_or_si128(_mm_or_si128(between4(rx1, a, b), between4(rxm, a, b)),
+					    _mm_or_si128(between4(a, rx1, rxm), between4(b, rx1, rxm)));
+			right = _mm_or_si128(_mm_or_si128(between4(rxm, a, b), between4(rx2, a, b)),
+					     _mm_or_si128(between4(a, rx1, rx2), between4(b, rx1, rx2)));
+			left = _mm_and_si128(left, on);
+			right = _mm_and_si128(right, on);
+		} else {
+			__m128i span = _mm_or_si128(_mm_or_si128(between4(ry1, a, b), between4(ry2, a, b)),
+						    _mm_or_si128(between4(a, ry1, ry2), between4(b, ry1, ry2)));
+			left = _mm_and_si128(span, between4(p, rx1, rxm));
+			right = _mm_and_si128(span, between4(p, rxm, rx2));
+		}
+
+		int ml = _mm_movemask_ps(_mm_castsi128_ps(left));
+		int mr = _mm_movemask_ps(_mm_castsi128_ps(right));
+		if (ml | mr) {
+			int first = __builtin_ctz(ml | mr);
+			*h = ml >> first & 1 ? HIT_LEFT : HIT_RIGHT;
+			return i + first;
+		}
+	}
+
+	return lines_scalar(l, i, end, r, vertical, h);
+}
+
+__attribute__((target("avx2")))
+static int miss8(__m256i x, __m256i y, __m256i x1, __m256i y1,
+		 __m256i qx0, __m256i qy0, __m256i qx1, __m256i qy1)
+{
+	__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(x, qx1), _mm256_cmpgt_epi32(qx0, x1)),
+				    _mm256_or_si256(_mm256_cmpgt_epi32(y, qy1), _mm256_cmpgt_epi32(qy0, y1)));
+	return _mm256_movemask_ps(_mm256_castsi256_ps(m));
+}
+
+__attribute__((target("avx2")))
+static void boxes_avx2(rect const *q, rect const *r, int n, uint32_t *mask)
+{
+	__m256i qx0 = _mm256_set1_epi32(q->x);
+	__m256i qy0 = _mm256_set1_epi32(q->y);
+	__m256i qx1 = _mm256_set1_epi32(q->x + q->w);
+	__m256i qy1 = _mm256_set1_epi32(q->y + q->h);
+	/* the unpacking below leaves the boxes in the order 0 2 4 6 1 3 5 7 */
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	clear_mask(n, mask);
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i a = _mm256_loadu_si256((__m256i const *) &r[i]);
+		__m256i b = _mm256_loadu_si256((__m256i const *) &r[i + 2]);
+		__m256i c = _mm256_loadu_si256((__m256i const *) &r[i + 4]);
+		__m256i d = _mm256_loadu_si256((__m256i const *) &r[i + 6]);
+		__m256i ab0 = _mm256_unpacklo_epi32(a, b);
+		__m256i ab1 = _mm256_unpackhi_epi32(a, b);
+		__m256i cd0 = _mm256_unpacklo_epi32(c, d);
+		__m256i cd1 = _mm256_unpackhi_epi32(c, d);
+		__m256i x = _mm256_unpacklo_epi64(ab0, cd0);
+		__m256i y = _mm256_unpackhi_epi64(ab0, cd0);
+		__m256i w = _mm256_unpacklo_epi64(ab1, cd1);
+		__m256i h = _mm256_unpackhi_epi64(ab1, cd1);
+
+		x = _mm256_permutevar8x32_epi32(x, order);
+		y = _mm256_permutevar8x32_epi32(y, order);
+		w = _mm256_permutevar8x32_epi32(w, order);
+		h = _mm256_permutevar8x32_epi32(h, order);
+
+		int m = miss8(x, y, _mm256_add_epi32(x, w), _mm256_add_epi32(y, h), qx0, qy0, qx1, qy1);
+		mask[i / 32] |= (uint32_t) (~m & 0xff) << i % 32;
+	}
+	/* the tail is left to code that may not clear the upper halves */
+	_mm256_zeroupper();
+	boxes_scalar_from(q, r, i, n, mask);
+}
+
+__attribute__((target("avx2")))
+static void points_avx2(rect const *q, point const *p, int n, uint32_t *mask)
+{
+	__m256i qx0 = _mm256_set1_epi32(q->x);
+	__m256i qy0 = _mm256_set1_epi32(q->y);
+	__m256i qx1 = _mm256_set1_epi32(q->x + q->w);
+	__m256i qy1 = _mm256_set1_epi32(q->y + q->h);
+
+	clear_mask(n, mask);
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((__m256i const *) &p[i]));
+		__m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((__m256i const *) &p[i + 4]));
+		/* per 128 bit lane, so the points come out as 0 1 4 5 2 3 6 7 */
+		__m256i x = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i y = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+		y = _mm256_permute4x64_epi64(y, _MM_SHUFFLE(3, 1, 2, 0));
+
+		int m = miss8(x, y, x, y, qx0, qy0, qx1, qy1);
+		mask[i / 32] |= (uint32_t) (~m & 0xff) << i % 32;
+	}
+	_mm256_zeroupper();
+	points_scalar_from(q, p, i, n, mask);
+}
+
+__attribute__((target("avx2")))
+static __m256i between8(__m256i x, __m256i lo, __m256i hi)
+{
+	__m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, x), _mm256_cmpgt_epi32(x, hi));
+	return _mm256_xor_si256(out, _mm256_cmpeq_epi32(x, x));
+}
+
+__attribute__((target("avx2")))
+static int lines_avx2(line_soa const *l, int i, int end, rect const *r, bool vertical, enum hit *h)
+{
+	__m256i rx1 = _mm256_set1_epi32(r->x);
+	__m256i rxm = _mm256_set1_epi32(r->x + r->w / 2);
+	__m256i rx2 = _mm256_set1_epi32(r->x + r->w);
+	__m256i ry1 = _mm256_set1_epi32(r->y);
+	__m256i ry2 = _mm256_set1_epi32(r->y + r->h);
+
+	for (; i + 8 <= end; i += 8) {
+		__m256i p = _mm256_loadu_si256((__m256i const *) &l->p[i]);
+		__m256i a = _mm256_loadu_si256((__m256i const *) &l->a[i]);
+		__m256i b = _mm256_loadu_si256((__m256i const *) &l->b[i]);
+		__m256i left, right;
+		if (!vertical) {
+			__m256i on = between8(p, ry1, ry2);
+			left = _mm256_or_si256(_mm256_or_si256(between8(rx1, a, b), between8(rxm, a, b)),
+					       _mm256_or_si256(between8(a, rx1, rxm), between8(b, rx1, rxm)));
+			right = _mm256_or_si256(_mm256_or_si256(between8(rxm, a, b), between8(rx2, a, b)),
+						_mm256_or_si256(between8(a, rx1, rx2), between8(b, rx1, rx2)));
+			left = _mm256_and_si256(left, on);
+			right = _mm256_and_si256(right, on);
+		} else {
+			__m256i span = _mm256_or_si256(_mm256_or_si256(between8(ry1, a, b), between8(ry2, a, b)),
+						       _mm256_or_si256(between8(a, ry1, ry2), between8(b, ry1, ry2)));
+			left = _mm256_and_si256(span, between8(p, rx1, rxm));
+			right = _mm256_and_si256(span, between8(p, rxm, rx2));
+		}
+
+		int ml = _mm256_movemask_ps(_mm256_castsi256_ps(left));
+		int mr = _mm256_movemask_ps(_mm256_castsi256_ps(right));
+		if (ml | mr) {
+			int first = __builtin_ctz(ml | mr);
+			*h = ml >> first & 1 ? HIT_LEFT : HIT_RIGHT;
+			return i + first;
+		}
+	}
+
+	_mm256_zeroupper();
+	return lines_sse2(l, i, end, r, vertical, h);
+}
+#endif
+
+static void pick_kernels(void)
+{
+	boxes_impl = boxes_scalar;
+	points_impl = points_scalar;
+	lines_impl = lines_scalar;
+
+#ifdef HIT_X86
+	__builtin_cpu_init();
+	if (getenv("FRIDGE_NO_SIMD")) {
+		return;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		boxes_impl = boxes_avx2;
+		points_impl = points_avx2;
+		lines_impl = lines_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		boxes_impl = boxes_sse2;
+		points_impl = points_sse2;
+		lines_impl = lines_sse2;
+	}
+#endif
+}
+
+/* which kernels the CPU gets, for reports */
+char const *hit_kernels(void)
+{
+	if (!boxes_impl) { pick_kernels(); }
+#ifdef HIT_X86
+	if (boxes_impl == boxes_avx2) { return "avx2"; }
+	if (boxes_impl == boxes_sse2) { return "sse2"; }
+#endif
+	return "scalar";
+}
@@ -0,0 +1,500 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "replay.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool write_header(replay_writer *w);
+static bool flush_run(replay_writer *w);
+static bool map_file(replay *r, FILE *fd);
+static bool check_replay(replay const *r);
+
+/* events */
+uint16_t event_to_mask(game_event const *e)
+{
+	uint16_t m = 0;
+
+	if (e->player.walk)       { m |= EV_WALK; }
+	if (e->player.move_left)  { m |= EV_LEFT; }
+	if (e->player.move_right) { m |= EV_RIGHT; }
+	if (e->player.move_jump)  { m |= EV_JUMP; }
+
+	if (e->toggle_pause)   { m |= EV_PAUSE; }
+	if (e->toggle_debug)   { m |= EV_DEBUG; }
+	if (e->toggle_terrain) { m |= EV_TERRAIN; }
+	if (e->reload_conf)    { m |= EV_CONF; }
+	if (e->exit)           { m |= EV_EXIT; }
+	if (e->keyboard)       { m |= EV_KEYBOARD; }
+	if (e->reset)          { m |= EV_RESET; }
+
+	return m;
+}
+
+void mask_to_event(uint16_t m, game_event *e)
+{
+	e->player.walk       = m & EV_WALK;
+	e->player.move_left  = m & EV_LEFT;
+	e->player.move_right = m & EV_RIGHT;
+	e->player.move_jump  = m & EV_JUMP;
+
+	e->toggle_pause   = m & EV_PAUSE;
+	e->toggle_debug   = m & EV_DEBUG;
+	e->toggle_terrain = m & EV_TERRAIN;
+	e->reload_conf    = m & EV_CONF;
+	e->exit           = m & EV_EXIT;
+	e->keyboard       = m & EV_KEYBOARD;
+	e->reset          = m & EV_RESET;
+}
+
+/* recording */
+bool replay_create(replay_writer *w, FILE *fd)
+{
+	*w = (replay_writer) { fd: fd };
+
+	/* the real header is written by replay_finish, once the counts are
+	 * known */
+	return write_header(w);
+}
+
+bool replay_record(replay_writer *w, game_event const *e)
+{
+	uint16_t m = event_to_mask(e);
+
+	if (w->cur.count == 0 || w->cur.mask != m || w->cur.count == UINT16_MAX) {
+		if (!flush_run(w)) { return false; }
+		w->cur = (replay_run) { mask: m, count: 0 };
+		w->cur_start = w->ticks;
+	}
+
+	if (m & EV_CONF) {
+		replay_reloaded(w);
+	}
+
+	if (w->ticks % REPLAY_STRIDE == 0) {
+		if (w->nindex == w->index_cap) {
+			w->index_cap = w->index_cap ? 2 * w->index_cap : 64;
+			w->index = realloc(w->index, sizeof(replay_index) * w->index_cap);
+		}
+		w->index[w->nindex] = (replay_index) { run: w->nruns, start: w->cur_start };
+		w->nindex += 1;
+	}
+
+	w->cur.count += 1;
+	w->ticks += 1;
+
+	return true;
+}
+
+bool replay_finish(replay_writer *w)
+{
+	bool ok = flush_run(w);
+
+	ok = ok && fwrite(w->index, sizeof(replay_index), w->nindex, w->fd) == w->nindex;
+	ok = ok && fwrite(w->keys, w->key_size, w->nkeys, w->fd) == w->nkeys;
+	if (w->nhashes != (w->reloaded ? w->reload_tick : w->ticks)) {
+		/* hashes were not taken for every tick, they are of no use */
+		w->nhashes = 0;
+	}
+	ok = ok && fwrite(w->hashes, sizeof(uint32_t), w->nhashes, w->fd) == w->nhashes;
+	ok = ok && fseek(w->fd, 0, SEEK_SET) == 0;
+	ok = ok && write_header(w);
+	ok = ok && fflush(w->fd) == 0;
+
+	free(w->index);
+	free(w->keys);
+	free(w->hashes);
+	w->index = 0;
+	w->keys = 0;
+	w->hashes = 0;
+
+	if (!ok) {
+		fprintf(stderr, "error: could not write replay\n");
+	}
+
+	return ok;
+}
+
+/* Notes that the config was reloaded before the tick about to be recorded.
+ * What follows depends on files the replay does not carry, so no more
+ * keyframes or hashes are taken. */
+void replay_reloaded(replay_writer *w)
+{
+	if (!w->reloaded) {
+		w->reloaded = true;
+		w->reload_tick = w->ticks;
+	}
+}
+
+/* Takes a keyframe if one is due before the next recorded tick.  Call it
+ * right before replay_record with the state the event will be applied to. */
+void replay_keyframe(replay_writer *w, world const *wd, game_state const *gs)
+{
+	if (w->reloaded || w->ticks % REPLAY_KEY_INTERVAL != 0 ||
+	    w->ticks / REPLAY_KEY_INTERVAL != w->nkeys) {
+		return;
+	}
+
+	if (w->nkeys == 0) {
+		w->key_size = snapshot_size(wd, gs);
+	} else if (snapshot_size(wd, gs) != w->key_size) {
+		/* a config reload changed what there is to save; keyframes are
+		 * all the same size, so the ones taken so far are the last, and
+		 * as the count now lags behind no later one comes due */
+		return;
+	}
+
+	if (w->nkeys == w->keys_cap) {
+		w->keys_cap = w->keys_cap ? 2 * w->keys_cap : 16;
+		w->keys = realloc(w->keys, (size_t) w->key_size * w->keys_cap);
+	}
+	snapshot_save(wd, gs, w->keys + (size_t) w->key_size * w->nkeys);
+	w->nkeys += 1;
+}
+
+/* Records the hash of the state the last recorded tick led to.  Call it
+ * right after that tick was simulated. */
+void replay_hash(replay_writer *w, world const *wd, game_state const *gs)
+{
+	if (w->reloaded || w->nhashes + 1 != w->ticks) {
+		return;
+	}
+
+	if (w->nhashes == w->hashes_cap) {
+		w->hashes_cap = w->hashes_cap ? 2 * w->hashes_cap : 1024;
+		w->hashes = realloc(w->hashes, sizeof(uint32_t) * w->hashes_cap);
+	}
+	w->hashes[w->nhashes] = snapshot_hash(wd, gs);
+	w->nhashes += 1;
+}
+
+/* playback */
+bool replay_open(replay *r, char const *file)
+{
+	FILE *fd = fopen(file, "rb");
+	if (!fd) {
+		fprintf(stderr, "error: could not open replay `%s'\n", file);
+		return false;
+	}
+
+	char magic[4];
+	bool binary = fread(magic, 1, 4, fd) == 4 && !memcmp(magic, REPLAY_MAGIC, 4);
+	rewind(fd);
+
+	if (!binary) {
+		/* an old text replay: convert it on the fly */
+		FILE *tmp = tmpfile();
+		if (!tmp || !replay_import(fd, tmp)) {
+			fprintf(stderr, "error: could not import text replay `%s'\n", file);
+			fclose(fd);
+			return false;
+		}
+		fclose(fd);
+		fd = tmp;
+	}
+
+	bool ok = map_file(r, fd);
+	fclose(fd);
+	if (!ok) {
+		fprintf(stderr, "error: could not read replay `%s'\n", file);
+		return false;
+	}
+
+	r->hdr = r->map;
+	r->runs = (replay_run const *) ((char const *) r->map + r->hdr->runs);
+	r->index = (replay_index const *) ((char const *) r->map + r->hdr->index);
+	r->keys = (unsigned char const *) r->map + r->hdr->keys;
+	r->hashes = (uint32_t const *) ((char const *) r->map + r->hdr->hashes);
+	if (!check_replay(r)) {
+		fprintf(stderr, "error: `%s' is not a valid replay\n", file);
+		replay_close(r);
+		return false;
+	}
+
+	r->tick = 0;
+	r->run = 0;
+	r->run_start = 0;
+
+	return true;
+}
+
+bool replay_next(replay *r, game_event *e)
+{
+	if (r->tick >= r->hdr->ticks) {
+		return false;
+	}
+
+	mask_to_event(r->runs[r->run].mask, e);
+	r->tick += 1;
+	if (r->tick - r->run_start >= r->runs[r->run].count) {
+		r->run_start += r->runs[r->run].count;
+		r->run += 1;
+	}
+
+	return true;
+}
+
+bool replay_seek(replay *r, uint32_t tick)
+{
+	if (tick > r->hdr->ticks) {
+		return false;
+	}
+
+	uint32_t i = tick / r->hdr->stride;
+	if (i >= r->hdr->nindex) {
+		i = r->hdr->nindex - 1;
+	}
+
+	r->run = r->hdr->nindex ? r->index[i].run : 0;
+	r->run_start = r->hdr->nindex ? r->index[i].start : 0;
+	while (r->run < r->hdr->nruns && r->run_start + r->runs[r->run].count <= tick) {
+		r->run_start += r->runs[r->run].count;
+		r->run += 1;
+	}
+	r->tick = tick;
+
+	return true;
+}
+
+/* Brings the game to the state right before `tick', restoring the closest
+ * keyframe when that saves simulating, and playing the events from there. */
+bool replay_jump(replay *r, world *w, game_state *gs, uint32_t tick)
+{
+	if (tick > r->hdr->ticks) {
+		tick = r->hdr->ticks;
+	}
+
+	if (r->hdr->nkeys > 0) {
+		uint32_t k = tick / r->hdr->key_interval;
+		if (k >= r->hdr->nkeys) {
+			k = r->hdr->nkeys - 1;
+		}
+
+		uint32_t key_tick = k * r->hdr->key_interval;
+		if (tick < r->tick || key_tick > r->tick) {
+			if (!snapshot_restore(w, gs, r->keys + (size_t) r->hdr->key_size * k,
+			                      r->hdr->key_size)) {
+				return false;
+			}
+			replay_seek(r, key_tick);
+		}
+	}
+
+	if (tick < r->tick) {
+		/* no keyframe to go back to */
+		return false;
+	}
+
+	game_event e;
+	while (r->tick < tick) {
+		clear_event(&e);
+		replay_next(r, &e);
+		update_gamestate(w, gs, &e);
+	}
+
+	return true;
+}
+
+/* Simulates the replay again, starting from w and gs, which must hold the
+ * state it was recorded from, and compares the outcome with the recorded
+ * hashes.  On a mismatch `tick' is set to the first tick that played out
+ * differently.  With keyframes only the keyframe ticks are hashed on the
+ * way and the interval where the hashes part is bisected afterwards,
+ * restoring from its keyframe, which is known to be good.  A replay that
+ * reloaded its config is only checked up to the reload. */
+bool replay_verify(replay *r, world *w, game_state *gs, uint32_t *tick)
+{
+	replay_header const *h = r->hdr;
+	if (h->nhashes == 0) {
+		fprintf(stderr, "error: the replay has no state hashes\n");
+		*tick = 0;
+		return false;
+	}
+
+	uint32_t step = h->nkeys > 0 ? h->key_interval : 1;
+	uint32_t good = 0;
+	game_event e;
+
+	replay_seek(r, 0);
+	while (r->tick < h->nhashes) {
+		clear_event(&e);
+		replay_next(r, &e);
+		update_gamestate(w, gs, &e);
+
+		if (r->tick % step != 0 && r->tick != h->nhashes) {
+			continue;
+		}
+		if (snapshot_hash(w, gs) == r->hashes[r->tick - 1]) {
+			good = r->tick;
+			continue;
+		}
+
+		uint32_t bad = r->tick;
+		while (bad - good > 1) {
+			uint32_t mid = good + (bad - good) / 2;
+			replay_jump(r, w, gs, mid);
+			if (snapshot_hash(w, gs) == r->hashes[mid - 1]) {
+				good = mid;
+			} else {
+				bad = mid;
+			}
+		}
+		*tick = bad - 1;
+		return false;
+	}
+
+	return true;
+}
+
+void replay_close(replay *r)
+{
+#ifndef _WIN32
+	munmap(r->map, r->size);
+#else
+	free(r->map);
+#endif
+	r->map = 0;
+}
+
+/* text replays */
+bool read_event(FILE *fd, game_event *e)
+{
+	char buf[MAX_PATH];
+	while (fgets(buf, MAX_PATH - 1, fd)) {
+	switch (*buf) {
+	case 'w': e->player.walk = true; break;
+	case 'l': e->player.move_left = true; break;
+	case 'r': e->player.move_right = true; break;
+	case 'j': e->player.move_jump = true; break;
+	case 'p': e->toggle_pause = true; break;
+	case 'd': e->toggle_debug = true; break;
+	case 'h': e->toggle_terrain = true; break;
+	case 'c': e->reload_conf = true; break;
+	case 'e': e->exit = true; break;
+	case 'k': e->keyboard = true; break;
+	case 's': e->reset = true; break;
+	case 't': return true;
+	default: break;
+	}
+	}
+
+	return false;
+}
+
+bool replay_import(FILE *txt, FILE *bin)
+{
+	replay_writer w;
+	game_event e;
+
+	if (!replay_create(&w, bin)) { return false; }
+
+	clear_event(&e);
+	while (read_event(txt, &e)) {
+		if (!replay_record(&w, &e)) { return false; }
+		clear_event(&e);
+	}
+
+	return replay_finish(&w);
+}
+
+/* low level */
+static bool write_header(replay_writer *w)
+{
+	replay_header h = {
+		version: REPLAY_VERSION,
+		stride: REPLAY_STRIDE,
+		ticks: w->ticks,
+		nruns: w->nruns,
+		runs: sizeof(replay_header),
+		nindex: w->nindex,
+		index: sizeof(replay_header) + sizeof(replay_run) * w->nruns,
+		key_interval: REPLAY_KEY_INTERVAL,
+		key_size: w->key_size,
+		nkeys: w->nkeys,
+		nhashes: w->nhashes };
+	h.keys = h.index + sizeof(replay_index) * w->nindex;
+	h.hashes = h.keys + w->key_size * w->nkeys;
+	memcpy(h.magic, REPLAY_MAGIC, 4);
+
+	return fwrite(&h, sizeof(replay_header), 1, w->fd) == 1;
+}
+
+static bool flush_run(replay_writer *w)
+{
+	if (w->cur.count == 0) { return true; }
+
+	w->nruns += 1;
+
+	return fwrite(&w->cur, sizeof(replay_run), 1, w->fd) == 1;
+}
+
+static bool map_file(replay *r, FILE *fd)
+{
+	if (fflush(fd) != 0 || fseek(fd, 0, SEEK_END) != 0) { return false; }
+	long n = ftell(fd);
+	if (n < (long) sizeof(replay_header)) { return false; }
+	r->size = n;
+
+#ifndef _WIN32
+	r->map = mmap(0, r->size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+	if (r->map == MAP_FAILED) {
+		r->map = 0;
+		return false;
+	}
+#else
+	r->map = malloc(r->size);
+	rewind(fd);
+	if (fread(r->map, 1, r->size, fd) != r->size) {
+		free(r->map);
+		r->map = 0;
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+static bool check_replay(replay const *r)
+{
+	replay_header const *h = r->hdr;
+	if (memcmp(h->magic, REPLAY_MAGIC, 4) || h->version != REPLAY_VERSION || h->stride == 0) {
+		return false;
+	}
+
+	if (h->runs + (size_t) h->nruns * sizeof(replay_run) > r->size ||
+	    h->index + (size_t) h->nindex * sizeof(replay_index) > r->size ||
+	    h->keys + (size_t) h->nkeys * h->key_size > r->size ||
+	    h->hashes + (size_t) h->nhashes * sizeof(uint32_t) > r->size) {
+		return false;
+	}
+
+	if (h->nhashes > h->ticks) {
+		return false;
+	}
+
+	if (h->nkeys > 0 && (h->key_interval == 0 || (h->nkeys - 1) * h->key_interval > h->ticks)) {
+		return false;
+	}
+
+	/* seeking trusts the index, so every entry has to name the run its
+	 * tick falls in and where that run starts; no run is empty */
+	uint64_t ticks = 0;
+	uint32_t i, k = 0;
+	for (i = 0; i < h->nruns; i++) {
+		if (r->runs[i].count == 0) {
+			return false;
+		}
+		ticks += r->runs[i].count;
+		for (; k < h->nindex && (uint64_t) k * h->stride < ticks; k++) {
+			if (r->index[k].run != i || r->index[k].start != ticks - r->runs[i].count) {
+				return false;
+			}
+		}
+	}
+
+	return ticks == h->ticks && k == h->nindex && h->nindex == (h->ticks + h->stride - 1) / h->stride;
+}
@@ -0,0 +1,128 @@
+#ifndef FRIDGE_REPLAY_H
+#define FRIDGE_REPLAY_H
+
+/* Binary replays: every tick's game_event is reduced to a bitmask, runs of
+ * identical masks are stored as (mask, count) pairs and a sparse index maps
+ * every REPLAY_STRIDE-th tick to its run, so playback can seek.  Recordings
+ * made with a running game also carry a snapshot of the game state every
+ * REPLAY_KEY_INTERVAL ticks, so seeking does not have to re-simulate from
+ * the start, and a hash of the state after every tick, so a replay can be
+ * checked against a changed engine.  The core cannot redo a config reload,
+ * so both stop at the first tick that reloads: hashes then cover only the
+ * ticks before it.  The file is little-endian and laid
+ * out so it can be mapped and read in place:
+ *
+ *   replay_header | replay_run[nruns] | replay_index[nindex] | keys |
+ *   uint32_t hashes[nhashes]
+ */
+
+#include <stdint.h>
+
+#include "core.h"
+
+#define REPLAY_MAGIC "FRPL"
+#define REPLAY_VERSION 4
+#define REPLAY_STRIDE 256
+#define REPLAY_KEY_INTERVAL 250
+
+enum event_bit {
+	EV_WALK     = 1 << 0,
+	EV_LEFT     = 1 << 1,
+	EV_RIGHT    = 1 << 2,
+	EV_JUMP     = 1 << 3,
+	EV_PAUSE    = 1 << 4,
+	EV_DEBUG    = 1 << 5,
+	EV_TERRAIN  = 1 << 6,
+	EV_CONF     = 1 << 7,
+	EV_EXIT     = 1 << 8,
+	EV_KEYBOARD = 1 << 9,
+	EV_RESET    = 1 << 10
+};
+
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t stride;
+	uint32_t ticks;
+	uint32_t nruns;
+	uint32_t runs;
+	uint32_t nindex;
+	uint32_t index;
+	uint32_t key_interval;
+	uint32_t key_size;
+	uint32_t nkeys;
+	uint32_t keys;
+	uint32_t nhashes;
+	uint32_t hashes;
+} replay_header;
+
+typedef struct {
+	uint16_t mask;
+	uint16_t count;
+} replay_run;
+
+typedef struct {
+	uint32_t run;
+	uint32_t start;
+} replay_index;
+
+typedef struct {
+	FILE *fd;
+	uint32_t ticks;
+	uint32_t nruns;
+	replay_run cur;
+	uint32_t cur_start;
+	replay_index *index;
+	uint32_t nindex;
+	uint32_t index_cap;
+	unsigned char *keys;
+	uint32_t key_size;
+	uint32_t nkeys;
+	uint32_t keys_cap;
+	uint32_t *hashes;
+	uint32_t nhashes;
+	uint32_t hashes_cap;
+	bool reloaded;
+	uint32_t reload_tick;
+} replay_writer;
+
+typedef struct {
+	void *map;
+	size_t size;
+	replay_header const *hdr;
+	replay_run const *runs;
+	replay_index const *index;
+	unsigned char const *keys;
+	uint32_t const *hashes;
+	uint32_t tick;
+	uint32_t run;
+	uint32_t run_start;
+} replay;
+
+/* events */
+uint16_t event_to_mask(game_event const *e);
+void mask_to_event(uint16_t m, game_event *e);
+
+/* recording */
+bool replay_create(replay_writer *w, FILE *fd);
+bool replay_record(replay_writer *w, game_event const *e);
+void replay_keyframe(replay_writer *w, world const *wd, game_state const *gs);
+void replay_hash(replay_writer *w, world const *wd, game_state const *gs);
+void replay_reloaded(replay_writer *w);
+bool replay_finish(replay_writer *w);
+
+/* playback */
+bool replay_open(replay *r, char const *file);
+bool replay_next(replay *r, game_event *e);
+bool replay_seek(replay *r, uint32_t tick);
+bool replay_jump(replay *r, world *w, game_state *gs, uint32_t tick);
+void replay_close(replay *r);
+
+/* verification */
+bool replay_verify(replay *r, world *w, game_state *gs, uint32_t *tick);
+
+/* text replays */
+bool read_event(FILE *fd, game_event *e);
+bool replay_import(FILE *txt, FILE *bin);
+
+#endif
@@ -0,0 +1,215 @@
+#include <time.h>
+
+#include "core.h"
+#include "bake.h"
+#include "replay.h"
+
+/* Runs a replay through the simulation core without opening a window, as
+ * fast as the machine allows. */
+
+#define ROOTVAR "FRIDGE_ROOT"
+#define GAME_CONF "game.json"
+
+/* the intros are never drawn here, only their length matters */
+static point const screen = { x: 640, y: 480 };
+
+static bool load_game(arena *mem, world *w, game_state *gs, char const *root);
+static void free_game(arena *mem, world *w, game_state *gs);
+static bool import(char const *txt, char const *bin);
+static bool verify(char const *root, int n, char **files);
+
+int main(int argc, char **argv)
+{
+	if (argc == 4 && streq(argv[1], "--import")) {
+		return import(argv[2], argv[3]) ? 0 : 1;
+	}
+
+	char const *root = getenv(ROOTVAR);
+	if (!root || !*root) {
+		fprintf(stderr, "error: environment undefined\n");
+		fprintf(stderr, "set %s to the installation directory of Fridge Filler\n", ROOTVAR);
+		return 1;
+	}
+
+	if (argc == 2 && streq(argv[1], "--bake")) {
+		return bake_build(root, GAME_CONF) ? 0 : 1;
+	}
+
+	if (argc >= 3 && streq(argv[1], "--verify")) {
+		return verify(root, argc - 2, argv + 2) ? 0 : 1;
+	}
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: %s REPLAY [TICK]\n", argv[0]);
+		fprintf(stderr, "       %s --verify REPLAY...\n", argv[0]);
+		fprintf(stderr, "       %s --import TEXT-REPLAY REPLAY\n", argv[0]);
+		fprintf(stderr, "       %s --bake\n", argv[0]);
+		return 1;
+	}
+
+	replay rp;
+	if (!replay_open(&rp, argv[1])) { return 1; }
+
+	arena mem;
+	world w;
+	game_state gs;
+	if (!load_game(&mem, &w, &gs, root)) { return 1; }
+
+	game_event ge;
+	clear_event(&ge);
+
+	unsigned ticks = 0;
+	clock_t start = clock();
+	if (argc == 3) {
+		/* jump straight to the requested tick */
+		if (!replay_jump(&rp, &w, &gs, strtoul(argv[2], 0, 10))) { return 1; }
+		ticks = rp.tick;
+	}
+	while (argc == 2 && gs.run != MODE_EXIT && replay_next(&rp, &ge)) {
+		update_gamestate(&w, &gs, &ge);
+		clear_event(&ge);
+		ticks += 1;
+	}
+	double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	entity_state p;
+	group_get(&gs.entities[GROUP_PLAYER], 0, &p);
+	printf("ticks: %u\n", ticks);
+	printf("player: %d %d %s\n", p.pos.x, p.pos.y, st_names[p.st]);
+	printf("left to collect: %d\n", gs.need_to_collect);
+	printf("time: %.3f s (%.0f ticks/s)\n", secs, secs > 0 ? ticks / secs : 0);
+
+	free_game(&mem, &w, &gs);
+	replay_close(&rp);
+
+	return 0;
+}
+
+/* the game of the config under root, all but the level out of mem */
+static bool load_game(arena *mem, world *w, game_state *gs, char const *root)
+{
+	bake b;
+	if (!bake_open(&b, root, GAME_CONF)) { return false; }
+
+	arena_init(mem);
+	entity_rule *e_rules;
+	bake_rules(&b, mem, &e_rules);
+	bake_world(&b, mem, w);
+	bake_game(&b, mem, gs, &screen, e_rules);
+	bake_close(&b);
+
+	gs->run = gs->logo.active ? MODE_LOGO : gs->intro.active ? MODE_INTRO : MODE_GAME;
+	clear_game(gs);
+
+	return true;
+}
+
+static void free_game(arena *mem, world *w, game_state *gs)
+{
+	destroy_game(gs);
+	destroy_world(w);
+	arena_free(mem);
+}
+
+/* converts a text replay, running the game alongside to add keyframes and
+ * state hashes */
+static bool import(char const *txt, char const *bin)
+{
+	FILE *in, *out;
+
+	in = fopen(txt, "r");
+	if (!in) {
+		fprintf(stderr, "error: could not open `%s'\n", txt);
+		return false;
+	}
+
+	out = fopen(bin, "wb");
+	if (!out) {
+		fprintf(stderr, "error: could not create `%s'\n", bin);
+		fclose(in);
+		return false;
+	}
+
+	char const *root = getenv(ROOTVAR);
+	arena mem;
+	world w;
+	game_state gs;
+	bool sim = root && *root && load_game(&mem, &w, &gs, root);
+	if (!sim) {
+		fprintf(stderr, "Warning: could not load the game, the replay will have no keyframes\n");
+	}
+
+	replay_writer rw;
+	bool ok = replay_create(&rw, out);
+
+	game_event e;
+	clear_event(&e);
+	while (ok && read_event(in, &e)) {
+		if (sim) {
+			replay_keyframe(&rw, &w, &gs);
+		}
+		ok = replay_record(&rw, &e);
+		if (sim) {
+			update_gamestate(&w, &gs, &e);
+			replay_hash(&rw, &w, &gs);
+		}
+		clear_event(&e);
+	}
+	ok = ok && replay_finish(&rw);
+
+	if (sim) {
+		free_game(&mem, &w, &gs);
+	}
+	fclose(in);
+	fclose(out);
+
+	return ok;
+}
+
+/* checks that the replays still play out the way they were recorded */
+static bool verify(char const *root, int n, char **files)
+{
+	int i, failed = 0;
+	clock_t start = clock();
+
+	for (i = 0; i < n; i++) {
+		replay rp;
+		if (!replay_open(&rp, files[i])) {
+			failed += 1;
+			continue;
+		}
+
+		if (rp.hdr->nhashes == 0) {
+			printf("%s: no state hashes, import it again\n", files[i]);
+			failed += 1;
+			replay_close(&rp);
+			continue;
+		}
+
+		arena mem;
+		world w;
+		game_state gs;
+		if (!load_game(&mem, &w, &gs, root)) {
+			replay_close(&rp);
+			return false;
+		}
+
+		uint32_t tick;
+		if (!replay_verify(&rp, &w, &gs, &tick)) {
+			printf("%s: differs from tick %u on\n", files[i], tick);
+			failed += 1;
+		} else if (rp.hdr->nhashes < rp.hdr->ticks) {
+			printf("%s: ok up to tick %u, where the config was reloaded\n", files[i], rp.hdr->nhashes);
+		} else {
+			printf("%s: ok\n", files[i]);
+		}
+
+		free_game(&mem, &w, &gs);
+		replay_close(&rp);
+	}
+
+	double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("%d of %d replays differ (%.3f s)\n", failed, n, secs);
+
+	return failed == 0;
+}
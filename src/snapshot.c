@@ -0,0 +1,227 @@
+#include <stdint.h>
+
+#include "core.h"
+
+/* A snapshot is a flat array of 32 bit integers: a header
+ * with the sizes it was taken with, the game state, every entity and
+ * finally the message frequencies, which change as messages are shown.
+ * The same values, fed through FNV-1a instead of into a buffer, make the
+ * state hash. */
+
+#define SNAP_HEADER 13
+#define SNAP_ENTITY 13
+
+#define FNV_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+typedef struct {
+	int32_t *p;
+	uint32_t hash;
+} sink;
+
+static void put_state(sink *s, world const *w, game_state const *gs);
+static void put_entity(sink *s, entity_state const *e);
+static void put(sink *s, int32_t v);
+static void get_entity(int32_t const **p, entity_state *e);
+static int msg_index(world const *w, message const *m);
+static bool msg_pointer(world const *w, int i, message const **m);
+
+size_t snapshot_size(world const *w, game_state const *gs)
+{
+	size_t n = SNAP_HEADER + 2 * SNAP_ENTITY + w->msg.n;
+
+	int g;
+	for (g = 0; g < NGROUPS; g++) {
+		n += SNAP_ENTITY * gs->entities[g].n;
+	}
+
+	return sizeof(int32_t) * n;
+}
+
+void snapshot_save(world const *w, game_state const *gs, void *buf)
+{
+	sink s = { p: buf };
+	put_state(&s, w, gs);
+}
+
+uint32_t snapshot_hash(world const *w, game_state const *gs)
+{
+	sink s = { p: 0, hash: FNV_BASIS };
+	put_state(&s, w, gs);
+
+	return s.hash;
+}
+
+/* `size' is the size the snapshot was saved with; nothing is restored unless
+ * it and the message shown fit the loaded config. */
+bool snapshot_restore(world *w, game_state *gs, void const *buf, size_t size)
+{
+	int32_t const *p = buf;
+	message const *msg;
+
+	if (size != snapshot_size(w, gs) ||
+	    p[0] != w->msg.n ||
+	    p[1] != gs->entities[GROUP_PLAYER].n ||
+	    p[2] != gs->entities[GROUP_OBJECTS].n ||
+	    p[3] != gs->entities[GROUP_ENEMIES].n) {
+		fprintf(stderr, "error: snapshot does not fit the loaded config\n");
+		return false;
+	} else if (!msg_pointer(w, p[7], &msg)) {
+		fprintf(stderr, "error: snapshot shows message %d of %u\n", p[7], w->msg.n);
+		return false;
+	}
+	p += 4;
+
+	gs->run = *p++;
+	gs->clock = *p++;
+	gs->need_to_collect = *p++;
+	gs->msg = msg;
+	p++;
+	gs->msg_timeout = *p++;
+	gs->debug.active = *p & 1;
+	gs->debug.pause = *p++ >> 1 & 1;
+	gs->debug.show_terrain_collision = *p++;
+	gs->debug.frames = *p & 1;
+	gs->debug.hitboxes = *p++ >> 1 & 1;
+	gs->debug.message_positions = *p++;
+
+	get_entity(&p, &gs->logo);
+	get_entity(&p, &gs->intro);
+
+	int g, i;
+	for (g = 0; g < NGROUPS; g++) {
+		for (i = 0; i < gs->entities[g].n; i++) {
+			entity_state e;
+			group_get(&gs->entities[g], i, &e);
+			get_entity(&p, &e);
+			group_put(&gs->entities[g], i, &e);
+		}
+	}
+
+	for (i = 0; i < w->msg.n; i++) {
+		w->msg.msgs[i].when = *p++;
+	}
+
+	return true;
+}
+
+/* low level */
+static void put_state(sink *s, world const *w, game_state const *gs)
+{
+	put(s, w->msg.n);
+	put(s, gs->entities[GROUP_PLAYER].n);
+	put(s, gs->entities[GROUP_OBJECTS].n);
+	put(s, gs->entities[GROUP_ENEMIES].n);
+	put(s, gs->run);
+	put(s, gs->clock);
+	put(s, gs->need_to_collect);
+	put(s, msg_index(w, gs->msg));
+	put(s, gs->msg_timeout);
+	put(s, gs->debug.active | gs->debug.pause << 1);
+	put(s, gs->debug.show_terrain_collision);
+	put(s, gs->debug.frames | gs->debug.hitboxes << 1);
+	put(s, gs->debug.message_positions);
+
+	put_entity(s, &gs->logo);
+	put_entity(s, &gs->intro);
+
+	int g, i;
+	for (g = 0; g < NGROUPS; g++) {
+		for (i = 0; i < gs->entities[g].n; i++) {
+			entity_state e;
+			group_get(&gs->entities[g], i, &e);
+			put_entity(s, &e);
+		}
+	}
+
+	for (i = 0; i < w->msg.n; i++) {
+		put(s, w->msg.msgs[i].when);
+	}
+}
+
+static void put_entity(sink *s, entity_state const *e)
+{
+	put(s, e->active);
+	put(s, e->pos.x);
+	put(s, e->pos.y);
+	put(s, e->hitbox.x);
+	put(s, e->hitbox.y);
+	put(s, e->hitbox.w);
+	put(s, e->hitbox.h);
+	put(s, e->dir);
+	put(s, e->st);
+	put(s, e->jump_timeout);
+	put(s, e->jump_type);
+	put(s, e->fall_time);
+	put(s, e->anim.start);
+}
+
+/* hashes the value byte by byte, low byte first, so the hash does not
+ * depend on the machine */
+static void put(sink *s, int32_t v)
+{
+	if (s->p) {
+		*s->p++ = v;
+		return;
+	}
+
+	uint32_t u = v;
+	int i;
+	for (i = 0; i < 4; i++) {
+		s->hash = (s->hash ^ (u & 0xff)) * FNV_PRIME;
+		u >>= 8;
+	}
+}
+
+static void get_entity(int32_t const **p, entity_state *e)
+{
+	int32_t const *q = *p;
+
+	e->active = *q++;
+	e->pos.x = *q++;
+	e->pos.y = *q++;
+	e->hitbox.x = *q++;
+	e->hitbox.y = *q++;
+	e->hitbox.w = *q++;
+	e->hitbox.h = *q++;
+	e->dir = *q++;
+	e->st = *q++;
+	e->jump_timeout = *q++;
+	e->jump_type = *q++;
+	e->fall_time = *q++;
+	e->anim.start = *q++;
+
+	*p = q;
+}
+
+/* messages are saved by position: the regular ones by index, followed by
+ * the two finish messages */
+static int msg_index(world const *w, message const *m)
+{
+	if (!m) {
+		return -1;
+	} else if (m == &w->finish.win) {
+		return w->msg.n;
+	} else if (m == &w->finish.loss) {
+		return w->msg.n + 1;
+	}
+
+	return m - w->msg.msgs;
+}
+
+static bool msg_pointer(world const *w, int i, message const **m)
+{
+	if (i < -1 || i > (int) w->msg.n + 1) {
+		return false;
+	} else if (i == -1) {
+		*m = 0;
+	} else if (i == w->msg.n) {
+		*m = &w->finish.win;
+	} else if (i == w->msg.n + 1) {
+		*m = &w->finish.loss;
+	} else {
+		*m = &w->msg.msgs[i];
+	}
+
+	return true;
+}
@@ -0,0 +1,122 @@
+#include "core.h"
+
+/* Triggers are points the player sets off by covering them with its
+ * hitbox.  They are bucketed into a grid, and the triggers in the cells
+ * the hitbox covered at the last lookup are kept, so as long as the
+ * player stays within the same cells finding them costs nothing. */
+
+#define TRIGGER_CELL 128
+
+static void add_trigger(trigger_index *ti, enum trigger_kind k, int i, point const *p);
+static void build_cells(trigger_index *ti, arena *mem);
+static int cell_of(int v, int o);
+
+/* Indexes the messages and the finish, once both are loaded, out of the
+ * arena they were loaded into. */
+void index_triggers(world *w, arena *mem)
+{
+	trigger_index *ti = &w->triggers;
+	*ti = (trigger_index) { n: 0 };
+	ti->t = arena_alloc(mem, sizeof(trigger) * (w->msg.n + 1));
+
+	unsigned i;
+	for (i = 0; i < w->msg.n; i++) {
+		add_trigger(ti, TRIGGER_MESSAGE, i, &w->msg.msgs[i].pos);
+	}
+	add_trigger(ti, TRIGGER_FINISH, 0, &w->finish.pos);
+
+	build_cells(ti, mem);
+}
+
+/* Points ids at the triggers that may lie in r, in ascending order, and
+ * returns how many there are. */
+int near_triggers(world *w, rect const *r, int const **ids)
+{
+	trigger_index *ti = &w->triggers;
+
+	int x0 = r->w < 0 ? r->x + r->w : r->x;
+	int x1 = r->w < 0 ? r->x : r->x + r->w;
+	int y0 = r->h < 0 ? r->y + r->h : r->y;
+	int y1 = r->h < 0 ? r->y : r->y + r->h;
+	rect c = { x: cell_of(x0, ti->x0), y: cell_of(y0, ti->y0) };
+	c.w = cell_of(x1, ti->x0) - c.x;
+	c.h = cell_of(y1, ti->y0) - c.y;
+
+	*ids = ti->near;
+	if (ti->cached && c.x == ti->cells.x && c.y == ti->cells.y && c.w == ti->cells.w && c.h == ti->cells.h) {
+		return ti->nnear;
+	}
+
+	ti->cached = true;
+	ti->cells = c;
+	ti->nnear = 0;
+
+	int cx, cy, k;
+	for (cy = c.y < 0 ? 0 : c.y; cy <= c.y + c.h && cy < ti->ny; cy++) {
+		for (cx = c.x < 0 ? 0 : c.x; cx <= c.x + c.w && cx < ti->nx; cx++) {
+			int cell = cy * ti->nx + cx;
+			for (k = ti->start[cell]; k < ti->start[cell + 1]; k++) {
+				/* keep them in order, a trigger lies in one cell only */
+				int j, id = ti->idx[k];
+				for (j = ti->nnear; j > 0 && ti->near[j - 1] > id; j--) {
+					ti->near[j] = ti->near[j - 1];
+				}
+				ti->near[j] = id;
+				ti->nnear += 1;
+			}
+		}
+	}
+
+	return ti->nnear;
+}
+
+/* low level */
+static void add_trigger(trigger_index *ti, enum trigger_kind k, int i, point const *p)
+{
+	ti->t[ti->n] = (trigger) { kind: k, i: i, pos: *p };
+	ti->n += 1;
+}
+
+static void build_cells(trigger_index *ti, arena *mem)
+{
+	int i, x1, y1;
+	ti->x0 = x1 = ti->t[0].pos.x;
+	ti->y0 = y1 = ti->t[0].pos.y;
+	for (i = 1; i < ti->n; i++) {
+		point const *p = &ti->t[i].pos;
+		if (p->x < ti->x0) { ti->x0 = p->x; }
+		if (p->x > x1) { x1 = p->x; }
+		if (p->y < ti->y0) { ti->y0 = p->y; }
+		if (p->y > y1) { y1 = p->y; }
+	}
+	ti->nx = cell_of(x1, ti->x0) + 1;
+	ti->ny = cell_of(y1, ti->y0) + 1;
+
+	int nc = ti->nx * ti->ny;
+	ti->start = arena_alloc(mem, sizeof(int) * (nc + 1));
+	ti->idx = arena_alloc(mem, sizeof(int) * ti->n);
+	ti->near = arena_alloc(mem, sizeof(int) * ti->n);
+	memset(ti->start, 0, sizeof(int) * (nc + 1));
+
+	for (i = 0; i < ti->n; i++) {
+		point const *p = &ti->t[i].pos;
+		ti->start[cell_of(p->y, ti->y0) * ti->nx + cell_of(p->x, ti->x0) + 1] += 1;
+	}
+	for (i = 0; i < nc; i++) {
+		ti->start[i + 1] += ti->start[i];
+	}
+
+	int *fill = malloc(sizeof(int) * nc);
+	memcpy(fill, ti->start, sizeof(int) * nc);
+	for (i = 0; i < ti->n; i++) {
+		point const *p = &ti->t[i].pos;
+		ti->idx[fill[cell_of(p->y, ti->y0) * ti->nx + cell_of(p->x, ti->x0)]++] = i;
+	}
+	free(fill);
+}
+
+/* the cell v falls in counting from o, rounding down for those before o */
+static int cell_of(int v, int o)
+{
+	return v >= o ? (v - o) / TRIGGER_CELL : -((o - v + TRIGGER_CELL - 1) / TRIGGER_CELL);
+}
@@ -0,0 +1,83 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "watch.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+static char const * const watch_dirs[NWATCH] = { CONF_DIR, ASSET_DIR };
+
+bool watch_open(file_watch *w, char const *root)
+{
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0) {
+		fprintf(stderr, "Warning: could not watch the config: %s\n", strerror(errno));
+		return false;
+	}
+
+	int i;
+	for (i = 0; i < NWATCH; i++) {
+		/* editors either write in place or move a new file over */
+		char const *p = set_path("%s/%s", root, watch_dirs[i]);
+		w->wd[i] = inotify_add_watch(w->fd, p, IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (w->wd[i] < 0) {
+			fprintf(stderr, "Warning: could not watch `%s': %s\n", p, strerror(errno));
+			watch_close(w);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Calls f with every file that changed since the last call, without
+ * waiting for any, and returns how many there were. */
+int watch_poll(file_watch *w, void (*f)(enum watch_dir d, char const *name, void *), void *data)
+{
+	/* aligned for the events, as inotify(7) asks */
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	int n = 0;
+	ssize_t len;
+
+	while ((len = read(w->fd, buf, sizeof(buf))) > 0) {
+		char *p = buf;
+		while (p < buf + len) {
+			struct inotify_event const *ev = (struct inotify_event const *) p;
+			p += sizeof(struct inotify_event) + ev->len;
+			if (ev->len == 0) { continue; }
+
+			int i;
+			for (i = 0; i < NWATCH && w->wd[i] != ev->wd; i++) {}
+			if (i == NWATCH) { continue; }
+
+			f(i, ev->name, data);
+			n += 1;
+		}
+	}
+
+	return n;
+}
+
+void watch_close(file_watch *w)
+{
+	if (w->fd >= 0) { close(w->fd); }
+	w->fd = -1;
+}
+#else
+bool watch_open(file_watch *w, char const *root)
+{
+	w->fd = -1;
+	return false;
+}
+
+int watch_poll(file_watch *w, void (*f)(enum watch_dir d, char const *name, void *), void *data)
+{
+	return 0;
+}
+
+void watch_close(file_watch *w)
+{
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef FRIDGE_WATCH_H
+#define FRIDGE_WATCH_H
+
+/* Watches conf/ and assets/ for files that were written or moved into
+ * place, so the game can reload just those.  Only Linux has a watcher
+ * (inotify); elsewhere watch_open fails and the game keeps its manual
+ * reload. */
+
+#include "core.h"
+
+enum watch_dir { WATCH_CONF, WATCH_ASSETS, NWATCH };
+
+typedef struct {
+	int fd;
+	int wd[NWATCH];
+} file_watch;
+
+bool watch_open(file_watch *w, char const *root);
+int watch_poll(file_watch *w, void (*f)(enum watch_dir d, char const *name, void *), void *data);
+void watch_close(file_watch *w);
+
+#endif